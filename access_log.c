@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "access_log.h"
+#include "stats.h"
+
+#define RING_MASK (ACCESS_LOG_RING_SLOTS - 1)
+#define SEEN_SLOTS 1024         // paths a thread remembers having logged, direct mapped
+#define FLUSH_IOV 128           // ring pieces gathered into one writev
+#define LOG_PATH_SIZE 4096
+
+_Static_assert(sizeof(union access_log_slot) == 64, "access log records must be 64 bytes");
+_Static_assert((ACCESS_LOG_RING_SLOTS & RING_MASK) == 0, "ACCESS_LOG_RING_SLOTS must be a power of two");
+
+// One thread's records. The producer and the flusher each write their own
+// index on a cache line of its own and only read the other's.
+struct access_log_ring
+{
+    union access_log_slot slots[ACCESS_LOG_RING_SLOTS];
+
+    // Written by the producer
+    uint64_t head __attribute__((aligned(64)));     // records appended so far
+    uint64_t tail_seen;                             // tail when the producer last looked
+    unsigned long generation;                       // file the seen paths were logged to
+    uint64_t seen[SEEN_SLOTS];
+
+    // Written by the flusher
+    uint64_t tail __attribute__((aligned(64)));     // records written out so far
+    struct access_log_ring *next;
+    uint16_t id;
+};
+
+int access_log_enabled;
+
+static __thread struct access_log_ring *local_ring;
+
+// Every thread's ring, for the flusher; rings are only ever added at the head
+static struct access_log_ring *all_rings;
+static uint16_t num_rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// State of the flusher
+static char log_path[LOG_PATH_SIZE];
+static uint64_t log_rotate_size;
+static int log_fd = -1;
+static uint64_t log_size;
+static unsigned long log_generation;    // bumped with every new file, so paths are logged again
+static int log_reopen;
+static int log_stop;
+static pthread_t log_thread;
+
+static struct access_log_ring *register_ring(void)
+{
+    struct access_log_ring *ring = aligned_alloc(64, sizeof(*ring));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->generation = __atomic_load_n(&log_generation, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&rings_lock);
+    ring->id = num_rings++;
+    ring->next = all_rings;
+    __atomic_store_n(&all_rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rings_lock);
+    local_ring = ring;
+    return ring;
+}
+
+// Room for n more records in the ring, checking the flusher's progress only
+// when the last known tail says it is full
+static int ring_room(struct access_log_ring *ring, uint64_t n)
+{
+    if (ring->head + n - ring->tail_seen <= ACCESS_LOG_RING_SLOTS)
+    {
+        return 1;
+    }
+    ring->tail_seen = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return ring->head + n - ring->tail_seen <= ACCESS_LOG_RING_SLOTS;
+}
+
+static void count_dropped(uint64_t n)
+{
+    stats_add(&stats_thread()->log_dropped, n);
+}
+
+uint64_t access_log_path_hash(const char *path)
+{
+    // FNV-1a, with 0 kept for requests without a path
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const char *p;
+    for (p = path; *p != '\0'; p++)
+    {
+        hash = (hash ^ (unsigned char)*p) * 0x100000001b3ULL;
+    }
+    hash += hash == 0;
+
+    struct access_log_ring *ring = local_ring != NULL ? local_ring : register_ring();
+    if (ring == NULL)
+    {
+        return hash;
+    }
+
+    // A new file does not have the paths of the old one
+    unsigned long generation = __atomic_load_n(&log_generation, __ATOMIC_RELAXED);
+    if (ring->generation != generation)
+    {
+        memset(ring->seen, 0, sizeof(ring->seen));
+        ring->generation = generation;
+    }
+    uint64_t *seen = &ring->seen[hash % SEEN_SLOTS];
+    if (*seen == hash)
+    {
+        return hash;
+    }
+
+    // Write the whole path or none of it; without it the decoder shows the hash
+    size_t len = p - path;
+    uint64_t pieces = (len + sizeof(ring->slots[0].path.text) - 1) / sizeof(ring->slots[0].path.text);
+    pieces += pieces == 0;
+    if (!ring_room(ring, pieces))
+    {
+        count_dropped(pieces);
+        return hash;
+    }
+
+    // The flusher only sees the pieces once head moves past all of them
+    uint64_t head = ring->head;
+    size_t off = 0;
+    do
+    {
+        struct access_log_path *piece = &ring->slots[head++ & RING_MASK].path;
+        size_t n = len - off < sizeof(piece->text) ? len - off : sizeof(piece->text);
+        piece->type = ACCESS_LOG_PATH;
+        piece->len = n;
+        piece->more = off + n < len;
+        piece->hash = hash;
+        memcpy(piece->text, path + off, n);
+        off += n;
+    } while (off < len);
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    *seen = hash;
+    return hash;
+}
+
+void access_log_append(const struct access_log_record *record)
+{
+    struct access_log_ring *ring = local_ring != NULL ? local_ring : register_ring();
+    if (ring == NULL || !ring_room(ring, 1))
+    {
+        count_dropped(1);
+        return;
+    }
+    struct access_log_record *slot = &ring->slots[ring->head & RING_MASK].request;
+    *slot = *record;
+    slot->type = ACCESS_LOG_REQUEST;
+    slot->thread = ring->id;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t wall_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Write every byte of iov, resuming after partial writes. Returns -1 on failure.
+static int write_all(struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(log_fd, iov, iovcnt);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        log_size += n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Open the log, starting a new file with a header. Returns -1 on failure.
+static int open_file(void)
+{
+    struct stat st;
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd == -1 || fstat(log_fd, &st) == -1)
+    {
+        perror(log_path);
+        return -1;
+    }
+    log_size = st.st_size;
+    __atomic_add_fetch(&log_generation, 1, __ATOMIC_RELAXED);
+
+    if (log_size == 0)
+    {
+        struct access_log_header header;
+        memset(&header, 0, sizeof(header));
+        header.type = ACCESS_LOG_HEADER;
+        header.version = ACCESS_LOG_VERSION;
+        memcpy(header.magic, ACCESS_LOG_MAGIC, sizeof(ACCESS_LOG_MAGIC));
+        header.record_size = sizeof(union access_log_slot);
+        header.start_ns = wall_clock_ns();
+        struct iovec iov = {&header, sizeof(header)};
+        if (write_all(&iov, 1) == -1)
+        {
+            perror(log_path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void reopen_file(void)
+{
+    if (log_fd != -1)
+    {
+        close(log_fd);
+        log_fd = -1;
+    }
+    open_file();
+}
+
+// Shift <path>.1 to <path>.2 and so on, dropping the oldest, and start over
+static void rotate_file(void)
+{
+    char from[LOG_PATH_SIZE + 16], to[LOG_PATH_SIZE + 16];
+    int i;
+    for (i = ACCESS_LOG_KEEP; i > 1; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%d", log_path, i - 1);
+        snprintf(to, sizeof(to), "%s.%d", log_path, i);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", log_path);
+    if (rename(log_path, to) == -1)
+    {
+        perror("rename");
+    }
+    reopen_file();
+}
+
+// Write the gathered pieces out and hand their slots back to the producers.
+// Records that cannot be written are dropped so the rings keep moving.
+static void write_batch(struct iovec *iov, int iovcnt, struct access_log_ring **rings, const uint64_t *heads,
+                        int count)
+{
+    uint64_t records = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++)
+    {
+        records += iov[i].iov_len / sizeof(union access_log_slot);
+    }
+    if (log_fd == -1 || write_all(iov, iovcnt) == -1)
+    {
+        count_dropped(records);
+    }
+    for (i = 0; i < count; i++)
+    {
+        __atomic_store_n(&rings[i]->tail, heads[i], __ATOMIC_RELEASE);
+    }
+}
+
+// Drain every ring into the file, as few writev calls as the pieces allow
+static void flush_rings(void)
+{
+    struct iovec iov[FLUSH_IOV];
+    struct access_log_ring *batch[FLUSH_IOV / 2];
+    uint64_t heads[FLUSH_IOV / 2];
+    int iovcnt = 0, count = 0;
+
+    struct access_log_ring *ring;
+    for (ring = __atomic_load_n(&all_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+    {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+        if (head == tail)
+        {
+            continue;
+        }
+
+        // The records from tail to head, in two pieces when they wrap around
+        uint64_t first = tail & RING_MASK, n = head - tail;
+        uint64_t run = n < ACCESS_LOG_RING_SLOTS - first ? n : ACCESS_LOG_RING_SLOTS - first;
+        iov[iovcnt].iov_base = &ring->slots[first];
+        iov[iovcnt++].iov_len = run * sizeof(union access_log_slot);
+        if (run < n)
+        {
+            iov[iovcnt].iov_base = &ring->slots[0];
+            iov[iovcnt++].iov_len = (n - run) * sizeof(union access_log_slot);
+        }
+        batch[count] = ring;
+        heads[count++] = head;
+
+        if (iovcnt > FLUSH_IOV - 2)
+        {
+            write_batch(iov, iovcnt, batch, heads, count);
+            iovcnt = count = 0;
+        }
+    }
+    if (iovcnt > 0)
+    {
+        write_batch(iov, iovcnt, batch, heads, count);
+    }
+}
+
+static void *flusher_main(void *arg)
+{
+    struct timespec interval = {0, ACCESS_LOG_FLUSH_MS * 1000000L};
+    int stop;
+    (void)arg;
+
+    do
+    {
+        nanosleep(&interval, NULL);
+        stop = __atomic_load_n(&log_stop, __ATOMIC_ACQUIRE);
+        if (__atomic_exchange_n(&log_reopen, 0, __ATOMIC_ACQUIRE))
+        {
+            reopen_file();
+        }
+        flush_rings();
+        if (log_rotate_size != 0 && log_size >= log_rotate_size)
+        {
+            rotate_file();
+        }
+    } while (!stop);
+    return NULL;
+}
+
+int access_log_open(const char *path, uint64_t rotate_size)
+{
+    if (strlen(path) >= sizeof(log_path))
+    {
+        fprintf(stderr, "access log path too long\n");
+        return -1;
+    }
+    strcpy(log_path, path);
+    log_rotate_size = rotate_size;
+    if (open_file() == -1)
+    {
+        return -1;
+    }
+
+    int err = pthread_create(&log_thread, NULL, flusher_main, NULL);
+    if (err != 0)
+    {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        return -1;
+    }
+    __atomic_store_n(&access_log_enabled, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void access_log_reopen(void)
+{
+    __atomic_store_n(&log_reopen, 1, __ATOMIC_RELEASE);
+}
+
+void access_log_close(void)
+{
+    if (!access_log_active())
+    {
+        return;
+    }
+    __atomic_store_n(&access_log_enabled, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(log_thread, NULL);
+    close(log_fd);
+    log_fd = -1;
+}
@@ -0,0 +1,103 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdint.h>
+
+// The access log is a file of fixed-size binary records. Each thread appends
+// its records to a single-producer, single-consumer ring of its own, without
+// locks or system calls; a flusher thread drains all the rings into the file
+// with one writev per pass and rotates it once it grows too big. A record
+// that finds its ring full is dropped and counted, the request never waits.
+// logdecode turns a log back into text or CSV.
+#define ACCESS_LOG_MAGIC "CNLOG1"
+#define ACCESS_LOG_VERSION 1
+#define ACCESS_LOG_RING_SLOTS 8192      // records buffered per thread, a power of two
+#define ACCESS_LOG_FLUSH_MS 50          // how often the flusher drains the rings
+#define ACCESS_LOG_KEEP 4               // rotated files kept, as <path>.1 to <path>.N
+
+// Size a log grows to before it is rotated, by default
+#define ACCESS_LOG_DEFAULT_ROTATE (64 << 20)
+
+// Types of records
+#define ACCESS_LOG_HEADER 1     // first record of every file
+#define ACCESS_LOG_REQUEST 2    // one response
+#define ACCESS_LOG_PATH 3       // a piece of the path a hash stands for
+
+// Flags of a request record
+#define ACCESS_LOG_ABORTED 1    // the connection closed before the response was sent completely
+#define ACCESS_LOG_CLOSE 2      // the connection was closed after the response
+
+struct access_log_header
+{
+    uint32_t type;
+    uint32_t version;
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t start_ns;          // when the file was opened, ns since the epoch
+    char pad[32];
+};
+
+struct access_log_record
+{
+    uint32_t type;
+    uint16_t status;            // status code of the response
+    uint16_t thread;            // ring the record came through
+    uint64_t time_ns;           // when the response finished, ns since the epoch
+    uint64_t path_hash;         // request path, named by an earlier ACCESS_LOG_PATH record; 0 for none
+    uint64_t bytes;             // bytes of the response written to the socket
+    uint64_t send_ns;           // queuing the response to its last byte leaving
+    uint32_t peer_addr;         // IPv4 address of the client in network order, 0 if unknown
+    uint16_t peer_port;
+    uint16_t flags;             // ACCESS_LOG_ABORTED, ACCESS_LOG_CLOSE
+    uint32_t parse_ns;          // parsing the request head
+    uint32_t open_ns;           // opening a file that missed the caches, 0 if none was opened
+    uint64_t reserved;
+};
+
+// Paths are logged once per thread and file; longer ones take several
+// records with more set on all but the last
+struct access_log_path
+{
+    uint32_t type;
+    uint16_t len;               // bytes of text used
+    uint16_t more;
+    uint64_t hash;
+    char text[48];
+};
+
+union access_log_slot
+{
+    uint32_t type;
+    struct access_log_header header;
+    struct access_log_record request;
+    struct access_log_path path;
+};
+
+// Set while a log is open, so callers can skip building records
+extern int access_log_enabled;
+
+static inline int access_log_active(void)
+{
+    return __atomic_load_n(&access_log_enabled, __ATOMIC_RELAXED);
+}
+
+// Append records to the file at path and start the flusher. The file is
+// rotated when it reaches rotate_size bytes, never if 0. Returns -1 on failure.
+int access_log_open(const char *path, uint64_t rotate_size);
+
+// Have the flusher close and reopen the file, after it was moved away
+void access_log_reopen(void);
+
+// Stop the flusher after writing out what the rings hold
+void access_log_close(void);
+
+// The hash a request record names path by. Writes the path records the
+// first time this thread logs path into the current file.
+uint64_t access_log_path_hash(const char *path);
+
+// Queue a request record through this thread's ring, or count it as dropped
+// if the ring is full
+void access_log_append(const struct access_log_record *record);
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "admission.h"
+#include "stats.h"
+
+// Connections per client address, in open-addressing tables with linear
+// probing. Address 0 never connects, so it marks a free slot.
+struct addr_slot
+{
+    uint32_t addr;
+    uint32_t count;
+};
+
+struct addr_shard
+{
+    pthread_mutex_t lock;
+    struct addr_slot *slots;
+    uint32_t mask;
+} __attribute__((aligned(64)));
+
+static int max_conns;
+static int max_per_addr;
+static int queue_high, queue_low;
+static uint64_t lag_high_ns, lag_low_ns;
+
+static int connections __attribute__((aligned(64)));
+static struct addr_shard shards[ADMISSION_SHARDS];
+
+// Spread addresses over the shards with the top bits and over the slots
+// of a shard with the ones below
+static uint32_t addr_hash(uint32_t addr)
+{
+    return addr * 0x9e3779b1u;
+}
+
+static struct addr_shard *shard_of(uint32_t hash)
+{
+    return &shards[hash >> (32 - ADMISSION_SHARD_BITS)];
+}
+
+static uint32_t home_slot(const struct addr_shard *shard, uint32_t addr)
+{
+    return (addr_hash(addr) >> 4) & shard->mask;
+}
+
+int admission_init(int max_connections, int max_per_address, int queue_high_mark, int lag_high_ms)
+{
+    // Leave a quarter of the descriptors to the files being served
+    if (max_connections == 0)
+    {
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == -1)
+        {
+            perror("getrlimit");
+            return -1;
+        }
+        rlim_t usable = limit.rlim_max < (1 << 20) ? limit.rlim_max : (1 << 20);
+        max_connections = usable / 4 * 3;
+    }
+    max_conns = max_connections;
+    max_per_addr = max_per_address;
+    queue_high = queue_high_mark;
+    queue_low = queue_high_mark / 4;
+    lag_high_ns = (uint64_t)lag_high_ms * 1000000;
+    lag_low_ns = lag_high_ns / 4;
+
+    if (max_per_addr == 0)
+    {
+        return 0;
+    }
+
+    // Every address holds a connection, so twice the connection cap spread over
+    // the shards keeps them at most half full unless the addresses cluster
+    uint32_t slots = 64;
+    while (slots < 2 * (uint32_t)max_conns / ADMISSION_SHARDS)
+    {
+        slots *= 2;
+    }
+    int i;
+    for (i = 0; i < ADMISSION_SHARDS; i++)
+    {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        shards[i].slots = calloc(slots, sizeof(struct addr_slot));
+        shards[i].mask = slots - 1;
+        if (shards[i].slots == NULL)
+        {
+            perror("calloc");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Count a connection from addr. Returns 0 if the address is at its cap, or
+// its shard is full.
+static int take_addr(uint32_t addr)
+{
+    struct addr_shard *shard = shard_of(addr_hash(addr));
+    uint32_t i = home_slot(shard, addr), probes;
+    int taken = 0;
+
+    pthread_mutex_lock(&shard->lock);
+    for (probes = 0; probes <= shard->mask; probes++, i = (i + 1) & shard->mask)
+    {
+        struct addr_slot *slot = &shard->slots[i];
+        if (slot->addr == addr || slot->addr == 0)
+        {
+            taken = slot->count < (uint32_t)max_per_addr;
+            if (taken)
+            {
+                slot->addr = addr;
+                slot->count++;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return taken;
+}
+
+// Count a connection from addr as closed, freeing the slot with the last one.
+// The entries after it move back so no probe sequence has a hole in it.
+static void put_addr(uint32_t addr)
+{
+    struct addr_shard *shard = shard_of(addr_hash(addr));
+    uint32_t i = home_slot(shard, addr);
+
+    pthread_mutex_lock(&shard->lock);
+    while (shard->slots[i].addr != addr && shard->slots[i].addr != 0)
+    {
+        i = (i + 1) & shard->mask;
+    }
+    if (shard->slots[i].addr == addr && --shard->slots[i].count == 0)
+    {
+        uint32_t j = i;
+        while (1)
+        {
+            j = (j + 1) & shard->mask;
+            uint32_t next = shard->slots[j].addr;
+            if (next == 0)
+            {
+                break;
+            }
+
+            // An entry whose home lies cyclically in (i, j] is still reachable
+            uint32_t home = home_slot(shard, next);
+            if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            {
+                continue;
+            }
+            shard->slots[i] = shard->slots[j];
+            i = j;
+        }
+        shard->slots[i].addr = 0;
+        shard->slots[i].count = 0;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+enum admission_result admission_admit(const struct admission_load *load, uint32_t addr)
+{
+    if (load->shedding)
+    {
+        return ADMISSION_SHEDDING;
+    }
+    if (__atomic_add_fetch(&connections, 1, __ATOMIC_RELAXED) > max_conns)
+    {
+        __atomic_sub_fetch(&connections, 1, __ATOMIC_RELAXED);
+        return ADMISSION_TOO_MANY;
+    }
+    if (max_per_addr != 0 && addr != 0 && !take_addr(addr))
+    {
+        __atomic_sub_fetch(&connections, 1, __ATOMIC_RELAXED);
+        return ADMISSION_PER_ADDR;
+    }
+    return ADMISSION_OK;
+}
+
+void admission_release(uint32_t addr)
+{
+    __atomic_sub_fetch(&connections, 1, __ATOMIC_RELAXED);
+    if (max_per_addr != 0 && addr != 0)
+    {
+        put_addr(addr);
+    }
+}
+
+void admission_update(struct admission_load *load, uint64_t batch_ns, int queued)
+{
+    // Average over about the last eight batches, so one slow batch does not trip it
+    load->lag_ns = load->lag_ns - load->lag_ns / 8 + batch_ns / 8;
+
+    int over = (queue_high != 0 && queued >= queue_high) || (lag_high_ns != 0 && load->lag_ns >= lag_high_ns);
+    int under = queued <= queue_low && load->lag_ns <= lag_low_ns;
+    if (!load->shedding && over)
+    {
+        load->shedding = 1;
+    }
+    else if (load->shedding && under)
+    {
+        load->shedding = 0;
+    }
+}
+
+void admission_reject(int fd)
+{
+    static const char response[] = ADMISSION_RESPONSE;
+    char discard[4096];
+
+    recv(fd, discard, sizeof(discard), MSG_DONTWAIT);
+    send(fd, response, sizeof(response) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+    stats_add(&stats_thread()->rejected, 1);
+    stats_response(503);
+}
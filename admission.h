@@ -0,0 +1,67 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+
+// Admission control keeps an overloaded server answering quickly instead of
+// queuing work it cannot keep up with. Connections are admitted against a
+// cap for the whole process and a cap per client address; every event loop
+// also watches its own load, the files waiting for the offload pool and the
+// time it takes to get through a batch of events, and sheds new requests
+// while either is above its high watermark until both fall below their low
+// ones. Whatever is turned away gets a pre-serialized 503.
+#define ADMISSION_RETRY_AFTER "1"   // seconds a turned-away client should wait
+#define ADMISSION_SHARD_BITS 4      // address hash bits picking one of the locks over the address table
+#define ADMISSION_SHARDS (1 << ADMISSION_SHARD_BITS)
+#define ADMISSION_MAX_UNADMITTED 64 // turned-away connections a loop keeps open to read their request
+
+// Defaults of the load watermarks; the low ones are a quarter of the high ones
+#define ADMISSION_DEFAULT_QUEUE_HIGH 192
+#define ADMISSION_DEFAULT_LAG_HIGH_MS 20
+
+// The whole response to a request that is turned away
+#define ADMISSION_RESPONSE "HTTP/1.1 503 Service Unavailable\r\nRetry-After: " ADMISSION_RETRY_AFTER \
+                           "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+
+// Why a connection was not admitted
+enum admission_result
+{
+    ADMISSION_OK,
+    ADMISSION_TOO_MANY,     // the process is at its connection cap
+    ADMISSION_PER_ADDR,     // the client address is at its cap
+    ADMISSION_SHEDDING      // the event loop is overloaded
+};
+
+// Load of one event loop
+struct admission_load
+{
+    int shedding;           // answering new requests with 503
+    int unadmitted;         // connections open to answer their request with the 503
+    uint64_t lag_ns;        // moving average of the time a batch of events takes
+};
+
+// Set the caps: max_conns connections in all (0 for 3/4 of the descriptor
+// limit), max_per_addr per client address (0 for none), and the high
+// watermarks of the offload queue depth and batch time in milliseconds
+// (0 to ignore one). Returns -1 on failure.
+int admission_init(int max_conns, int max_per_addr, int queue_high, int lag_high_ms);
+
+// Admit a new connection from addr, an IPv4 address in network order or 0
+// if unknown, on a loop with load. A connection that is admitted must be
+// released with admission_release.
+enum admission_result admission_admit(const struct admission_load *load, uint32_t addr);
+
+// A connection admission_admit let in closed
+void admission_release(uint32_t addr);
+
+// A loop got through a batch of events in batch_ns with queued jobs waiting
+// for the offload pool: start or stop shedding
+void admission_update(struct admission_load *load, uint64_t batch_ns, int queued);
+
+// Answer a socket that was not admitted with the 503 and close it, for when
+// not even a connection to read its request on can be spared. What the client
+// already sent is read first, but a request arriving after the close resets
+// the connection and may take the response with it.
+void admission_reject(int fd);
+
+#endif
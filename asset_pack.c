@@ -0,0 +1,678 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "asset_pack.h"
+#include "compress.h"
+#include "file_cache.h"
+#include "http.h"
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+struct asset_image
+{
+    char *base;         // the header, followed by the rest of the image
+    size_t map_len;
+    int refs;
+};
+
+// A representation found while walking the serving directory
+struct pack_file
+{
+    char *path;         // below the serving directory
+    struct stat st;     // of the file the body comes from
+    int encoding;
+    char *body;         // compressed variant made here, NULL to read the file
+    size_t size;
+    int source;         // file whose body this variant shares, -1 for its own
+    uint64_t data;      // offset of the body in the image
+};
+
+struct pack_list
+{
+    struct pack_file *files;
+    int count;
+    int capacity;
+};
+
+struct asset_pack
+{
+    struct asset_image *image;
+    struct asset_pack *next_retired;
+    struct file_cache_entry *entries;
+    unsigned char *encodings;   // coding of each entry's body
+    int count;
+    int *slots;         // open addressing by hash: entry index + 1, 0 if empty
+    size_t mask;
+    char *headers;      // the rendered heads of all entries
+};
+
+// The image loops switch to, guarded by publish_lock
+static pthread_mutex_t publish_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct asset_image *published;
+static unsigned long published_generation;
+
+static struct pack_file *add_file(struct pack_list *list)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity * 2 + 64;
+        struct pack_file *files = realloc(list->files, capacity * sizeof(*files));
+        if (files == NULL)
+        {
+            return NULL;
+        }
+        list->files = files;
+        list->capacity = capacity;
+    }
+    struct pack_file *file = &list->files[list->count++];
+    memset(file, 0, sizeof(*file));
+    file->source = -1;
+    return file;
+}
+
+static void free_list(struct pack_list *list)
+{
+    int i;
+    for (i = 0; i < list->count; i++)
+    {
+        free(list->files[i].path);
+        free(list->files[i].body);
+    }
+    free(list->files);
+}
+
+// Collect the regular files below root/dir_path. Symlinks are left out: they
+// could lead out of the serving directory, and requests for them still find
+// the filesystem.
+static int walk(struct pack_list *list, const char *root, const char *dir_path)
+{
+    char full_path[4096];
+    snprintf(full_path, sizeof(full_path), "%s/%s", root, dir_path);
+    DIR *dir = opendir(full_path);
+    if (dir == NULL)
+    {
+        perror(full_path);
+        return -1;
+    }
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL)
+    {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char child[4096];
+        struct stat child_stat;
+        if (snprintf(child, sizeof(child), "%s%s%s", dir_path, *dir_path != '\0' ? "/" : "", dirent->d_name) >=
+                (int)sizeof(child) ||
+            snprintf(full_path, sizeof(full_path), "%s/%s", root, child) >= (int)sizeof(full_path) ||
+            lstat(full_path, &child_stat) == -1)
+        {
+            continue;
+        }
+        if (S_ISDIR(child_stat.st_mode))
+        {
+            if (walk(list, root, child) == -1)
+            {
+                closedir(dir);
+                return -1;
+            }
+        }
+        else if (S_ISREG(child_stat.st_mode))
+        {
+            struct pack_file *file = add_file(list);
+            if (file == NULL || (file->path = strdup(child)) == NULL)
+            {
+                closedir(dir);
+                return -1;
+            }
+            file->st = child_stat;
+            file->size = child_stat.st_size;
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(((const struct pack_file *)a)->path, ((const struct pack_file *)b)->path);
+}
+
+// Read the size bytes of the file at root/path into buf
+static int read_file(const char *root, const char *path, char *buf, size_t size)
+{
+    char full_path[4096];
+    snprintf(full_path, sizeof(full_path), "%s/%s", root, path);
+    int fd = open(full_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+    {
+        perror(full_path);
+        return -1;
+    }
+
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(fd, buf + done, size - done, done);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            fprintf(stderr, "%s: changed while packing\n", full_path);
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+    close(fd);
+    return 0;
+}
+
+// Add the gzip and brotli variants of the files worth compressing: a sidecar
+// of the file when there is one, otherwise a copy compressed here. The list
+// is sorted by path, so sidecars are found with a binary search.
+static int add_variants(struct pack_list *list, const char *root)
+{
+    static const int encodings[] = {HTTP_ENCODING_BR, HTTP_ENCODING_GZIP};
+    int num_files = list->count, i;
+    size_t e;
+
+    for (i = 0; i < num_files; i++)
+    {
+        if (list->files[i].size < COMPRESS_MIN_SIZE || list->files[i].size > FILE_CACHE_MAX_ENTRY ||
+            !http_mime_compressible(http_mime_lookup(list->files[i].path)))
+        {
+            continue;
+        }
+
+        char *body = NULL;
+        for (e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++)
+        {
+            struct pack_file key;
+            char sidecar[4096];
+            snprintf(sidecar, sizeof(sidecar), "%s%s", list->files[i].path, http_encoding_suffix(encodings[e]));
+            key.path = sidecar;
+            struct pack_file *found = bsearch(&key, list->files, num_files, sizeof(key), compare_paths);
+            int source = found != NULL ? found - list->files : -1;
+
+            // Compress the file ourselves when there is no sidecar
+            char *variant = NULL;
+            size_t variant_len = 0;
+            if (source == -1)
+            {
+                if (body == NULL)
+                {
+                    body = malloc(list->files[i].size);
+                    if (body == NULL || read_file(root, list->files[i].path, body, list->files[i].size) == -1)
+                    {
+                        free(body);
+                        return -1;
+                    }
+                }
+                variant = compress_body(encodings[e], body, list->files[i].size, &variant_len);
+                if (variant == NULL)
+                {
+                    continue;
+                }
+            }
+
+            struct pack_file *file = add_file(list);
+            if (file == NULL || (file->path = strdup(list->files[i].path)) == NULL)
+            {
+                free(variant);
+                free(body);
+                return -1;
+            }
+            file->encoding = encodings[e];
+            file->source = source;
+            file->st = source != -1 ? list->files[source].st : list->files[i].st;
+            file->body = variant;
+            file->size = source != -1 ? list->files[source].size : variant_len;
+        }
+        free(body);
+    }
+    return 0;
+}
+
+// Map len bytes of anonymous memory, on huge pages if the system has some set
+// aside and otherwise asking for transparent ones
+static char *map_anonymous(size_t *len)
+{
+    size_t huge_len = (*len + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    char *base = mmap(NULL, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                      -1, 0);
+    if (base != MAP_FAILED)
+    {
+        *len = huge_len;
+        return base;
+    }
+    base = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+    madvise(base, *len, MADV_HUGEPAGE);
+    return base;
+}
+
+struct asset_image *asset_image_build(const char *root)
+{
+    struct pack_list list = {NULL, 0, 0};
+    int i;
+
+    if (walk(&list, root, "") == -1)
+    {
+        free_list(&list);
+        return NULL;
+    }
+    qsort(list.files, list.count, sizeof(*list.files), compare_paths);
+    if (add_variants(&list, root) == -1)
+    {
+        free_list(&list);
+        return NULL;
+    }
+
+    // Lay out the header, the records, the paths and then the bodies
+    uint64_t offset = sizeof(struct asset_pack_header) + (uint64_t)list.count * sizeof(struct asset_pack_record);
+    uint64_t paths = offset;
+    for (i = 0; i < list.count; i++)
+    {
+        offset += strlen(list.files[i].path) + 1;
+    }
+    for (i = 0; i < list.count; i++)
+    {
+        struct pack_file *file = &list.files[i];
+        if (file->source == -1)
+        {
+            offset = (offset + ASSET_PACK_ALIGN - 1) & ~(uint64_t)(ASSET_PACK_ALIGN - 1);
+            file->data = offset;
+            offset += file->size;
+        }
+    }
+
+    struct asset_image *image = malloc(sizeof(*image));
+    size_t map_len = offset;
+    char *base = image != NULL ? map_anonymous(&map_len) : NULL;
+    if (base == NULL)
+    {
+        free(image);
+        free_list(&list);
+        return NULL;
+    }
+    image->base = base;
+    image->map_len = map_len;
+    image->refs = 1;
+
+    struct asset_pack_header *header = (struct asset_pack_header *)base;
+    memcpy(header->magic, ASSET_PACK_MAGIC, sizeof(header->magic));
+    header->version = ASSET_PACK_VERSION;
+    header->count = list.count;
+    header->size = offset;
+    header->records = sizeof(*header);
+
+    // Fill in the records and copy the bodies
+    struct asset_pack_record *records = (struct asset_pack_record *)(base + header->records);
+    for (i = 0; i < list.count; i++)
+    {
+        struct pack_file *file = &list.files[i];
+        struct asset_pack_record *record = &records[i];
+        size_t path_len = strlen(file->path) + 1;
+        memcpy(base + paths, file->path, path_len);
+        record->path = paths;
+        paths += path_len;
+        record->data = file->source != -1 ? list.files[file->source].data : file->data;
+        record->size = file->size;
+        record->file_size = file->st.st_size;
+        record->ino = file->st.st_ino;
+        record->mtime_sec = file->st.st_mtim.tv_sec;
+        record->mtime_nsec = file->st.st_mtim.tv_nsec;
+        record->encoding = file->encoding;
+        record->reserved = 0;
+
+        if (file->body != NULL)
+        {
+            memcpy(base + file->data, file->body, file->size);
+        }
+        else if (file->source == -1 && read_file(root, file->path, base + file->data, file->size) == -1)
+        {
+            free_list(&list);
+            asset_image_release(image);
+            return NULL;
+        }
+    }
+    free_list(&list);
+    return image;
+}
+
+// Check that every record of a mapped pack points inside it
+static int validate(const char *base, size_t len)
+{
+    const struct asset_pack_header *header = (const struct asset_pack_header *)base;
+    if (len < sizeof(*header) || memcmp(header->magic, ASSET_PACK_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != ASSET_PACK_VERSION || header->size != len || header->records > len ||
+        (len - header->records) / sizeof(struct asset_pack_record) < header->count)
+    {
+        return -1;
+    }
+
+    const struct asset_pack_record *records = (const struct asset_pack_record *)(base + header->records);
+    uint32_t i;
+    for (i = 0; i < header->count; i++)
+    {
+        if (records[i].path >= len || memchr(base + records[i].path, '\0', len - records[i].path) == NULL ||
+            records[i].data > len || records[i].size > len - records[i].data ||
+            records[i].encoding > HTTP_ENCODING_BR)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct asset_image *asset_image_load(const char *path)
+{
+    struct stat st;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(path);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    // The mapping keeps the file alive after a new pack is renamed over it
+    char *base = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror(path);
+        return NULL;
+    }
+    madvise(base, st.st_size, MADV_HUGEPAGE);
+    if (validate(base, st.st_size) == -1)
+    {
+        fprintf(stderr, "%s: not a valid pack\n", path);
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    struct asset_image *image = malloc(sizeof(*image));
+    if (image == NULL)
+    {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    image->base = base;
+    image->map_len = st.st_size;
+    image->refs = 1;
+    return image;
+}
+
+int asset_image_write(const struct asset_image *image, const char *path)
+{
+    const struct asset_pack_header *header = asset_image_header(image);
+    char tmp_path[4096];
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int)getpid()) >= (int)sizeof(tmp_path))
+    {
+        fprintf(stderr, "%s: path too long\n", path);
+        return -1;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        perror(tmp_path);
+        return -1;
+    }
+
+    // Write and sync the whole pack before it replaces the old one
+    uint64_t done = 0;
+    while (done < header->size)
+    {
+        ssize_t n = write(fd, image->base + done, header->size - done);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n == -1)
+        {
+            break;
+        }
+        done += n;
+    }
+    if (done < header->size || fsync(fd) == -1 || close(fd) == -1 || rename(tmp_path, path) == -1)
+    {
+        perror(tmp_path);
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+const struct asset_pack_header *asset_image_header(const struct asset_image *image)
+{
+    return (const struct asset_pack_header *)image->base;
+}
+
+void asset_image_release(struct asset_image *image)
+{
+    if (image != NULL && __atomic_sub_fetch(&image->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        munmap(image->base, image->map_len);
+        free(image);
+    }
+}
+
+void asset_image_publish(struct asset_image *image)
+{
+    pthread_mutex_lock(&publish_lock);
+    struct asset_image *old = published;
+    published = image;
+    __atomic_store_n(&published_generation, published_generation + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&publish_lock);
+    asset_image_release(old);
+}
+
+unsigned long asset_image_generation(void)
+{
+    return __atomic_load_n(&published_generation, __ATOMIC_ACQUIRE);
+}
+
+struct asset_image *asset_image_acquire(void)
+{
+    pthread_mutex_lock(&publish_lock);
+    struct asset_image *image = published;
+    if (image != NULL)
+    {
+        __atomic_add_fetch(&image->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&publish_lock);
+    return image;
+}
+
+// FNV-1a over the path, with the coding mixed in
+static unsigned long hash_key(const char *path, int encoding)
+{
+    unsigned long hash = 14695981039346656037UL;
+    while (*path != '\0')
+    {
+        hash = (hash ^ (unsigned char)*path++) * 1099511628211UL;
+    }
+    return (hash ^ encoding) * 1099511628211UL;
+}
+
+struct asset_pack *asset_pack_create(struct asset_image *image)
+{
+    const struct asset_pack_header *header = asset_image_header(image);
+    const struct asset_pack_record *records = (const struct asset_pack_record *)(image->base + header->records);
+    char head[HTTP_HEAD_MAX];
+    size_t num_slots = 16, headers_len = 0;
+    int i;
+
+    while (num_slots < (size_t)header->count * 2)
+    {
+        num_slots *= 2;
+    }
+    struct asset_pack *pack = calloc(1, sizeof(*pack));
+    if (pack != NULL)
+    {
+        pack->entries = calloc(header->count + 1, sizeof(*pack->entries));
+        pack->encodings = calloc(header->count + 1, 1);
+        pack->slots = calloc(num_slots, sizeof(*pack->slots));
+    }
+    if (pack == NULL || pack->entries == NULL || pack->encodings == NULL || pack->slots == NULL)
+    {
+        goto fail;
+    }
+    pack->image = image;
+    pack->count = header->count;
+    pack->mask = num_slots - 1;
+
+    // Work out the validators of every entry and how much room their heads take
+    for (i = 0; i < pack->count; i++)
+    {
+        struct file_cache_entry *entry = &pack->entries[i];
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        st.st_ino = records[i].ino;
+        st.st_size = records[i].file_size;
+        st.st_mtim.tv_sec = records[i].mtime_sec;
+        st.st_mtim.tv_nsec = records[i].mtime_nsec;
+        http_make_validators(&entry->validators, &st);
+        if (records[i].encoding != 0)
+        {
+            struct http_validators file_validators = entry->validators;
+            http_variant_validators(&entry->validators, &file_validators, records[i].encoding);
+        }
+
+        pack->encodings[i] = records[i].encoding;
+        entry->path = image->base + records[i].path;
+        entry->body = image->base + records[i].data;
+        entry->body_len = records[i].size;
+        entry->fd = -1;
+        entry->headers_len = http_render_head(head, 200, http_mime_lookup(entry->path), entry->body_len,
+                                              records[i].encoding, &entry->validators);
+        headers_len += entry->headers_len;
+    }
+
+    // Render the heads into one block and index the entries by path and coding
+    pack->headers = malloc(headers_len + 1);
+    if (pack->headers == NULL)
+    {
+        goto fail;
+    }
+    char *out = pack->headers;
+    for (i = 0; i < pack->count; i++)
+    {
+        struct file_cache_entry *entry = &pack->entries[i];
+        http_render_head(out, 200, http_mime_lookup(entry->path), entry->body_len, records[i].encoding,
+                         &entry->validators);
+        entry->headers = out;
+        out += entry->headers_len;
+
+        entry->hash = hash_key(entry->path, records[i].encoding);
+        size_t slot = entry->hash & pack->mask;
+        while (pack->slots[slot] != 0)
+        {
+            slot = (slot + 1) & pack->mask;
+        }
+        pack->slots[slot] = i + 1;
+    }
+    return pack;
+
+fail:
+    perror("asset_pack_create");
+    if (pack != NULL)
+    {
+        free(pack->headers);
+        free(pack->entries);
+        free(pack->encodings);
+        free(pack->slots);
+        free(pack);
+    }
+    return NULL;
+}
+
+const struct file_cache_entry *asset_pack_lookup(const struct asset_pack *pack, const char *path, int encoding)
+{
+    unsigned long hash = hash_key(path, encoding);
+    size_t slot = hash & pack->mask;
+    int index;
+
+    while ((index = pack->slots[slot]) != 0)
+    {
+        const struct file_cache_entry *entry = &pack->entries[index - 1];
+        if (entry->hash == hash && pack->encodings[index - 1] == encoding && strcmp(entry->path, path) == 0)
+        {
+            return entry;
+        }
+        slot = (slot + 1) & pack->mask;
+    }
+    return NULL;
+}
+
+// Whether a response is still sending one of the pack's entries
+static int busy(const struct asset_pack *pack)
+{
+    int i;
+    for (i = 0; i < pack->count; i++)
+    {
+        if (pack->entries[i].refs != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void destroy(struct asset_pack *pack)
+{
+    asset_image_release(pack->image);
+    free(pack->headers);
+    free(pack->entries);
+    free(pack->encodings);
+    free(pack->slots);
+    free(pack);
+}
+
+struct asset_pack *asset_pack_retire(struct asset_pack *retired, struct asset_pack *pack)
+{
+    pack->next_retired = retired;
+    return pack;
+}
+
+struct asset_pack *asset_pack_collect(struct asset_pack *retired)
+{
+    struct asset_pack **link = &retired;
+    while (*link != NULL)
+    {
+        struct asset_pack *pack = *link;
+        if (busy(pack))
+        {
+            link = &pack->next_retired;
+            continue;
+        }
+        *link = pack->next_retired;
+        destroy(pack);
+    }
+    return retired;
+}
@@ -0,0 +1,94 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct file_cache_entry;
+
+// A pack is an immutable image of a serving directory: a header, an array of
+// records and then the paths and bodies of every file back to back. The same
+// layout is used in memory and on disk, so a pack file is served straight
+// from its mapping. Compressible files also get gzip and brotli variants,
+// unless a .gz or .br sidecar already provides them.
+#define ASSET_PACK_MAGIC "CNPACK1"
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGN 64     // bodies start on a cache line
+
+struct asset_pack_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;             // records
+    uint64_t size;              // bytes of the whole image
+    uint64_t records;           // offset of the record array
+};
+
+// One representation of a file; offsets are from the start of the image
+struct asset_pack_record
+{
+    uint64_t path;              // NUL-terminated path below the serving directory
+    uint64_t data;
+    uint64_t size;
+    uint64_t file_size;         // size, inode and modification time of the file
+    uint64_t ino;               // the body came from, for its ETag
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t encoding;          // HTTP_ENCODING_* coding of the body, 0 for the file itself
+    uint32_t reserved;
+};
+
+// A pack mapped into memory, shared by all the event loops
+struct asset_image;
+
+// Read every regular file below root into an anonymous mapping, backed by
+// huge pages where the system has them. Returns NULL on failure.
+struct asset_image *asset_image_build(const char *root);
+
+// Map the pack file at path, faulting it in up front. Returns NULL if it
+// cannot be read or is not a valid pack.
+struct asset_image *asset_image_load(const char *path);
+
+// Write an image to path. The pack is written next to it and renamed over
+// it, so a server reloading path sees either the old pack or the new one.
+// Returns -1 on failure.
+int asset_image_write(const struct asset_image *image, const char *path);
+
+// The header of an image, for its size and record count
+const struct asset_pack_header *asset_image_header(const struct asset_image *image);
+
+// Drop a reference to an image, unmapping it with the last one
+void asset_image_release(struct asset_image *image);
+
+// Make image the one event loops serve from, taking over the caller's
+// reference; loops pick it up before their next request
+void asset_image_publish(struct asset_image *image);
+
+// How many images have been published, to notice a new one cheaply
+unsigned long asset_image_generation(void);
+
+// The image published last, with a reference of its own, or NULL
+struct asset_image *asset_image_acquire(void);
+
+// An event loop's index over an image: cache entries whose headers are
+// rendered once and whose bodies point into the mapping, in a hash table
+// by path and coding
+struct asset_pack;
+
+// Index an image, taking over the caller's reference to it. Returns NULL on
+// failure, when the reference is still the caller's.
+struct asset_pack *asset_pack_create(struct asset_image *image);
+
+// The entry of the file at path, relative to the serving directory, with the
+// body in encoding (0 for none), or NULL
+const struct file_cache_entry *asset_pack_lookup(const struct asset_pack *pack, const char *path, int encoding);
+
+// Put a pack that was replaced on a list of retired ones, returning the new
+// list head. It stays alive while responses still send its entries.
+struct asset_pack *asset_pack_retire(struct asset_pack *retired, struct asset_pack *pack);
+
+// Free the retired packs no response holds anymore, releasing their images.
+// Returns the list of those still busy.
+struct asset_pack *asset_pack_collect(struct asset_pack *retired);
+
+#endif
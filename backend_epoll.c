@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include "event_backend.h"
+
+// Most events taken from the kernel per wait
+#define EPOLL_BATCH 256
+
+struct epoll_state
+{
+    int epoll_fd;
+    struct epoll_event ready[EPOLL_BATCH];
+};
+
+static unsigned epoll_events(int events)
+{
+    return (events & EVENT_READ ? EPOLLIN : 0) | (events & EVENT_WRITE ? EPOLLOUT : 0) |
+           (events & EVENT_EXCLUSIVE ? EPOLLEXCLUSIVE : 0) | (events & EVENT_EDGE ? EPOLLET : 0);
+}
+
+static void *epoll_backend_create(int max_fds)
+{
+    struct epoll_state *state = malloc(sizeof(*state));
+    if (state == NULL)
+    {
+        perror("malloc");
+        return NULL;
+    }
+    state->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (state->epoll_fd == -1)
+    {
+        perror("epoll_create1");
+        free(state);
+        return NULL;
+    }
+    (void)max_fds;
+    return state;
+}
+
+static int epoll_backend_add(void *arg, int fd, int events, void *data)
+{
+    struct epoll_state *state = arg;
+    struct epoll_event event = {.events = epoll_events(events), .data.ptr = data};
+    return epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static int epoll_backend_modify(void *arg, int fd, int events, void *data)
+{
+    struct epoll_state *state = arg;
+    struct epoll_event event = {.events = epoll_events(events), .data.ptr = data};
+
+    // epoll reports errors and hangups whatever is watched, so to watch nothing
+    // the descriptor leaves the interest list, and comes back when watched again
+    if (events == 0)
+    {
+        return epoll_ctl(state->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    int ret = epoll_ctl(state->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    if (ret == -1 && errno == ENOENT)
+    {
+        ret = epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+    return ret;
+}
+
+// Closing the descriptor takes it out of the interest list
+static void epoll_backend_remove(void *arg, int fd)
+{
+    (void)arg;
+    (void)fd;
+}
+
+static int epoll_backend_wait(void *arg, struct event *events, int max_events, int timeout_ms)
+{
+    struct epoll_state *state = arg;
+
+    int n = epoll_wait(state->epoll_fd, state->ready, max_events < EPOLL_BATCH ? max_events : EPOLL_BATCH,
+                       timeout_ms);
+    if (n == -1)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        // Errors and hangups count as both, only the watched one matters
+        unsigned revents = state->ready[i].events;
+        events[i].data = state->ready[i].data.ptr;
+        events[i].events = (revents & (EPOLLIN | EPOLLERR | EPOLLHUP) ? EVENT_READ : 0) |
+                           (revents & (EPOLLOUT | EPOLLERR | EPOLLHUP) ? EVENT_WRITE : 0);
+    }
+    return n;
+}
+
+const struct event_backend epoll_backend = {
+    "epoll", epoll_backend_create, epoll_backend_add, epoll_backend_modify, epoll_backend_remove, epoll_backend_wait, 1,
+};
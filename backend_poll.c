@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "event_backend.h"
+
+// Watched descriptors are kept packed so a poll call only covers live ones
+struct poll_state
+{
+    struct pollfd *fds;
+    void **data;        // parallel to fds
+    int *index_of;      // position of each descriptor in fds, -1 if not watched
+    int count;
+    int max_fds;
+    int next;           // where the next scan starts, so every descriptor gets its turn
+};
+
+static short poll_events(int events)
+{
+    return (events & EVENT_READ ? POLLIN : 0) | (events & EVENT_WRITE ? POLLOUT : 0);
+}
+
+static void *poll_backend_create(int max_fds)
+{
+    struct poll_state *state = calloc(1, sizeof(*state));
+    if (state != NULL)
+    {
+        state->fds = calloc(max_fds, sizeof(*state->fds));
+        state->data = calloc(max_fds, sizeof(*state->data));
+        state->index_of = malloc(max_fds * sizeof(*state->index_of));
+    }
+    if (state == NULL || state->fds == NULL || state->data == NULL || state->index_of == NULL)
+    {
+        perror("calloc");
+        return NULL;
+    }
+
+    int fd;
+    for (fd = 0; fd < max_fds; fd++)
+    {
+        state->index_of[fd] = -1;
+    }
+    state->max_fds = max_fds;
+    return state;
+}
+
+static int poll_backend_add(void *arg, int fd, int events, void *data)
+{
+    struct poll_state *state = arg;
+
+    if (fd >= state->max_fds)
+    {
+        errno = EMFILE;
+        return -1;
+    }
+    state->index_of[fd] = state->count;
+    state->fds[state->count].fd = fd;
+    state->fds[state->count].events = poll_events(events);
+    state->fds[state->count].revents = 0;
+    state->data[state->count++] = data;
+    return 0;
+}
+
+static int poll_backend_modify(void *arg, int fd, int events, void *data)
+{
+    struct poll_state *state = arg;
+    int i = state->index_of[fd];
+
+    // poll reports errors and hangups whatever is asked for, but skips negative descriptors
+    state->fds[i].fd = events != 0 ? fd : ~fd;
+    state->fds[i].events = poll_events(events);
+    state->data[i] = data;
+    return 0;
+}
+
+static void poll_backend_remove(void *arg, int fd)
+{
+    struct poll_state *state = arg;
+    int i = state->index_of[fd];
+
+    // Move the last descriptor into the freed entry
+    state->count--;
+    state->fds[i] = state->fds[state->count];
+    state->data[i] = state->data[state->count];
+    state->index_of[state->fds[i].fd >= 0 ? state->fds[i].fd : ~state->fds[i].fd] = i;
+    state->index_of[fd] = -1;
+}
+
+static int poll_backend_wait(void *arg, struct event *events, int max_events, int timeout_ms)
+{
+    struct poll_state *state = arg;
+
+    int ready = poll(state->fds, state->count, timeout_ms);
+    if (ready == -1)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    // Collect the ready descriptors, starting after the last one reported
+    int count = 0, scanned, i = state->next;
+    for (scanned = 0; scanned < state->count && ready > 0 && count < max_events; scanned++)
+    {
+        if (i >= state->count)
+        {
+            i = 0;
+        }
+        short revents = state->fds[i].revents;
+        if (revents != 0)
+        {
+            // Errors and hangups come without the events asked for
+            if (revents & (POLLERR | POLLHUP | POLLNVAL))
+            {
+                revents |= state->fds[i].events;
+            }
+            events[count].data = state->data[i];
+            events[count++].events = (revents & POLLIN ? EVENT_READ : 0) | (revents & POLLOUT ? EVENT_WRITE : 0);
+            ready--;
+        }
+        i++;
+    }
+    state->next = i;
+    return count;
+}
+
+const struct event_backend poll_backend = {
+    "poll", poll_backend_create, poll_backend_add, poll_backend_modify, poll_backend_remove, poll_backend_wait,
+};
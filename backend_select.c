@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/select.h>
+
+#include "event_backend.h"
+
+// select() can only watch descriptors below FD_SETSIZE
+struct select_state
+{
+    fd_set read_fds;
+    fd_set write_fds;
+    int max_fd;                 // highest descriptor watched, -1 if none
+    int next_fd;                // where the next scan starts, so every descriptor gets its turn
+    void *data[FD_SETSIZE];
+};
+
+static void *select_backend_create(int max_fds)
+{
+    struct select_state *state = malloc(sizeof(*state));
+    if (state == NULL)
+    {
+        perror("malloc");
+        return NULL;
+    }
+    FD_ZERO(&state->read_fds);
+    FD_ZERO(&state->write_fds);
+    state->max_fd = -1;
+    state->next_fd = 0;
+    (void)max_fds;
+    return state;
+}
+
+static int select_backend_modify(void *arg, int fd, int events, void *data)
+{
+    struct select_state *state = arg;
+
+    FD_CLR(fd, &state->read_fds);
+    FD_CLR(fd, &state->write_fds);
+    if (events & EVENT_READ)
+    {
+        FD_SET(fd, &state->read_fds);
+    }
+    if (events & EVENT_WRITE)
+    {
+        FD_SET(fd, &state->write_fds);
+    }
+    state->data[fd] = data;
+    return 0;
+}
+
+static int select_backend_add(void *arg, int fd, int events, void *data)
+{
+    struct select_state *state = arg;
+
+    if (fd >= FD_SETSIZE)
+    {
+        errno = EMFILE;
+        return -1;
+    }
+    if (fd > state->max_fd)
+    {
+        state->max_fd = fd;
+    }
+    return select_backend_modify(state, fd, events, data);
+}
+
+static void select_backend_remove(void *arg, int fd)
+{
+    struct select_state *state = arg;
+
+    FD_CLR(fd, &state->read_fds);
+    FD_CLR(fd, &state->write_fds);
+    while (state->max_fd >= 0 && !FD_ISSET(state->max_fd, &state->read_fds) &&
+           !FD_ISSET(state->max_fd, &state->write_fds))
+    {
+        state->max_fd--;
+    }
+}
+
+static int select_backend_wait(void *arg, struct event *events, int max_events, int timeout_ms)
+{
+    struct select_state *state = arg;
+    struct timeval timeout = {timeout_ms / 1000, timeout_ms % 1000 * 1000};
+    fd_set read_fds = state->read_fds;
+    fd_set write_fds = state->write_fds;
+
+    int ready = select(state->max_fd + 1, &read_fds, &write_fds, NULL, timeout_ms >= 0 ? &timeout : NULL);
+    if (ready == -1)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    // Collect the ready descriptors, starting after the last one reported
+    int count = 0, scanned, fd = state->next_fd;
+    for (scanned = 0; scanned <= state->max_fd && ready > 0 && count < max_events; scanned++)
+    {
+        if (fd > state->max_fd)
+        {
+            fd = 0;
+        }
+        int mask = (FD_ISSET(fd, &read_fds) ? EVENT_READ : 0) | (FD_ISSET(fd, &write_fds) ? EVENT_WRITE : 0);
+        if (mask != 0)
+        {
+            events[count].data = state->data[fd];
+            events[count++].events = mask;
+            ready -= (mask & EVENT_READ ? 1 : 0) + (mask & EVENT_WRITE ? 1 : 0);
+        }
+        fd++;
+    }
+    state->next_fd = fd;
+    return count;
+}
+
+const struct event_backend select_backend = {
+    "select", select_backend_create, select_backend_add, select_backend_modify, select_backend_remove, select_backend_wait,
+};
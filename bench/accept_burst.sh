@@ -0,0 +1,27 @@
+#!/bin/sh
+# Connections per second under bursts of new connections: every client
+# connection carries a single request and closes, and all of them open at once,
+# so the server spends its time accepting. Compares the accept paths of every
+# backend, including workers sharing one listener with EPOLLEXCLUSIVE against
+# one SO_REUSEPORT listener each.
+# usage: bench/accept_burst.sh [client options]
+# PORT, ROOT, TARGET and WORKERS pick the first port, the served directory, the
+# requested path and the number of workers.
+port=${PORT:-18280}
+root=${ROOT:-.}
+target=${TARGET:-/Makefile}
+workers=${WORKERS:-2}
+[ $# -gt 0 ] || set -- -k -c 500 -n 40
+
+for server in "./server -w 1 --backend select" "./server -w 1 --backend poll" "./server -w 1 --backend epoll" \
+              "./server -w $workers" "./server -w $workers -s" "./server -w $workers --backend uring"; do
+    $server $port "$root" >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    echo "== $server"
+    ./client "$@" 127.0.0.1 $port "$target" | sed 's/^Requests\/sec:/Connections\/sec:/'
+    kill $pid
+    wait $pid 2>/dev/null
+    port=$((port + 1))
+    echo
+done
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+# Compare two result files of bench/micro_bench benchmark by benchmark and
+# flag every one whose median time per operation grew by more than the
+# threshold. Exits with 1 if any did, so a build can fail on a regression.
+# usage: bench/compare.py [-t percent] baseline.json current.json
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data, {r["name"]: r for r in data["results"]}
+
+
+def main():
+    args = sys.argv[1:]
+    threshold = 10.0
+    if len(args) >= 2 and args[0] == "-t":
+        threshold = float(args[1])
+        args = args[2:]
+    if len(args) != 2:
+        sys.exit("usage: %s [-t percent] baseline.json current.json" % sys.argv[0])
+
+    base_info, base = load(args[0])
+    new_info, new = load(args[1])
+    if base_info.get("parser_impl") != new_info.get("parser_impl"):
+        print("note: delimiter scanner changed from %s to %s"
+              % (base_info.get("parser_impl"), new_info.get("parser_impl")))
+
+    slower = 0
+    print("%-36s %12s %12s %8s" % ("benchmark (ns/op)", "baseline", "current", "change"))
+    for name, result in new.items():
+        if name not in base:
+            print("%-36s %12s %12.1f %8s" % (name, "-", result["ns_per_op"], "new"))
+            continue
+        before, after = base[name]["ns_per_op"], result["ns_per_op"]
+        change = (after - before) / before * 100
+        flag = ""
+        if change > threshold:
+            flag = "  SLOWER"
+            slower += 1
+        elif change < -threshold:
+            flag = "  faster"
+        print("%-36s %12.1f %12.1f %+7.1f%%%s" % (name, before, after, change, flag))
+    for name in base:
+        if name not in new:
+            print("%-36s %12.1f %12s %8s" % (name, base[name]["ns_per_op"], "-", "gone"))
+
+    if slower:
+        print("%d benchmark%s slower by more than %g%%" % (slower, "s" if slower > 1 else "", threshold))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
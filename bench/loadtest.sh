@@ -0,0 +1,21 @@
+#!/bin/sh
+# Run the client's benchmark mode against every event backend on loopback, one after the other.
+# usage: bench/loadtest.sh [client options]
+# PORT, ROOT and TARGET pick the first port, the served directory and the requested path.
+port=${PORT:-18080}
+root=${ROOT:-.}
+target=${TARGET:-/mime.types}
+[ $# -gt 0 ] || set -- -c 50 -n 2000 -d 4
+
+for server in "./server -w 1 --backend select" "./server -w 1 --backend poll" "./server -w 1 --backend epoll" \
+              "./server --backend epoll" "./server --backend epoll --pack" "./server --backend uring"; do
+    $server $port "$root" >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    echo "== $server ($target)"
+    ./client "$@" 127.0.0.1 $port "$target"
+    kill $pid
+    wait $pid 2>/dev/null
+    port=$((port + 1))
+    echo
+done
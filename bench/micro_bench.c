@@ -0,0 +1,730 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "../file_send.h"
+#include "../http.h"
+#include "../http_parser.h"
+#include "bench_requests.h"
+
+#define BUFFER_SIZE 1024
+#define COPY_BUFFER_SIZE 65536
+#define RUNS 5                  // timed runs per benchmark, the median is reported
+#define DEFAULT_RUN_MS 20       // iterations are calibrated so a run lasts at least this long
+
+// One benchmark body: do its operation iterations times
+typedef void (*bench_fn)(void *arg, long iterations);
+
+// A request buffer
+struct text
+{
+    const char *data;
+    size_t len;
+};
+
+static volatile int sink;
+
+static double run_ns = DEFAULT_RUN_MS * 1e6;
+static const char *filter;
+static FILE *json;
+static int results;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Whether the filter lets a benchmark run
+static int selected(const char *name)
+{
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+// Time fn, unless the filter skips it: doubling the iterations until a run
+// takes a quarter of the run time warms caches and the branch predictor,
+// then RUNS runs of the scaled count are timed. Prints the median and the
+// fastest run, and the throughput when every operation moves bytes.
+static void bench(const char *name, bench_fn fn, void *arg, size_t bytes)
+{
+    if (!selected(name))
+    {
+        return;
+    }
+
+    long iterations = 1;
+    double elapsed;
+    for (;;)
+    {
+        double start = now_ns();
+        fn(arg, iterations);
+        elapsed = now_ns() - start;
+        if (elapsed >= run_ns / 4)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+    iterations = (long)(iterations * run_ns / elapsed) + 1;
+
+    double ns_per_op[RUNS];
+    int run;
+    for (run = 0; run < RUNS; run++)
+    {
+        double start = now_ns();
+        fn(arg, iterations);
+        ns_per_op[run] = (now_ns() - start) / iterations;
+    }
+    qsort(ns_per_op, RUNS, sizeof(ns_per_op[0]), compare_double);
+    double median = ns_per_op[RUNS / 2];
+
+    if (bytes != 0)
+    {
+        fprintf(stderr, "%-36s %12.1f ns/op %12.1f min %10.1f MB/s\n", name, median, ns_per_op[0],
+                bytes * 1e3 / median);
+    }
+    else
+    {
+        fprintf(stderr, "%-36s %12.1f ns/op %12.1f min\n", name, median, ns_per_op[0]);
+    }
+    fprintf(json, "%s\n    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"min_ns_per_op\": %.2f, \"iterations\": %ld, "
+            "\"bytes_per_op\": %zu}", results++ ? "," : "", name, median, ns_per_op[0], iterations, bytes);
+}
+
+// Request line parsing
+
+// The original path: sscanf the request line into three stack arrays
+static void parse_sscanf(void *arg, long iterations)
+{
+    const struct text *request = arg;
+    char buf[BUFFER_SIZE];
+    char method[BUFFER_SIZE];
+    char path[BUFFER_SIZE];
+    char protocol[BUFFER_SIZE];
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        memcpy(buf, request->data, request->len + 1);
+        sscanf(buf, "%s %s %s", method, path, protocol);
+        sink += method[0] + path[0] + protocol[0];
+    }
+}
+
+// The whole head in one call: every header, where sscanf stops after the request line
+static void parse_http(void *arg, long iterations)
+{
+    const struct text *request = arg;
+    struct http_request req;
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        http_parser_init(&req);
+        sink += http_parse(&req, request->data, request->len) + req.num_headers;
+    }
+}
+
+// Content type lookup, over the extensions of a typical page
+
+static const char *const asset_paths[] = {
+    "/srv/www/index.html", "/srv/www/static/css/site.css", "/srv/www/static/js/app.bundle.min.js",
+    "/srv/www/img/logo.png", "/srv/www/img/hero.JPEG", "/srv/www/fonts/inter.woff2",
+    "/srv/www/downloads/release.tar.gz", "/srv/www/LICENSE",
+};
+
+#define NUM_ASSET_PATHS (sizeof(asset_paths) / sizeof(asset_paths[0]))
+
+// The original lookup: compare the extension with each known one in turn
+static const char *content_type_chain(const char *file_path)
+{
+    const char *extension = strrchr(file_path, '.');
+    if (extension != NULL)
+    {
+        if (strcasecmp(extension, ".html") == 0 || strcasecmp(extension, ".htm") == 0)
+        {
+            return "text/html";
+        }
+        else if (strcasecmp(extension, ".jpeg") == 0 || strcasecmp(extension, ".jpg") == 0)
+        {
+            return "image/jpeg";
+        }
+        else if (strcasecmp(extension, ".png") == 0)
+        {
+            return "image/png";
+        }
+        else if (strcasecmp(extension, ".gif") == 0)
+        {
+            return "image/gif";
+        }
+    }
+    return "application/octet-stream";
+}
+
+static void mime_chain(void *arg, long iterations)
+{
+    long i;
+
+    (void)arg;
+    for (i = 0; i < iterations; i++)
+    {
+        sink += content_type_chain(asset_paths[i % NUM_ASSET_PATHS])[0];
+    }
+}
+
+static void mime_table(void *arg, long iterations)
+{
+    long i;
+
+    (void)arg;
+    for (i = 0; i < iterations; i++)
+    {
+        sink += get_content_type(asset_paths[i % NUM_ASSET_PATHS])[0];
+    }
+}
+
+// Path construction from a parsed request
+
+#define SERVING_ROOT "/srv/www"
+
+struct path_case
+{
+    struct text request;
+    struct http_request req;
+    char target[BUFFER_SIZE];   // the target as sscanf would have copied it
+};
+
+// The original path: glue the raw target to the root, query string, escapes, dot segments and all
+static void path_snprintf(void *arg, long iterations)
+{
+    const struct path_case *path_case = arg;
+    char full_path[BUFFER_SIZE];
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        if (snprintf(full_path, sizeof(full_path), "%s%s", SERVING_ROOT, path_case->target) >= (int)sizeof(full_path))
+        {
+            abort();
+        }
+        sink += full_path[sizeof(SERVING_ROOT)];
+    }
+}
+
+// What serve_get does: cut the query, normalize, then join with the root and any index file
+static void path_normalized(void *arg, long iterations)
+{
+    const struct path_case *path_case = arg;
+    char request_path[BUFFER_SIZE];
+    char full_path[BUFFER_SIZE];
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        if (http_request_path(&path_case->req, path_case->request.data, request_path, sizeof(request_path)) != 0)
+        {
+            abort();
+        }
+        const char *index = request_path[strlen(request_path) - 1] == '/' ? "index.html" : "";
+        if (snprintf(full_path, sizeof(full_path), "%s%s%s", SERVING_ROOT, request_path, index) >=
+            (int)sizeof(full_path))
+        {
+            abort();
+        }
+        sink += full_path[sizeof(SERVING_ROOT)];
+    }
+}
+
+static void init_path_case(struct path_case *path_case, const char *request)
+{
+    path_case->request.data = request;
+    path_case->request.len = strlen(request);
+    http_parser_init(&path_case->req);
+    if (http_parse(&path_case->req, request, path_case->request.len) != HTTP_PARSE_DONE)
+    {
+        fprintf(stderr, "bad request in path benchmark\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(path_case->target, request + path_case->req.target.off, path_case->req.target.len);
+    path_case->target[path_case->req.target.len] = '\0';
+}
+
+// Response head formatting: the same 200 head, written to /dev/null
+
+struct head_case
+{
+    int null_fd;
+    const char *type;                   // the media type
+    const struct mime_entry *entry;     // and its pre-serialized line
+    unsigned long long content_length;
+    struct http_validators validators;
+    char date_line[64];                 // formatted once, as the server does each second
+};
+
+static const char head_format[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Accept-Ranges: bytes\r\n"
+    "Content-Type: %s\r\n"
+    "Content-Length: %llu\r\n"
+    "Vary: Accept-Encoding\r\n"
+    "%.*s"
+    "%s"
+    "Connection: keep-alive\r\n\r\n";
+
+static void head_snprintf(void *arg, long iterations)
+{
+    const struct head_case *head = arg;
+    char buf[HTTP_HEAD_MAX];
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        int len = snprintf(buf, sizeof(buf), head_format, head->type, head->content_length,
+                           (int)head->validators.lines_len, head->validators.lines, head->date_line);
+        sink += write(head->null_fd, buf, len);
+    }
+}
+
+static void head_dprintf(void *arg, long iterations)
+{
+    const struct head_case *head = arg;
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        sink += dprintf(head->null_fd, head_format, head->type, head->content_length,
+                        (int)head->validators.lines_len, head->validators.lines, head->date_line);
+    }
+}
+
+static void head_preserialized(void *arg, long iterations)
+{
+    const struct head_case *head = arg;
+    char buf[HTTP_HEAD_MAX];
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        size_t len = http_render_head(buf, 200, head->entry, head->content_length, 0, &head->validators);
+        len += http_render_head_end(buf + len, 1);
+        sink += write(head->null_fd, buf, len);
+    }
+}
+
+static void init_head_case(struct head_case *head)
+{
+    static const char path[] = "/srv/www/static/js/app.bundle.min.js";
+    struct stat st;
+
+    head->null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (head->null_fd == -1)
+    {
+        perror("/dev/null");
+        exit(EXIT_FAILURE);
+    }
+    head->type = get_content_type(path);
+    head->entry = http_mime_lookup(path);
+    head->content_length = 48213;
+
+    memset(&st, 0, sizeof(st));
+    st.st_ino = 1049231;
+    st.st_size = head->content_length;
+    st.st_mtime = 1697500000;
+    http_make_validators(&head->validators, &st);
+
+    char buf[HTTP_HEAD_MAX];
+    size_t len = http_render_head_end(buf, 1);
+    const char *end = memchr(buf, '\n', len);
+    memcpy(head->date_line, buf, end + 1 - buf);
+    head->date_line[end + 1 - buf] = '\0';
+}
+
+// File send strategies, into a loopback TCP connection drained by another thread
+
+static const size_t send_sizes[] = {1024, 16384, 262144, 4194304};
+
+#define NUM_SEND_SIZES (sizeof(send_sizes) / sizeof(send_sizes[0]))
+
+struct send_case
+{
+    int sock;
+    int file_fd;
+    size_t size;
+    char head[HTTP_HEAD_MAX];
+    size_t head_len;
+};
+
+// Write all of len bytes to a blocking socket
+static void write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// The original path: read the file through a buffer and write it out
+static void send_read_write(void *arg, long iterations)
+{
+    const struct send_case *send_case = arg;
+    static char buf[COPY_BUFFER_SIZE];
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        write_all(send_case->sock, send_case->head, send_case->head_len);
+        off_t offset = 0;
+        ssize_t n;
+        while ((n = pread(send_case->file_fd, buf, sizeof(buf), offset)) > 0)
+        {
+            write_all(send_case->sock, buf, n);
+            offset += n;
+        }
+    }
+}
+
+// The head corked onto the file, which goes out with sendfile
+static void send_sendfile(void *arg, long iterations)
+{
+    const struct send_case *send_case = arg;
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        if (send(send_case->sock, send_case->head, send_case->head_len, MSG_MORE) != (ssize_t)send_case->head_len ||
+            file_send_all(send_case->sock, send_case->file_fd, 0, send_case->size) == -1)
+        {
+            perror("sendfile");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Map the file for each response and write head and body in one writev
+static void send_mmap_writev(void *arg, long iterations)
+{
+    const struct send_case *send_case = arg;
+    long i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        char *body = mmap(NULL, send_case->size, PROT_READ, MAP_SHARED, send_case->file_fd, 0);
+        if (body == MAP_FAILED)
+        {
+            perror("mmap");
+            exit(EXIT_FAILURE);
+        }
+        struct iovec iov[2] = {{(void *)send_case->head, send_case->head_len}, {body, send_case->size}};
+        int iov_index = 0;
+        while (iov_index < 2)
+        {
+            ssize_t n = writev(send_case->sock, iov + iov_index, 2 - iov_index);
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                perror("writev");
+                exit(EXIT_FAILURE);
+            }
+            while (iov_index < 2 && (size_t)n >= iov[iov_index].iov_len)
+            {
+                n -= iov[iov_index++].iov_len;
+            }
+            if (iov_index < 2)
+            {
+                iov[iov_index].iov_base = (char *)iov[iov_index].iov_base + n;
+                iov[iov_index].iov_len -= n;
+            }
+        }
+        munmap(body, send_case->size);
+    }
+}
+
+static int drain_cpu = -1;
+
+// Read and discard everything the benchmarks send, on its own CPU when there is one
+static void *drain(void *arg)
+{
+    int fd = *(int *)arg;
+    static char buf[1 << 18];
+
+    if (drain_cpu != -1)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(drain_cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    while (read(fd, buf, sizeof(buf)) > 0)
+    {
+    }
+    return NULL;
+}
+
+// Connect a socket over loopback to a thread that drains it. Returns the sending end.
+static int open_sink(pthread_t *thread, int *drain_fd)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len = sizeof(addr);
+
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener == -1 || sock == -1 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(listener, 1) == -1 || getsockname(listener, (struct sockaddr *)&addr, &addr_len) == -1 ||
+        connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        (*drain_fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) == -1)
+    {
+        perror("loopback sink");
+        exit(EXIT_FAILURE);
+    }
+    close(listener);
+
+    errno = pthread_create(thread, NULL, drain, drain_fd);
+    if (errno != 0)
+    {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    return sock;
+}
+
+// A file of size bytes in the temporary directory, unlinked at once
+static int make_file(size_t size)
+{
+    const char *dir = getenv("TMPDIR");
+    char path[BUFFER_SIZE];
+    static char block[COPY_BUFFER_SIZE];
+    size_t i;
+
+    snprintf(path, sizeof(path), "%s/micro_bench.XXXXXX", dir != NULL ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd == -1)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    unlink(path);
+    for (i = 0; i < sizeof(block); i++)
+    {
+        block[i] = 'a' + i % 26;
+    }
+    for (i = 0; i < size; i += sizeof(block))
+    {
+        write_all(fd, block, size - i < sizeof(block) ? size - i : sizeof(block));
+    }
+    return fd;
+}
+
+static void bench_send(void)
+{
+    static const struct
+    {
+        const char *name;
+        bench_fn fn;
+    } strategies[] = {
+        {"read_write", send_read_write},
+        {"sendfile", send_sendfile},
+        {"mmap_writev", send_mmap_writev},
+    };
+    struct send_case send_case = {.sock = -1};
+    pthread_t thread;
+    int drain_fd;
+    size_t i, j;
+
+    for (i = 0; i < NUM_SEND_SIZES; i++)
+    {
+        send_case.size = send_sizes[i];
+        send_case.file_fd = -1;
+        send_case.head_len = http_render_head(send_case.head, 200, NULL, send_case.size, 0, NULL);
+        send_case.head_len += http_render_head_end(send_case.head + send_case.head_len, 1);
+        for (j = 0; j < sizeof(strategies) / sizeof(strategies[0]); j++)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "send/%s/%zuk", strategies[j].name, send_case.size / 1024);
+            if (!selected(name))
+            {
+                continue;
+            }
+
+            // Set up the sink and the file only for benchmarks that run
+            if (send_case.sock == -1)
+            {
+                send_case.sock = open_sink(&thread, &drain_fd);
+            }
+            if (send_case.file_fd == -1)
+            {
+                send_case.file_fd = make_file(send_case.size);
+            }
+            bench(name, strategies[j].fn, &send_case, send_case.size);
+        }
+        if (send_case.file_fd != -1)
+        {
+            close(send_case.file_fd);
+        }
+    }
+
+    // The drain thread sees the end of the stream and exits
+    if (send_case.sock != -1)
+    {
+        close(send_case.sock);
+        pthread_join(thread, NULL);
+        close(drain_fd);
+    }
+}
+
+// Pin to cpu, or to the last CPU this process may run on when cpu is -1, and
+// pick another one for the drain thread. Returns the CPU pinned to.
+static int pin(int cpu)
+{
+    cpu_set_t allowed, set;
+    int i;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+    {
+        perror("sched_getaffinity");
+        exit(EXIT_FAILURE);
+    }
+    for (i = CPU_SETSIZE - 1; cpu == -1 && i >= 0; i--)
+    {
+        if (CPU_ISSET(i, &allowed))
+        {
+            cpu = i;
+        }
+    }
+    for (i = 0; i < CPU_SETSIZE && drain_cpu == -1; i++)
+    {
+        if (i != cpu && CPU_ISSET(i, &allowed))
+        {
+            drain_cpu = i;
+        }
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    {
+        perror("sched_setaffinity");
+        exit(EXIT_FAILURE);
+    }
+    return cpu;
+}
+
+// Time the pieces of the request path one by one, old and current versions
+// side by side, and write the results as JSON for bench/compare.py
+int main(int argc, char *argv[])
+{
+    const char *out = NULL;
+    int cpu = -1, opt;
+
+    while ((opt = getopt(argc, argv, "c:f:o:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            cpu = atoi(optarg);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'o':
+            out = optarg;
+            break;
+        case 't':
+            run_ns = atoi(optarg) * 1e6;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c cpu] [-f filter] [-o file] [-t ms]\n", argv[0]);
+            fprintf(stderr, "  -c  CPU to pin to, the last one allowed by default\n");
+            fprintf(stderr, "  -f  run only the benchmarks whose name contains filter\n");
+            fprintf(stderr, "  -o  write the JSON results to file instead of stdout\n");
+            fprintf(stderr, "  -t  least duration of each of the %d timed runs, %d ms by default\n", RUNS,
+                    DEFAULT_RUN_MS);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (run_ns <= 0)
+    {
+        fprintf(stderr, "run time must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    json = out != NULL ? fopen(out, "w") : stdout;
+    if (json == NULL)
+    {
+        perror(out);
+        exit(EXIT_FAILURE);
+    }
+
+    cpu = pin(cpu);
+    fprintf(stderr, "pinned to cpu %d, delimiter scanner: %s, median of %d runs\n", cpu, http_parser_impl(), RUNS);
+    fprintf(json, "{\n  \"cpu\": %d,\n  \"parser_impl\": \"%s\",\n  \"runs\": %d,\n  \"run_ms\": %g,\n  \"results\": [",
+            cpu, http_parser_impl(), RUNS, run_ns / 1e6);
+
+    struct text small = {small_request, strlen(small_request)};
+    struct text browser = {browser_request, strlen(browser_request)};
+    bench("parse/sscanf/small", parse_sscanf, &small, 0);
+    bench("parse/http_parse/small", parse_http, &small, 0);
+    bench("parse/sscanf/browser", parse_sscanf, &browser, 0);
+    bench("parse/http_parse/browser", parse_http, &browser, 0);
+
+    bench("mime/strcasecmp_chain", mime_chain, NULL, 0);
+    bench("mime/perfect_hash", mime_table, NULL, 0);
+
+    static struct path_case simple, dotted;
+    init_path_case(&simple, browser_request);
+    init_path_case(&dotted, "GET /static/./js//vendor/../app.bundle%2Emin.js?v=20231017 HTTP/1.1\r\n\r\n");
+    bench("path/snprintf/simple", path_snprintf, &simple, 0);
+    bench("path/normalized/simple", path_normalized, &simple, 0);
+    bench("path/snprintf/dotted", path_snprintf, &dotted, 0);
+    bench("path/normalized/dotted", path_normalized, &dotted, 0);
+
+    struct head_case head;
+    init_head_case(&head);
+    bench("head/snprintf", head_snprintf, &head, 0);
+    bench("head/dprintf", head_dprintf, &head, 0);
+    bench("head/preserialized", head_preserialized, &head, 0);
+    close(head.null_fd);
+
+    bench_send();
+
+    fprintf(json, "\n  ]\n}\n");
+    if (json != stdout && fclose(json) == EOF)
+    {
+        perror(out);
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
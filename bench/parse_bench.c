@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../http_parser.h"
+#include "bench_requests.h"
+
+#define ITERATIONS 2000000
+#define BUFFER_SIZE 1024
+
+static volatile int sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The original path: sscanf the request line into three stack arrays
+static void run_sscanf(const char *request, size_t len)
+{
+    char buf[BUFFER_SIZE];
+    char method[BUFFER_SIZE];
+    char path[BUFFER_SIZE];
+    char protocol[BUFFER_SIZE];
+
+    memcpy(buf, request, len + 1);
+    sscanf(buf, "%s %s %s", method, path, protocol);
+    sink += method[0] + path[0] + protocol[0];
+}
+
+// The whole head in one call
+static void run_parser(const char *request, size_t len)
+{
+    struct http_request req;
+
+    http_parser_init(&req);
+    sink += http_parse(&req, request, len) + req.num_headers;
+}
+
+// The head arriving in two reads, split in the middle
+static void run_parser_split(const char *request, size_t len)
+{
+    struct http_request req;
+
+    http_parser_init(&req);
+    http_parse(&req, request, len / 2);
+    sink += http_parse(&req, request, len) + req.num_headers;
+}
+
+static void bench(const char *name, const char *label, void (*fn)(const char *, size_t), const char *request)
+{
+    size_t len = strlen(request);
+    int i;
+
+    // Warm up caches and the branch predictor
+    for (i = 0; i < ITERATIONS / 10; i++)
+    {
+        fn(request, len);
+    }
+
+    double start = now_ns();
+    for (i = 0; i < ITERATIONS; i++)
+    {
+        fn(request, len);
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%-14s %-8s %4zu bytes  %8.1f ns/request  %8.2f GB/s\n",
+           name, label, len, elapsed / ITERATIONS, len * (double)ITERATIONS / elapsed);
+}
+
+int main(void)
+{
+    printf("delimiter scanner: %s\n", http_parser_impl());
+
+    bench("sscanf", "small", run_sscanf, small_request);
+    bench("http_parse", "small", run_parser, small_request);
+    bench("http_parse/2", "small", run_parser_split, small_request);
+    bench("sscanf", "browser", run_sscanf, browser_request);
+    bench("http_parse", "browser", run_parser, browser_request);
+    bench("http_parse/2", "browser", run_parser_split, browser_request);
+
+    return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Training load for the profile-guided build: every backend of the instrumented
+# server serves small and larger files, missing ones and the statistics pages,
+# kept alive, pipelined and one per connection, then exits cleanly so its
+# profile is written.
+# PORT and ROOT pick the first port and the served directory.
+port=${PORT:-18380}
+root=${ROOT:-.}
+
+for backend in epoll poll select uring; do
+    ./server -w 1 --backend $backend $port "$root" >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    for target in /Makefile /mime.types /server.c /missing /__stats /__stats/prometheus; do
+        ./client -c 20 -n 200 127.0.0.1 $port "$target" >/dev/null
+        ./client -c 10 -n 200 -d 8 127.0.0.1 $port "$target" >/dev/null
+        ./client -k -c 20 -n 10 127.0.0.1 $port "$target" >/dev/null
+    done
+    kill -INT $pid
+    wait $pid 2>/dev/null
+    port=$((port + 1))
+done
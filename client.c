@@ -1,22 +1,656 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #define BUFFER_SIZE 1024
 
+// Room for one response head, and the chunk size body bytes are read and dropped in
+#define RESPONSE_BUFFER_SIZE 16384
+
+// Most requests in flight on one connection
+#define MAX_DEPTH 64
+
+// Latency histogram in nanoseconds, in the manner of an HDR histogram: values
+// below HIST_SUB_BUCKETS are counted exactly, bigger ones keep their top
+// HIST_SUB_BITS - 1 significant bits, so each bucket is within 1% of its values
+#define HIST_SUB_BITS 8
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB_BUCKETS / 2)
+#define HIST_BUCKETS (HIST_SUB_BUCKETS + (64 - HIST_SUB_BITS) * HIST_HALF)
+
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+};
+
+// What every benchmark thread sends and how
+struct bench_config {
+    struct sockaddr_in address;
+    char request[BUFFER_SIZE];
+    size_t request_len;
+    int connections;        // per thread
+    long requests;          // per connection
+    int depth;              // requests in flight per connection
+    int keep_alive;
+    double rate;            // requests per second per thread, 0 to send as fast as responses come back
+};
+
+struct bench_conn {
+    int fd;
+    int in_flight;
+    int to_send;                // requests issued but not fully written
+    size_t send_offset;         // bytes of the first of them already written
+    long issued;
+    int watching_write;
+    uint64_t start[MAX_DEPTH];  // when each request in flight was due, oldest first
+    int start_head;
+
+    // Response parsing: the head is collected in buf, the body is counted down
+    char buf[RESPONSE_BUFFER_SIZE];
+    size_t buf_len;
+    long long body_left;        // -1 while reading a head, LLONG_MAX when the body runs to the close
+    int status;                 // of the response being read
+    int closing;                // the server closes after the current response
+};
+
+struct bench_thread {
+    pthread_t thread;
+    const struct bench_config *config;
+    struct bench_conn *conns;
+    int epoll_fd;
+    int timer_fd;
+    long total;             // requests this thread sends
+    long next;              // index of the next request of the open-loop schedule
+    int next_conn;          // where the search for a free connection starts
+    uint64_t start_ns;
+    uint64_t end_ns;
+
+    // Results
+    struct histogram latency;
+    long completed;
+    long failed;            // requests lost to closed or failed connections
+    long errors;            // responses with a status of 400 and above
+    unsigned long long bytes;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t value) {
+    if (value < HIST_SUB_BUCKETS) {
+        return value;
+    }
+    int shift = 63 - __builtin_clzll(value) - (HIST_SUB_BITS - 1);
+    return HIST_SUB_BUCKETS + (shift - 1) * HIST_HALF + (int)((value >> shift) - HIST_HALF);
+}
+
+// Highest value that lands in bucket index
+static uint64_t hist_value(int index) {
+    if (index < HIST_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = (index - HIST_SUB_BUCKETS) / HIST_HALF + 1;
+    uint64_t sub = (index - HIST_SUB_BUCKETS) % HIST_HALF + HIST_HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+static void hist_record(struct histogram *hist, uint64_t value) {
+    hist->counts[hist_index(value)]++;
+    if (hist->total == 0 || value < hist->min) {
+        hist->min = value;
+    }
+    if (value > hist->max) {
+        hist->max = value;
+    }
+    hist->total++;
+}
+
+static void hist_merge(struct histogram *into, const struct histogram *from) {
+    int i;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    if (from->total > 0 && (into->total == 0 || from->min < into->min)) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    into->total += from->total;
+}
+
+// Smallest recorded value that at least percentile percent of the values do not exceed
+static uint64_t hist_percentile(const struct histogram *hist, double percentile) {
+    uint64_t rank = (uint64_t)(percentile / 100.0 * hist->total + 0.5);
+    uint64_t seen = 0;
+    int i;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t value = hist_value(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+// Open a connection to the server, non-blocking and without Nagle delays.
+// Returns -1 if it cannot be opened.
+static int open_conn(struct bench_thread *bt, struct bench_conn *conn) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr *)&bt->config->address, sizeof(bt->config->address)) == -1) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+    if (epoll_ctl(bt->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        perror("epoll_ctl");
+        close(fd);
+        return -1;
+    }
+    conn->fd = fd;
+    conn->in_flight = 0;
+    conn->to_send = 0;
+    conn->send_offset = 0;
+    conn->watching_write = 0;
+    conn->start_head = 0;
+    conn->buf_len = 0;
+    conn->body_left = -1;
+    conn->closing = 0;
+    return 0;
+}
+
+// Queue a request on conn whose latency counts from due
+static void issue(struct bench_conn *conn, uint64_t due) {
+    conn->start[(conn->start_head + conn->in_flight) % MAX_DEPTH] = due;
+    conn->in_flight++;
+    conn->to_send++;
+    conn->issued++;
+}
+
+// Write the queued requests, all copies of the same bytes, until done or the socket is full
+static int flush_requests(struct bench_thread *bt, struct bench_conn *conn) {
+    const struct bench_config *config = bt->config;
+
+    while (conn->to_send > 0) {
+        struct iovec iov[MAX_DEPTH];
+        int i;
+        for (i = 0; i < conn->to_send; i++) {
+            iov[i].iov_base = (char *)config->request;
+            iov[i].iov_len = config->request_len;
+        }
+        iov[0].iov_base = (char *)config->request + conn->send_offset;
+        iov[0].iov_len -= conn->send_offset;
+
+        ssize_t n = writev(conn->fd, iov, conn->to_send);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        n += conn->send_offset;
+        conn->to_send -= n / config->request_len;
+        conn->send_offset = n % config->request_len;
+    }
+
+    // Wait for room in the socket only while something is left to write
+    int want_write = conn->to_send > 0;
+    if (want_write != conn->watching_write) {
+        struct epoll_event event = {.events = EPOLLIN | (want_write ? EPOLLOUT : 0), .data.ptr = conn};
+        epoll_ctl(bt->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->watching_write = want_write;
+    }
+    return 0;
+}
+
+// Number of requests conn may still issue in a closed loop
+static long closed_loop_room(const struct bench_thread *bt, const struct bench_conn *conn) {
+    long left = bt->config->requests - conn->issued;
+    long room = bt->config->depth - conn->in_flight;
+    return left < room ? left : room;
+}
+
+// Give up on conn: the requests it still owed are lost
+static void drop_conn(struct bench_thread *bt, struct bench_conn *conn) {
+    bt->failed += conn->in_flight;
+    if (bt->config->rate == 0) {
+        bt->failed += bt->config->requests - conn->issued;
+        conn->issued = bt->config->requests;
+    }
+    close(conn->fd);
+    conn->fd = -1;
+    conn->in_flight = 0;
+}
+
+// The server closed conn: count what was lost and reconnect if there is more to send
+static void reopen_conn(struct bench_thread *bt, struct bench_conn *conn) {
+    bt->failed += conn->in_flight;
+    conn->in_flight = 0;
+    close(conn->fd);
+    conn->fd = -1;
+
+    int more = bt->config->rate > 0 ? bt->next < bt->total : conn->issued < bt->config->requests;
+    if (more && open_conn(bt, conn) == -1) {
+        drop_conn(bt, conn);
+    }
+}
+
+// A response is complete: record how long it took from when its request was due
+static void finish_response(struct bench_thread *bt, struct bench_conn *conn, int status) {
+    uint64_t now = now_ns();
+    uint64_t due = conn->start[conn->start_head];
+    hist_record(&bt->latency, now > due ? now - due : 0);
+    conn->start_head = (conn->start_head + 1) % MAX_DEPTH;
+    conn->in_flight--;
+    bt->completed++;
+    if (status >= 400) {
+        bt->errors++;
+    }
+}
+
+// Parse the head at the start of conn->buf ending at head_len: the status code,
+// the body length, and whether the server closes afterwards
+static int parse_head(struct bench_conn *conn, size_t head_len) {
+    int status = 0;
+    const char *line = conn->buf;
+    const char *end = conn->buf + head_len;
+
+    if (head_len > 12 && strncmp(line, "HTTP/1.", 7) == 0) {
+        status = atoi(line + 9);
+    }
+    conn->body_left = LLONG_MAX;
+    while ((line = memchr(line, '\n', end - line)) != NULL && ++line < end) {
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            conn->body_left = strtoll(line + 15, NULL, 10);
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strncasecmp(line + 11, " close", 6) == 0) {
+            conn->closing = 1;
+        }
+    }
+
+    // Responses that never have a body
+    if (status == 304 || status == 204 || (status >= 100 && status < 200)) {
+        conn->body_left = 0;
+    }
+    return status;
+}
+
+// Read responses off conn. Returns -1 once the connection is gone.
+static int read_responses(struct bench_thread *bt, struct bench_conn *conn) {
+    while (1) {
+        ssize_t n = recv(conn->fd, conn->buf + conn->buf_len, sizeof(conn->buf) - conn->buf_len, 0);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            // A body delimited by the close is complete now
+            if (conn->body_left == LLONG_MAX && conn->in_flight > 0) {
+                finish_response(bt, conn, conn->status);
+            }
+            return -1;
+        }
+        bt->bytes += n;
+        conn->buf_len += n;
+
+        while (conn->buf_len > 0 && conn->in_flight > 0) {
+            if (conn->body_left == -1) {
+                char *head_end = memmem(conn->buf, conn->buf_len, "\r\n\r\n", 4);
+                if (head_end == NULL) {
+                    if (conn->buf_len == sizeof(conn->buf)) {
+                        fprintf(stderr, "client: response head too long\n");
+                        return -1;
+                    }
+                    break;
+                }
+                size_t head_len = head_end + 4 - conn->buf;
+                conn->status = parse_head(conn, head_len);
+                conn->buf_len -= head_len;
+                memmove(conn->buf, conn->buf + head_len, conn->buf_len);
+            }
+
+            // Drop the body bytes that arrived
+            size_t body = conn->body_left < (long long)conn->buf_len ? (size_t)conn->body_left : conn->buf_len;
+            if (conn->body_left != LLONG_MAX) {
+                conn->body_left -= body;
+            }
+            conn->buf_len -= body;
+            memmove(conn->buf, conn->buf + body, conn->buf_len);
+            if (conn->body_left != 0) {
+                break;
+            }
+            finish_response(bt, conn, conn->status);
+            conn->body_left = -1;
+            if (conn->closing) {
+                return -1;
+            }
+        }
+    }
+}
+
+// Send time of request index of the open-loop schedule
+static uint64_t due_time(const struct bench_thread *bt, long index) {
+    return bt->start_ns + (uint64_t)(index * 1e9 / bt->config->rate);
+}
+
+// Hand out the open-loop requests that are due to connections with room for
+// them, and set the timer for the next one. Requests that find every
+// connection busy wait, but their latency counts from when they were due.
+static void dispatch_due(struct bench_thread *bt) {
+    const struct bench_config *config = bt->config;
+    uint64_t now = now_ns();
+    int i;
+
+    while (bt->next < bt->total && due_time(bt, bt->next) <= now) {
+        struct bench_conn *conn = NULL;
+        int live = 0;
+        for (i = 0; i < config->connections; i++) {
+            struct bench_conn *candidate = &bt->conns[(bt->next_conn + i) % config->connections];
+            if (candidate->fd != -1) {
+                live++;
+                if (candidate->in_flight < config->depth) {
+                    conn = candidate;
+                    bt->next_conn = (bt->next_conn + i + 1) % config->connections;
+                    break;
+                }
+            }
+        }
+        if (conn == NULL) {
+            // Nobody is left to send the rest
+            if (live == 0) {
+                bt->failed += bt->total - bt->next;
+                bt->next = bt->total;
+            }
+            break;
+        }
+        issue(conn, due_time(bt, bt->next));
+        bt->next++;
+        if (flush_requests(bt, conn) == -1) {
+            reopen_conn(bt, conn);
+        }
+    }
+
+    if (bt->next < bt->total) {
+        struct itimerspec timer = {0};
+        uint64_t due = due_time(bt, bt->next);
+        timer.it_value.tv_sec = due / 1000000000ULL;
+        timer.it_value.tv_nsec = due % 1000000000ULL;
+        timerfd_settime(bt->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+    }
+}
+
+// Issue as many closed-loop requests on conn as it has room for
+static void refill(struct bench_thread *bt, struct bench_conn *conn) {
+    long room = closed_loop_room(bt, conn);
+    uint64_t now = now_ns();
+
+    while (room-- > 0) {
+        issue(conn, now);
+    }
+    if (flush_requests(bt, conn) == -1) {
+        reopen_conn(bt, conn);
+    }
+}
+
+static void *bench_run(void *arg) {
+    struct bench_thread *bt = arg;
+    const struct bench_config *config = bt->config;
+    struct epoll_event events[64];
+    int i;
+
+    bt->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    bt->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    bt->conns = calloc(config->connections, sizeof(*bt->conns));
+    if (bt->epoll_fd == -1 || bt->timer_fd == -1 || bt->conns == NULL) {
+        perror("bench setup");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event timer_event = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(bt->epoll_fd, EPOLL_CTL_ADD, bt->timer_fd, &timer_event);
+
+    bt->total = (long)config->connections * config->requests;
+    for (i = 0; i < config->connections; i++) {
+        if (open_conn(bt, &bt->conns[i]) == -1) {
+            bt->conns[i].fd = -1;
+            drop_conn(bt, &bt->conns[i]);
+        }
+    }
+
+    bt->start_ns = now_ns();
+    if (config->rate > 0) {
+        dispatch_due(bt);
+    } else {
+        for (i = 0; i < config->connections; i++) {
+            if (bt->conns[i].fd != -1) {
+                refill(bt, &bt->conns[i]);
+            }
+        }
+    }
+
+    while (bt->completed + bt->failed < bt->total) {
+        int n = epoll_wait(bt->epoll_fd, events, 64, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < n; i++) {
+            struct bench_conn *conn = events[i].data.ptr;
+            if (conn == NULL) {
+                uint64_t expirations;
+                while (read(bt->timer_fd, &expirations, sizeof(expirations)) > 0) {
+                }
+                continue;
+            }
+            if (conn->fd == -1) {
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && flush_requests(bt, conn) == -1) {
+                reopen_conn(bt, conn);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                if (read_responses(bt, conn) == -1) {
+                    reopen_conn(bt, conn);
+                }
+                if (config->rate == 0 && conn->fd != -1) {
+                    refill(bt, conn);
+                }
+            }
+        }
+        if (config->rate > 0) {
+            dispatch_due(bt);
+        }
+    }
+    bt->end_ns = now_ns();
+
+    for (i = 0; i < config->connections; i++) {
+        if (bt->conns[i].fd != -1) {
+            close(bt->conns[i].fd);
+        }
+    }
+    free(bt->conns);
+    close(bt->timer_fd);
+    close(bt->epoll_fd);
+    return NULL;
+}
+
+// Run the load test over threads threads and print the results
+static void benchmark(struct bench_config *config, int threads) {
+    struct bench_thread *bts = calloc(threads, sizeof(*bts));
+    struct histogram *latency = calloc(1, sizeof(*latency));
+    if (bts == NULL || latency == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    // Every connection needs a descriptor
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int i;
+    for (i = 0; i < threads; i++) {
+        bts[i].config = config;
+        if (pthread_create(&bts[i].thread, NULL, bench_run, &bts[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    long completed = 0, failed = 0, errors = 0;
+    unsigned long long bytes = 0;
+    uint64_t start = UINT64_MAX, end = 0;
+    for (i = 0; i < threads; i++) {
+        pthread_join(bts[i].thread, NULL);
+        hist_merge(latency, &bts[i].latency);
+        completed += bts[i].completed;
+        failed += bts[i].failed;
+        errors += bts[i].errors;
+        bytes += bts[i].bytes;
+        start = bts[i].start_ns < start ? bts[i].start_ns : start;
+        end = bts[i].end_ns > end ? bts[i].end_ns : end;
+    }
+
+    double seconds = (end - start) / 1e9;
+    printf("%d threads, %d connections, depth %d, %s", threads, config->connections * threads, config->depth,
+           config->keep_alive ? "keep-alive" : "connection per request");
+    if (config->rate > 0) {
+        printf(", open loop at %.0f requests/s\n", config->rate * threads);
+    } else {
+        printf(", closed loop\n");
+    }
+    printf("%ld responses in %.3f s, %.1f MB read\n", completed, seconds, bytes / 1e6);
+    printf("Requests/sec: %.1f\n", completed / seconds);
+    printf("Bytes/sec:    %.0f (%.1f MB/s)\n", bytes / seconds, bytes / seconds / 1e6);
+    if (latency->total > 0) {
+        printf("Latency (us): min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", latency->min / 1e3,
+               hist_percentile(latency, 50) / 1e3, hist_percentile(latency, 90) / 1e3,
+               hist_percentile(latency, 99) / 1e3, hist_percentile(latency, 99.9) / 1e3, latency->max / 1e3);
+    }
+    if (errors > 0 || failed > 0) {
+        printf("Error responses: %ld, failed requests: %ld\n", errors, failed);
+    }
+    free(latency);
+    free(bts);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-c connections] [-n requests] [-d depth] [-k] [-r rate] [-t threads] "
+            "<server_ip> <server_port> <file_path>\n"
+            "Without options the file is fetched once and the response written to stdout.\n"
+            "  -c  connections per thread (default 10)\n"
+            "  -n  requests per connection (default 1000)\n"
+            "  -d  requests pipelined on each connection (default 1, at most %d)\n"
+            "  -k  close the connection after every request instead of keeping it alive\n"
+            "  -r  open loop: send this many requests per second in total, latency counted from the\n"
+            "      scheduled send time so stalls are not hidden (default: closed loop)\n"
+            "  -t  threads (default 1)\n",
+            name, MAX_DEPTH);
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char *argv[]) {
+    struct bench_config config = {.connections = 10, .requests = 1000, .depth = 1, .keep_alive = 1, .rate = 0};
+    int threads = 1;
+    int bench = 0;
+    int opt;
+
+    // Parse the options; any of them selects the benchmark
+    while ((opt = getopt(argc, argv, "c:n:d:kr:t:")) != -1) {
+        bench = 1;
+        if (opt == 'c') {
+            config.connections = atoi(optarg);
+        } else if (opt == 'n') {
+            config.requests = atol(optarg);
+        } else if (opt == 'd') {
+            config.depth = atoi(optarg);
+        } else if (opt == 'k') {
+            config.keep_alive = 0;
+        } else if (opt == 'r') {
+            config.rate = atof(optarg);
+        } else if (opt == 't') {
+            threads = atoi(optarg);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
     // Check if the number of arguments is correct
-    if (argc != 4) {
-        printf("Usage: %s <server_ip> <server_port> <file_path>\n", argv[0]);
-        exit(EXIT_FAILURE);
+    if (argc - optind != 3 || config.connections < 1 || config.requests < 1 || config.depth < 1 ||
+        config.depth > MAX_DEPTH || threads < 1 || config.rate < 0) {
+        usage(argv[0]);
     }
 
     // Parse the server IP and port number
-    char *server_ip = argv[1];
-    int server_port = atoi(argv[2]);
+    char *server_ip = argv[optind];
+    int server_port = atoi(argv[optind + 1]);
+    char *file_path = argv[optind + 2];
+    memset(&config.address, 0, sizeof(config.address));
+    config.address.sin_family = AF_INET;
+    config.address.sin_addr.s_addr = inet_addr(server_ip);
+    config.address.sin_port = htons(server_port);
+
+    if (bench) {
+        // A connection that closes after every request has one in flight at a time
+        if (!config.keep_alive) {
+            config.depth = 1;
+        }
+        config.rate /= threads;
+        config.request_len = snprintf(config.request, sizeof(config.request), "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+                                      file_path, server_ip, config.keep_alive ? "" : "Connection: close\r\n");
+        if (config.request_len >= sizeof(config.request)) {
+            fprintf(stderr, "client: path too long\n");
+            exit(EXIT_FAILURE);
+        }
+        benchmark(&config, threads);
+        return 0;
+    }
 
     // Create a TCP socket
     int client_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -26,32 +660,24 @@ int main(int argc, char *argv[]) {
     }
 
     // Connect to the server
-    struct sockaddr_in server_address;
-    memset(&server_address, 0, sizeof(server_address));
-    server_address.sin_family = AF_INET;
-    server_address.sin_addr.s_addr = inet_addr(server_ip);
-    server_address.sin_port = htons(server_port);
-    if (connect(client_socket, (struct sockaddr *)&server_address, sizeof(server_address)) == -1) {
+    if (connect(client_socket, (struct sockaddr *)&config.address, sizeof(config.address)) == -1) {
         perror("connect");
         exit(EXIT_FAILURE);
     }
 
-    // Send the GET request to the server
-    char *file_path = argv[3];
+    // Send the GET request to the server, asking it to close the connection after the response
     char request[BUFFER_SIZE];
-    snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\n\r\n", file_path);
+    snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nConnection: close\r\n\r\n", file_path);
     if (send(client_socket, request, strlen(request), 0) == -1) {
         perror("send");
         exit(EXIT_FAILURE);
     }
 
-    // Receive and print the response from the server
+    // Receive the response and copy it to stdout as it is, since bodies may be binary
     char response[BUFFER_SIZE];
-    memset(response, 0, sizeof(response));
-    int bytes_received;
-    while ((bytes_received = recv(client_socket, response, sizeof(response) - 1, 0)) > 0) {
-        printf("%s", response);
-        memset(response, 0, sizeof(response));
+    ssize_t bytes_received;
+    while ((bytes_received = recv(client_socket, response, sizeof(response), 0)) > 0) {
+        fwrite(response, 1, bytes_received, stdout);
     }
     if (bytes_received == -1) {
         perror("recv");
@@ -62,4 +688,4 @@ int main(int argc, char *argv[]) {
     close(client_socket);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+#include "compress.h"
+#include "http.h"
+
+// Work allowed for one body, in input bytes times level: bodies up to 64 KB
+// get level 9 and the level drops as they grow, down to 1 for the biggest
+#define LEVEL_BUDGET (9UL << 16)
+
+// Level between 1 and max_level that keeps size bytes within the budget
+static int budget_level(size_t size, int max_level)
+{
+    size_t level = LEVEL_BUDGET / (size > 0 ? size : 1);
+    if (level < 1)
+    {
+        return 1;
+    }
+    return level > (size_t)max_level ? max_level : (int)level;
+}
+
+// gzip with a zlib stream wrapped in a gzip header
+static char *compress_gzip(const char *data, size_t size, size_t *compressed_len)
+{
+    z_stream stream = {0};
+    if (deflateInit2(&stream, budget_level(size, 9), Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return NULL;
+    }
+
+    size_t bound = deflateBound(&stream, size);
+    char *out = malloc(bound);
+    if (out == NULL)
+    {
+        deflateEnd(&stream);
+        return NULL;
+    }
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = size;
+    stream.next_out = (Bytef *)out;
+    stream.avail_out = bound;
+    int result = deflate(&stream, Z_FINISH);
+    *compressed_len = stream.total_out;
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END)
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static char *compress_br(const char *data, size_t size, size_t *compressed_len)
+{
+    size_t bound = BrotliEncoderMaxCompressedSize(size);
+    char *out = bound > 0 ? malloc(bound) : NULL;
+    if (out == NULL)
+    {
+        return NULL;
+    }
+    *compressed_len = bound;
+    if (!BrotliEncoderCompress(budget_level(size, 9), BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size,
+                               (const uint8_t *)data, compressed_len, (uint8_t *)out))
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+char *compress_body(int encoding, const char *data, size_t size, size_t *compressed_len)
+{
+    char *out = encoding == HTTP_ENCODING_BR ? compress_br(data, size, compressed_len)
+                                             : compress_gzip(data, size, compressed_len);
+    if (out != NULL && *compressed_len >= size)
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
@@ -0,0 +1,15 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+// Bodies smaller than this are sent as they are: they fit in a packet anyway
+#define COMPRESS_MIN_SIZE 1024
+
+// Compress size bytes of data with encoding, one of the HTTP_ENCODING_*
+// codings, into a buffer from malloc. The level is chosen from a work budget,
+// so small files get the best one and big files a cheaper one.
+// Returns NULL if compression fails or does not make the data smaller.
+char *compress_body(int encoding, const char *data, size_t size, size_t *compressed_len);
+
+#endif
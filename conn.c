@@ -0,0 +1,1589 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+#include "access_log.h"
+#include "asset_pack.h"
+#include "conn.h"
+#include "http.h"
+#include "file_cache.h"
+#include "file_send.h"
+#include "compress.h"
+#include "stats.h"
+#include "trace.h"
+
+#define PATH_SIZE 1024
+
+_Static_assert(CONN_HEADER_SIZE >= HTTP_HEAD_MAX, "header_buf cannot hold a response head");
+_Static_assert(CONN_OUT_CHUNKS >= 2 * HTTP_MAX_RANGES + 2, "output queue cannot hold a multipart response");
+
+// Closing delimiter of a multipart/byteranges body
+#define MULTIPART_END "\r\n--" HTTP_BOUNDARY "--\r\n"
+
+// A file of a request that missed the caches, opened by the offload pool
+struct open_job
+{
+    struct offload_job job;
+    struct conn *conn;          // NULL once the connection is gone
+    struct server_ctx *ctx;
+    const struct mime_entry *type;
+    int accepted;               // codings to look for a sidecar in
+    char path[PATH_SIZE];       // the file, or its index.html for a directory
+    char sidecar[PATH_SIZE];
+    uint64_t start_ns;
+
+    // Filled in by the pool thread
+    int encoding;               // coding of the sidecar found, 0 if path was opened
+    int fd;                     // -1 if nothing was found
+    int status;                 // error to answer with when fd is -1
+    struct stat st;
+    char *body;                 // small file read in for the cache, NULL otherwise
+};
+
+int server_ctx_offload(struct server_ctx *ctx, struct offload_pool *pool)
+{
+    if (offload_queue_init(&ctx->opened) == -1)
+    {
+        return -1;
+    }
+    ctx->offload = pool;
+    return 0;
+}
+
+// Switch to the image published last, keeping the old pack until no response sends from it
+static void switch_pack(struct server_ctx *ctx, unsigned long generation)
+{
+    struct asset_image *image = asset_image_acquire();
+    struct asset_pack *pack = image != NULL ? asset_pack_create(image) : NULL;
+    if (image != NULL && pack == NULL)
+    {
+        // Keep serving the old pack rather than none
+        asset_image_release(image);
+        ctx->pack_generation = generation;
+        return;
+    }
+    if (ctx->pack != NULL)
+    {
+        ctx->retired = asset_pack_retire(ctx->retired, ctx->pack);
+    }
+    ctx->pack = pack;
+    ctx->pack_generation = generation;
+}
+
+int server_ctx_init(struct server_ctx *ctx, const char *root, size_t cache_budget)
+{
+    // Drop trailing slashes so request paths can be appended directly
+    size_t root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/')
+    {
+        root_len--;
+    }
+    ctx->root = strndup(root, root_len);
+    if (ctx->root == NULL)
+    {
+        return -1;
+    }
+    ctx->root_len = root_len;
+
+    // Pin the serving directory, so every request resolves from it instead of walking the whole path
+    ctx->root_fd = open(ctx->root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (ctx->root_fd == -1)
+    {
+        perror(ctx->root);
+        return -1;
+    }
+
+    timer_wheel_init(&ctx->timers, timer_now_ms());
+
+    // Index the published pack right away, so the first request is served from it
+    ctx->pack = NULL;
+    ctx->pack_generation = 0;
+    ctx->retired = NULL;
+    ctx->retired_check_ms = 0;
+    switch_pack(ctx, asset_image_generation());
+
+    ctx->offload = NULL;
+    ctx->opened.event_fd = -1;
+    ctx->num_offloaded = 0;
+    ctx->load.shedding = 0;
+    ctx->load.lag_ns = 0;
+
+    ctx->control = 0;
+    ctx->draining = 0;
+    ctx->manifest = NULL;
+    ctx->control_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->control_fd == -1)
+    {
+        perror("eventfd");
+        return -1;
+    }
+
+    ctx->cache = NULL;
+    if (cache_budget > 0)
+    {
+        ctx->cache = file_cache_create(ctx->root, cache_budget);
+        if (ctx->cache == NULL)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void server_ctx_request(struct server_ctx *ctx, int request)
+{
+    uint64_t one = 1;
+
+    __atomic_or_fetch(&ctx->control, request, __ATOMIC_RELEASE);
+    while (write(ctx->control_fd, &one, sizeof(one)) == -1 && errno == EINTR)
+    {
+    }
+}
+
+// The manifest of a loop being filled in from its cache
+struct manifest
+{
+    const struct server_ctx *ctx;
+    char *text;
+    size_t len;
+    size_t size;
+    int count;
+};
+
+// Add a cached path to the manifest, below root. Compressed variants are
+// cached under their file's path with a suffix and are left out, since
+// warming would take them for files of their own.
+static int add_manifest_path(const char *path, void *arg)
+{
+    struct manifest *manifest = arg;
+    size_t len = strlen(path) - manifest->ctx->root_len;
+    path += manifest->ctx->root_len;
+
+    int encoding;
+    for (encoding = HTTP_ENCODING_GZIP; encoding <= HTTP_ENCODING_BR; encoding <<= 1)
+    {
+        size_t suffix_len = strlen(http_encoding_suffix(encoding));
+        if (len > suffix_len && strcmp(path + len - suffix_len, http_encoding_suffix(encoding)) == 0)
+        {
+            return 0;
+        }
+    }
+
+    if (manifest->len + len + 2 > manifest->size)
+    {
+        size_t size = 2 * manifest->size + len + 2;
+        char *text = realloc(manifest->text, size);
+        if (text == NULL)
+        {
+            return 1;
+        }
+        manifest->text = text;
+        manifest->size = size;
+    }
+    memcpy(manifest->text + manifest->len, path, len);
+    manifest->len += len;
+    manifest->text[manifest->len++] = '\n';
+    manifest->text[manifest->len] = '\0';
+    return ++manifest->count >= SERVER_CTX_MANIFEST_PATHS;
+}
+
+int server_ctx_control(struct server_ctx *ctx)
+{
+    uint64_t count;
+
+    while (read(ctx->control_fd, &count, sizeof(count)) == -1 && errno == EINTR)
+    {
+    }
+    int requests = __atomic_exchange_n(&ctx->control, 0, __ATOMIC_ACQUIRE);
+
+    // List the cached files from the most recently used one
+    if (requests & SERVER_CTX_MANIFEST)
+    {
+        struct manifest manifest = {ctx, NULL, 0, 0, 0};
+        if (ctx->cache != NULL)
+        {
+            file_cache_walk(ctx->cache, add_manifest_path, &manifest);
+        }
+        if (manifest.text == NULL)
+        {
+            manifest.text = strdup("");
+        }
+        if (manifest.text != NULL)
+        {
+            __atomic_store_n(&ctx->manifest, manifest.text, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (requests & SERVER_CTX_DRAIN)
+    {
+        ctx->draining = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// Cache the file at a path below root the way serving it would. Returns 1
+// if it was cached.
+static int warm_file_at(struct server_ctx *ctx, const char *path, size_t len)
+{
+    char full_path[PATH_SIZE];
+    struct stat file_stat;
+
+    if (len == 0 || path[0] != '/' ||
+        snprintf(full_path, sizeof(full_path), "%s%.*s", ctx->root, (int)len, path) >= (int)sizeof(full_path))
+    {
+        return 0;
+    }
+
+    // A path listed twice is hotter the second time round, and the lookup moves it up
+    if (file_cache_lookup(ctx->cache, full_path) != NULL)
+    {
+        return 0;
+    }
+    int file_fd = server_ctx_open(ctx, full_path);
+    if (file_fd == -1)
+    {
+        return 0;
+    }
+    if (fstat(file_fd, &file_stat) == -1 || !S_ISREG(file_stat.st_mode))
+    {
+        close(file_fd);
+        return 0;
+    }
+
+    struct http_validators validators;
+    http_make_validators(&validators, &file_stat);
+    char headers[HTTP_HEAD_MAX];
+    size_t headers_len =
+        http_render_head(headers, 200, http_mime_lookup(full_path), file_stat.st_size, 0, &validators);
+
+    const struct file_cache_entry *entry;
+    if (file_stat.st_size <= FILE_CACHE_MAX_ENTRY)
+    {
+        entry = file_cache_insert(ctx->cache, full_path, file_fd, file_stat.st_size, headers, headers_len,
+                                  &validators);
+        close(file_fd);
+    }
+    else
+    {
+        entry = file_cache_insert_meta(ctx->cache, full_path, file_fd, file_stat.st_size, headers, headers_len,
+                                       &validators);
+        if (entry == NULL)
+        {
+            close(file_fd);
+        }
+    }
+    return entry != NULL;
+}
+
+int server_ctx_warm(struct server_ctx *ctx, const char *manifest, size_t len)
+{
+    int warmed = 0;
+
+    if (ctx->cache == NULL)
+    {
+        return 0;
+    }
+
+    // Take the lines from the last, so the hottest file is inserted last
+    while (len > 0 && manifest[len - 1] == '\n')
+    {
+        len--;
+    }
+    while (len > 0)
+    {
+        const char *newline = memrchr(manifest, '\n', len);
+        const char *line = newline != NULL ? newline + 1 : manifest;
+        warmed += warm_file_at(ctx, line, manifest + len - line);
+        len = newline != NULL ? (size_t)(newline - manifest) : 0;
+    }
+    return warmed;
+}
+
+void conn_init(struct conn *conn, int fd)
+{
+    TRACE_PHASE(TRACE_ACCEPT, fd);
+    conn->fd = fd;
+    conn->state = CONN_IDLE;
+    conn->keep_alive = 1;
+    conn->watching = 0;
+    conn->out_head = 0;
+    conn->out_count = 0;
+    conn->in_len = 0;
+    http_parser_init(&conn->req);
+    conn->accepted_ns = stats_now();
+    conn->response_ns = 0;
+    timer_init(&conn->timer);
+    conn->timer_state = CONN_CLOSED;
+    conn->requests = 0;
+    conn->bytes_sent = 0;
+    conn->window_sent = 0;
+    conn->open_job = NULL;
+    conn->admitted = 0;
+    conn->peer_addr = 0;
+    conn->peer_port = 0;
+    conn->status = 0;
+    conn->path_hash = 0;
+    conn->response_sent = 0;
+    conn->parse_ns = 0;
+    conn->open_ns = 0;
+    stats_add(&stats_thread()->accepted, 1);
+}
+
+// Set once openat2 turns out to be missing, for kernels before 5.6
+static int no_openat2;
+
+const struct file_cache_entry *server_ctx_lookup_pack(struct server_ctx *ctx, const char *path, int accepted,
+                                                      int *encoding)
+{
+    static const int preference[] = {HTTP_ENCODING_BR, HTTP_ENCODING_GZIP};
+    size_t i;
+
+    unsigned long generation = asset_image_generation();
+    if (generation != ctx->pack_generation)
+    {
+        switch_pack(ctx, generation);
+    }
+
+    // Free replaced packs once their last response is out, checking at most once a second
+    if (ctx->retired != NULL && ctx->timers.now >= ctx->retired_check_ms)
+    {
+        ctx->retired = asset_pack_collect(ctx->retired);
+        ctx->retired_check_ms = ctx->timers.now + 1000;
+    }
+
+    if (ctx->pack == NULL)
+    {
+        return NULL;
+    }
+    path = server_ctx_relative_path(ctx, path);
+    for (i = 0; i < sizeof(preference) / sizeof(preference[0]); i++)
+    {
+        const struct file_cache_entry *entry;
+        if ((accepted & preference[i]) && (entry = asset_pack_lookup(ctx->pack, path, preference[i])) != NULL)
+        {
+            *encoding = preference[i];
+            return entry;
+        }
+    }
+    *encoding = 0;
+    return asset_pack_lookup(ctx->pack, path, 0);
+}
+
+int server_ctx_open(struct server_ctx *ctx, const char *path)
+{
+    const char *relative = server_ctx_relative_path(ctx, path);
+
+    if (!__atomic_load_n(&no_openat2, __ATOMIC_RELAXED))
+    {
+        struct open_how how = {
+            .flags = O_RDONLY | O_CLOEXEC,
+            .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS,
+        };
+        int fd = syscall(SYS_openat2, ctx->root_fd, relative, &how, sizeof(how));
+        if (fd != -1 || errno != ENOSYS)
+        {
+            return fd;
+        }
+        __atomic_store_n(&no_openat2, 1, __ATOMIC_RELAXED);
+    }
+
+    // Request paths are normalized, so only symlinks could lead out here
+    return openat(ctx->root_fd, relative, O_RDONLY | O_CLOEXEC);
+}
+
+// Append bytes in memory to the output queue, holding entry while they point into it
+static struct out_chunk *queue_data(struct conn *conn, const char *data, size_t len,
+                                    const struct file_cache_entry *entry)
+{
+    struct out_chunk *chunk = &conn->out[(conn->out_head + conn->out_count++) % CONN_OUT_CHUNKS];
+    chunk->data = data;
+    chunk->file_fd = -1;
+    chunk->offset = 0;
+    chunk->len = len;
+    chunk->entry = entry;
+    chunk->alloc = NULL;
+    if (entry != NULL)
+    {
+        file_cache_hold(entry);
+    }
+    return chunk;
+}
+
+// Append a range of an open file to the output queue. The queue closes the
+// file when done, unless it is the descriptor of entry, which it holds instead.
+// An empty range is not queued, as sending it would look like a shrunk file.
+static void queue_file(struct conn *conn, int file_fd, off_t offset, size_t len,
+                       const struct file_cache_entry *entry)
+{
+    if (len == 0)
+    {
+        if (entry == NULL)
+        {
+            close(file_fd);
+        }
+        return;
+    }
+
+    struct out_chunk *chunk = &conn->out[(conn->out_head + conn->out_count++) % CONN_OUT_CHUNKS];
+    chunk->data = NULL;
+    chunk->file_fd = file_fd;
+    chunk->offset = offset;
+    chunk->len = len;
+    chunk->entry = entry;
+    chunk->alloc = NULL;
+    if (entry != NULL)
+    {
+        file_cache_hold(entry);
+    }
+}
+
+// Drop the chunk at the head of the queue
+static void pop_chunk(struct conn *conn)
+{
+    struct out_chunk *chunk = &conn->out[conn->out_head];
+    if (chunk->file_fd != -1 && chunk->entry == NULL)
+    {
+        close(chunk->file_fd);
+    }
+    if (chunk->entry != NULL)
+    {
+        file_cache_release(chunk->entry);
+    }
+    free(chunk->alloc);
+    conn->out_head = (conn->out_head + 1) % CONN_OUT_CHUNKS;
+    conn->out_count--;
+}
+
+// Phase durations fit the record in 32 bits, saturating after 4 seconds
+static uint32_t log_ns(uint64_t ns)
+{
+    return ns < UINT32_MAX ? ns : UINT32_MAX;
+}
+
+// Queue an access log record of the response being sent, now being when it
+// finished or was cut short
+static void log_response(struct conn *conn, uint64_t now, int flags)
+{
+    struct access_log_record record;
+    struct timespec ts;
+
+    memset(&record, 0, sizeof(record));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    record.time_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    record.status = conn->status;
+    record.path_hash = conn->path_hash;
+    record.bytes = conn->bytes_sent - conn->response_sent;
+    record.send_ns = now - conn->response_ns;
+    record.peer_addr = conn->peer_addr;
+    record.peer_port = conn->peer_port;
+    record.flags = flags | (conn->keep_alive ? 0 : ACCESS_LOG_CLOSE);
+    record.parse_ns = log_ns(conn->parse_ns);
+    record.open_ns = log_ns(conn->open_ns);
+    access_log_append(&record);
+}
+
+void conn_drain(struct conn *conn, struct server_ctx *ctx)
+{
+    // A response in progress already told the client to keep the connection;
+    // the next one tells it to close
+    if (conn->state == CONN_IDLE && !conn_wants_write(conn) && !conn_waiting(conn))
+    {
+        timer_cancel(&conn->timer);
+        conn_schedule_timeout(conn, ctx);
+    }
+}
+
+void conn_cleanup(struct conn *conn)
+{
+    TRACE_PHASE(TRACE_CLOSE, conn->fd);
+
+    // A response cut short is logged with the bytes that made it out
+    if (conn->status != 0 && access_log_active())
+    {
+        log_response(conn, stats_now(), ACCESS_LOG_ABORTED);
+    }
+    while (conn->out_count > 0)
+    {
+        pop_chunk(conn);
+    }
+    timer_cancel(&conn->timer);
+    if (conn->admitted)
+    {
+        admission_release(conn->peer_addr);
+    }
+    if (conn->open_job != NULL)
+    {
+        // The job still runs; its completion finds no connection and cleans up
+        conn->open_job->conn = NULL;
+    }
+    stats_add(&stats_thread()->closed, 1);
+}
+
+void conn_schedule_timeout(struct conn *conn, struct server_ctx *ctx)
+{
+    // A response keeps its send window running across the requests it answers;
+    // the other deadlines keep running as long as the same request is pending
+    if (timer_pending(&conn->timer) && conn->state == conn->timer_state &&
+        (conn->state == CONN_SENDING_BODY || conn->requests == conn->timer_requests))
+    {
+        return;
+    }
+
+    int timeout;
+    switch (conn->state)
+    {
+    case CONN_IDLE:
+        timeout = !conn->admitted ? CONN_REJECT_WAIT_MS : ctx->draining ? CONN_DRAIN_IDLE_MS : CONN_IDLE_TIMEOUT_MS;
+        break;
+    case CONN_READING_HEADERS:
+        timeout = !conn->admitted ? CONN_REJECT_WAIT_MS : CONN_HEADER_TIMEOUT_MS;
+        break;
+    case CONN_SENDING_BODY:
+        timeout = CONN_SEND_WINDOW_MS;
+        conn->window_sent = conn->bytes_sent;
+        break;
+    default:
+        timer_cancel(&conn->timer);
+        return;
+    }
+    conn->timer_state = conn->state;
+    conn->timer_requests = conn->requests;
+    timer_add(&ctx->timers, &conn->timer, ctx->timers.now + timeout);
+}
+
+int conn_timed_out(struct conn *conn, struct server_ctx *ctx)
+{
+    // A response that is slow but moving gets another window
+    if (conn->timer_state == CONN_SENDING_BODY &&
+        conn->bytes_sent - conn->window_sent >= (uint64_t)CONN_MIN_SEND_RATE * CONN_SEND_WINDOW_MS / 1000)
+    {
+        conn->window_sent = conn->bytes_sent;
+        timer_add(&ctx->timers, &conn->timer, ctx->timers.now + CONN_SEND_WINDOW_MS);
+        return 0;
+    }
+    stats_add(&stats_thread()->timeouts, 1);
+    return 1;
+}
+
+static void expire_conn(struct timer *timer, void *arg)
+{
+    struct conn *conn = conn_of_timer(timer);
+    if (conn_timed_out(conn, arg))
+    {
+        shutdown(conn->fd, SHUT_RDWR);
+    }
+}
+
+void conn_expire_timeouts(struct server_ctx *ctx)
+{
+    timer_wheel_advance(&ctx->timers, timer_now_ms(), expire_conn, ctx);
+}
+
+void conn_count_response(struct conn *conn, int status_code)
+{
+    TRACE_PHASE(TRACE_RESOLVED, conn->fd);
+    stats_response(status_code);
+    conn->status = status_code;
+    conn->response_sent = conn->bytes_sent;
+}
+
+void conn_finish_response(struct conn *conn)
+{
+    TRACE_PHASE(TRACE_SENT, conn->fd);
+    uint64_t now = stats_now();
+    stats_record(STATS_SEND, now - conn->response_ns);
+    if (access_log_active())
+    {
+        log_response(conn, now, 0);
+    }
+    conn->status = 0;
+}
+
+void conn_count_sent(struct conn *conn, size_t n)
+{
+    if (conn->bytes_sent == conn->response_sent)
+    {
+        TRACE_PHASE(TRACE_HEADERS, conn->fd);
+    }
+    conn->bytes_sent += n;
+    stats_add(&stats_thread()->bytes_sent, n);
+    if (conn->accepted_ns != 0)
+    {
+        stats_record(STATS_FIRST_BYTE, stats_now() - conn->accepted_ns);
+        conn->accepted_ns = 0;
+    }
+}
+
+void conn_output_sent(struct conn *conn, size_t n)
+{
+    conn_count_sent(conn, n);
+
+    // Retire the chunks that went out completely, empty ones included, and trim the partial one
+    while (conn->out_count > 0)
+    {
+        struct out_chunk *chunk = &conn->out[conn->out_head];
+        if (n == 0 && chunk->len > 0)
+        {
+            break;
+        }
+        size_t part = n < chunk->len ? n : chunk->len;
+        if (chunk->data != NULL)
+        {
+            chunk->data += part;
+        }
+        else
+        {
+            chunk->offset += part;
+        }
+        chunk->len -= part;
+        n -= part;
+        if (chunk->len == 0)
+        {
+            pop_chunk(conn);
+        }
+    }
+}
+
+// Write queued output until it is gone or the socket would block.
+// Returns 0 when the queue is empty, 1 when the socket is full, -1 on error.
+static int flush_output(struct conn *conn)
+{
+    while (conn->out_count > 0)
+    {
+        struct out_chunk *chunk = &conn->out[conn->out_head];
+        ssize_t n;
+
+        if (chunk->data != NULL)
+        {
+            // Gather the consecutive memory chunks into one sendmsg
+            struct iovec iov[CONN_OUT_CHUNKS];
+            int iovcnt = 0;
+            while (iovcnt < conn->out_count)
+            {
+                struct out_chunk *next = &conn->out[(conn->out_head + iovcnt) % CONN_OUT_CHUNKS];
+                if (next->data == NULL)
+                {
+                    break;
+                }
+                iov[iovcnt].iov_base = (void *)next->data;
+                iov[iovcnt].iov_len = next->len;
+                iovcnt++;
+            }
+
+            // Hold the headers back while file data follows so they share packets
+            struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+            n = sendmsg(conn->fd, &msg, iovcnt < conn->out_count ? MSG_MORE : 0);
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            conn_output_sent(conn, n);
+        }
+        else
+        {
+            n = file_send_chunk(conn->fd, chunk->file_fd, &chunk->offset, chunk->len);
+            if (n == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+
+            // The file shrank underneath us, so the promised length cannot be met
+            if (n == 0)
+            {
+                return -1;
+            }
+            conn_count_sent(conn, n);
+            chunk->len -= n;
+            if (chunk->len == 0)
+            {
+                pop_chunk(conn);
+            }
+        }
+    }
+
+    if (conn->out_count == 0)
+    {
+        return 0;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+        return 1;
+    }
+    return -1;
+}
+
+// Queue a response with an empty body, its head rendered into header_buf
+static void send_error(struct conn *conn, int status_code)
+{
+    size_t len = http_render_head(conn->header_buf, status_code, NULL, 0, 0, NULL);
+    len += http_render_head_end(conn->header_buf + len, conn->keep_alive);
+    queue_data(conn, conn->header_buf, len, NULL);
+    conn_count_response(conn, status_code);
+}
+
+// Queue a cached file: pre-rendered headers, Date and Connection headers and
+// body go out in one sendmsg, or the body follows from the cached descriptor
+static void send_cached(struct conn *conn, const struct file_cache_entry *entry)
+{
+    size_t len = http_render_head_end(conn->header_buf, conn->keep_alive);
+    queue_data(conn, entry->headers, entry->headers_len, entry);
+    queue_data(conn, conn->header_buf, len, NULL);
+    if (entry->body != NULL)
+    {
+        queue_data(conn, entry->body, entry->body_len, entry);
+    }
+    else
+    {
+        queue_file(conn, entry->fd, 0, entry->body_len, entry);
+    }
+    conn_count_response(conn, 200);
+}
+
+// Queue one range of a file, from the cached body or descriptor of entry if
+// there is one, otherwise from file_fd
+static void queue_range(struct conn *conn, const struct file_cache_entry *entry, int file_fd,
+                        const struct http_range *range)
+{
+    size_t len = range->last - range->first + 1;
+    if (entry != NULL && entry->body != NULL)
+    {
+        queue_data(conn, entry->body + range->first, len, entry);
+    }
+    else
+    {
+        queue_file(conn, file_fd, range->first, len, entry);
+    }
+}
+
+// Queue a multipart/byteranges response for several ranges. Every file range
+// needs its own descriptor in the queue, so all but the last get a duplicate.
+// Returns -1, with nothing queued, if memory or descriptors ran out.
+static int send_multipart(struct conn *conn, const struct mime_entry *type, int encoding,
+                          const struct file_cache_entry *entry, int file_fd, unsigned long long size,
+                          const struct http_validators *validators, const struct http_range *ranges, int count)
+{
+    int fds[HTTP_MAX_RANGES];
+    size_t part_lens[HTTP_MAX_RANGES];
+    int i;
+
+    // The part heads and the closing delimiter live in one block freed after the last chunk
+    char *parts = malloc(count * HTTP_PART_HEAD_MAX + sizeof(MULTIPART_END));
+    if (parts == NULL)
+    {
+        return -1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        fds[i] = entry != NULL || i == count - 1 ? file_fd : fcntl(file_fd, F_DUPFD_CLOEXEC, 0);
+        if (entry == NULL && fds[i] == -1)
+        {
+            while (--i >= 0)
+            {
+                close(fds[i]);
+            }
+            free(parts);
+            return -1;
+        }
+    }
+
+    // Render the part heads to learn the length of the body
+    unsigned long long body_len = sizeof(MULTIPART_END) - 1;
+    char *part = parts;
+    for (i = 0; i < count; i++)
+    {
+        part_lens[i] = http_render_part_head(part, type, &ranges[i], size);
+        body_len += part_lens[i] + ranges[i].last - ranges[i].first + 1;
+        part += part_lens[i];
+    }
+    memcpy(part, MULTIPART_END, sizeof(MULTIPART_END) - 1);
+
+    size_t len = http_render_multipart_head(conn->header_buf, body_len, type, encoding, validators);
+    len += http_render_head_end(conn->header_buf + len, conn->keep_alive);
+    queue_data(conn, conn->header_buf, len, NULL);
+    part = parts;
+    for (i = 0; i < count; i++)
+    {
+        queue_data(conn, part, part_lens[i], NULL);
+        queue_range(conn, entry, fds[i], &ranges[i]);
+        part += part_lens[i];
+    }
+    queue_data(conn, part, sizeof(MULTIPART_END) - 1, NULL)->alloc = parts;
+    conn_count_response(conn, 206);
+    return 0;
+}
+
+// Answer a Range request for a representation of type, sent with encoding,
+// of size bytes, from the cache entry if there is one, otherwise from
+// file_fd, which the queue then owns. Returns 0 without queuing anything
+// when the whole representation should be sent instead.
+static int send_ranges(struct conn *conn, const struct mime_entry *type, int encoding,
+                       const struct file_cache_entry *entry, int file_fd, unsigned long long size,
+                       const struct http_validators *validators)
+{
+    struct http_range ranges[HTTP_MAX_RANGES];
+    size_t len;
+
+    int count = http_parse_ranges(&conn->req, conn->in_buf, size, validators, ranges);
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    // None of the ranges overlaps the file
+    if (count == -1)
+    {
+        len = http_render_head(conn->header_buf, 416, NULL, 0, 0, NULL);
+        len += http_render_content_range(conn->header_buf + len, NULL, size);
+        len += http_render_head_end(conn->header_buf + len, conn->keep_alive);
+        queue_data(conn, conn->header_buf, len, NULL);
+        conn_count_response(conn, 416);
+        if (entry == NULL)
+        {
+            close(file_fd);
+        }
+        return 1;
+    }
+
+    if (count > 1)
+    {
+        return send_multipart(conn, type, encoding, entry, file_fd, size, validators, ranges, count) == 0;
+    }
+
+    len = http_render_head(conn->header_buf, 206, type, ranges[0].last - ranges[0].first + 1, encoding, validators);
+    len += http_render_content_range(conn->header_buf + len, &ranges[0], size);
+    len += http_render_head_end(conn->header_buf + len, conn->keep_alive);
+    queue_data(conn, conn->header_buf, len, NULL);
+    queue_range(conn, entry, file_fd, &ranges[0]);
+    conn_count_response(conn, 206);
+    return 1;
+}
+
+// Tell the client its copy of a file of type is still current
+static void send_not_modified(struct conn *conn, const struct mime_entry *type,
+                              const struct http_validators *validators)
+{
+    size_t len = http_render_head(conn->header_buf, 304, type, 0, 0, validators);
+    len += http_render_head_end(conn->header_buf + len, conn->keep_alive);
+    queue_data(conn, conn->header_buf, len, NULL);
+    conn_count_response(conn, 304);
+}
+
+// Count a request that the cache, if there is one, could not answer by itself
+static void count_cache_miss(struct server_ctx *ctx)
+{
+    if (ctx->cache != NULL)
+    {
+        stats_add(&stats_thread()->cache_misses, 1);
+    }
+}
+
+// Answer from a cache entry holding a representation of type sent with
+// encoding: revalidations need nothing else, and so do files whose body or
+// descriptor is cached. Returns 0 if the file has to be opened.
+static int serve_entry(struct conn *conn, const struct mime_entry *type, int encoding,
+                       const struct file_cache_entry *entry)
+{
+    if (http_not_modified(&conn->req, conn->in_buf, &entry->validators))
+    {
+        send_not_modified(conn, type, &entry->validators);
+        return 1;
+    }
+    if (entry->body == NULL && entry->fd == -1)
+    {
+        return 0;
+    }
+    if (!send_ranges(conn, type, encoding, entry, entry->fd, entry->body_len, &entry->validators))
+    {
+        send_cached(conn, entry);
+    }
+    return 1;
+}
+
+// Compress the cached body of the file at path with the best coding the
+// client accepts, cache the result under the name of its sidecar and answer
+// with it. Returns 0 if the body is not worth compressing; once the variant
+// is cached, entry may be gone.
+static int serve_compressed(struct conn *conn, struct server_ctx *ctx, const char *path,
+                            const struct mime_entry *type, int accepted, const struct file_cache_entry *entry)
+{
+    int encoding = accepted & HTTP_ENCODING_BR ? HTTP_ENCODING_BR : HTTP_ENCODING_GZIP;
+    char variant_path[PATH_SIZE];
+    size_t body_len;
+
+    if (entry->body == NULL || entry->body_len < COMPRESS_MIN_SIZE ||
+        snprintf(variant_path, sizeof(variant_path), "%s%s", path, http_encoding_suffix(encoding)) >=
+            (int)sizeof(variant_path))
+    {
+        return 0;
+    }
+    char *body = compress_body(encoding, entry->body, entry->body_len, &body_len);
+    if (body == NULL)
+    {
+        return 0;
+    }
+
+    struct http_validators validators;
+    http_variant_validators(&validators, &entry->validators, encoding);
+    size_t len = http_render_head(conn->header_buf, 200, type, body_len, encoding, &validators);
+
+    // Inserting may evict the file itself, so hold it in case the variant does not fit
+    file_cache_hold(entry);
+    const struct file_cache_entry *variant =
+        file_cache_insert_data(ctx->cache, variant_path, body, body_len, conn->header_buf, len, &validators);
+    free(body);
+    if (variant != NULL)
+    {
+        serve_entry(conn, type, encoding, variant);
+    }
+    else
+    {
+        serve_entry(conn, type, 0, entry);
+    }
+    file_cache_release(entry);
+    return 1;
+}
+
+// Answer with the open regular file file_fd, the representation of type sent
+// with encoding, and keep it in the cache under path. A body newly cached is
+// compressed right away if the client accepts a coding for it. body is the
+// content of a small file already read for the cache, freed here, or NULL.
+static void serve_file(struct conn *conn, struct server_ctx *ctx, const char *path, int file_fd,
+                       const struct stat *file_stat, const struct mime_entry *type, int encoding, int accepted,
+                       char *body)
+{
+    // Render the response headers up to the Date header
+    struct http_validators validators;
+    http_make_validators(&validators, file_stat);
+    if (encoding != 0)
+    {
+        struct http_validators file_validators = validators;
+        http_variant_validators(&validators, &file_validators, encoding);
+    }
+    char *response_headers = conn->header_buf;
+    size_t len = http_render_head(response_headers, 200, type, file_stat->st_size, encoding, &validators);
+
+    // Keep small files in memory for the next request, and the validators and descriptor of big ones
+    if (ctx->cache != NULL)
+    {
+        const struct file_cache_entry *entry;
+        if (file_stat->st_size <= FILE_CACHE_MAX_ENTRY)
+        {
+            if (body != NULL)
+            {
+                entry = file_cache_insert_data(ctx->cache, path, body, file_stat->st_size, response_headers, len,
+                                               &validators);
+                free(body);
+                body = NULL;
+            }
+            else
+            {
+                entry = file_cache_insert(ctx->cache, path, file_fd, file_stat->st_size, response_headers, len,
+                                          &validators);
+            }
+            if (entry != NULL)
+            {
+                close(file_fd);
+            }
+        }
+        else
+        {
+            entry = file_cache_insert_meta(ctx->cache, path, file_fd, file_stat->st_size, response_headers, len,
+                                           &validators);
+        }
+        if (entry != NULL)
+        {
+            if (accepted == 0 || !serve_compressed(conn, ctx, path, type, accepted, entry))
+            {
+                serve_entry(conn, type, encoding, entry);
+            }
+            return;
+        }
+    }
+
+    free(body);
+    if (http_not_modified(&conn->req, conn->in_buf, &validators))
+    {
+        close(file_fd);
+        send_not_modified(conn, type, &validators);
+        return;
+    }
+
+    // Stream the requested ranges or the whole file from disk
+    if (send_ranges(conn, type, encoding, NULL, file_fd, file_stat->st_size, &validators))
+    {
+        return;
+    }
+    len += http_render_head_end(response_headers + len, conn->keep_alive);
+    queue_data(conn, response_headers, len, NULL);
+    queue_file(conn, file_fd, 0, file_stat->st_size, NULL);
+    conn_count_response(conn, 200);
+}
+
+// Answer with the sidecar at path holding a copy of a file of type compressed
+// with encoding. Returns 0 if there is no such sidecar.
+static int serve_sidecar(struct conn *conn, struct server_ctx *ctx, const char *path,
+                         const struct mime_entry *type, int encoding)
+{
+    struct stat file_stat;
+
+    int file_fd = server_ctx_open(ctx, path);
+    if (file_fd == -1)
+    {
+        return 0;
+    }
+    if (fstat(file_fd, &file_stat) == -1 || !S_ISREG(file_stat.st_mode))
+    {
+        close(file_fd);
+        return 0;
+    }
+    serve_file(conn, ctx, path, file_fd, &file_stat, type, encoding, 0, NULL);
+    return 1;
+}
+
+// Answer with a compressed variant of the file at path in a coding the client
+// accepts: a cached one, a .br or .gz sidecar next to the file, or else the
+// cached body of the file, entry, compressed once. Returns 0 if the file has
+// to go out as it is; entry is still valid then.
+static int serve_encoded(struct conn *conn, struct server_ctx *ctx, const char *path,
+                         const struct mime_entry *type, int accepted, const struct file_cache_entry *entry)
+{
+    static const int preference[] = {HTTP_ENCODING_BR, HTTP_ENCODING_GZIP};
+    char variant_path[PATH_SIZE];
+    size_t i;
+
+    // Not worth looking for when the file is tiny
+    if (entry != NULL && entry->body_len < COMPRESS_MIN_SIZE)
+    {
+        return 0;
+    }
+
+    // Variants made ahead of time beat those compressed here with a cheap level
+    for (i = 0; i < sizeof(preference) / sizeof(preference[0]); i++)
+    {
+        int encoding = preference[i];
+        if (!(accepted & encoding) ||
+            snprintf(variant_path, sizeof(variant_path), "%s%s", path, http_encoding_suffix(encoding)) >=
+                (int)sizeof(variant_path))
+        {
+            continue;
+        }
+        if (ctx->cache != NULL)
+        {
+            const struct file_cache_entry *variant = file_cache_lookup(ctx->cache, variant_path);
+            if (variant != NULL && serve_entry(conn, type, encoding, variant))
+            {
+                stats_add(&stats_thread()->cache_hits, 1);
+                return 1;
+            }
+        }
+        if (serve_sidecar(conn, ctx, variant_path, type, encoding))
+        {
+            count_cache_miss(ctx);
+            return 1;
+        }
+    }
+    if (entry != NULL && serve_compressed(conn, ctx, path, type, accepted, entry))
+    {
+        count_cache_miss(ctx);
+        return 1;
+    }
+    return 0;
+}
+
+// Read a file the pool opened ahead of sending it: a small one in whole for
+// the cache, or the start of a big one, so the loop does not wait on the disk
+static void warm_file(struct open_job *open)
+{
+    size_t size = open->st.st_size, done = 0;
+
+    if (open->ctx->cache == NULL || size > FILE_CACHE_MAX_ENTRY)
+    {
+        posix_fadvise(open->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(open->fd, 0, size < CONN_READAHEAD ? size : CONN_READAHEAD, POSIX_FADV_WILLNEED);
+        return;
+    }
+    open->body = malloc(size > 0 ? size : 1);
+    while (open->body != NULL && done < size)
+    {
+        ssize_t n = pread(open->fd, open->body + done, size - done, done);
+        if (n > 0)
+        {
+            done += n;
+        }
+        else if (n == 0 || errno != EINTR)
+        {
+            // Let the loop read it the usual way and find out
+            free(open->body);
+            open->body = NULL;
+        }
+    }
+}
+
+// Find the file of a request on a pool thread: a sidecar in a coding the
+// client accepts, otherwise the file itself or the index.html of a directory
+static void run_open_job(struct offload_job *job)
+{
+    static const int preference[] = {HTTP_ENCODING_BR, HTTP_ENCODING_GZIP};
+    struct open_job *open = (struct open_job *)job;
+    size_t i;
+
+    for (i = 0; i < sizeof(preference) / sizeof(preference[0]); i++)
+    {
+        open->encoding = preference[i];
+        if (!(open->accepted & open->encoding) ||
+            snprintf(open->sidecar, sizeof(open->sidecar), "%s%s", open->path,
+                     http_encoding_suffix(open->encoding)) >= (int)sizeof(open->sidecar))
+        {
+            continue;
+        }
+        open->fd = server_ctx_open(open->ctx, open->sidecar);
+        if (open->fd != -1 && fstat(open->fd, &open->st) == 0 && S_ISREG(open->st.st_mode))
+        {
+            warm_file(open);
+            return;
+        }
+        if (open->fd != -1)
+        {
+            close(open->fd);
+        }
+    }
+    open->encoding = 0;
+
+    open->fd = server_ctx_open(open->ctx, open->path);
+    if (open->fd == -1 || fstat(open->fd, &open->st) == -1)
+    {
+        // Paths escaping the serving directory through a symlink look like missing files
+        open->status = errno == ENOENT || errno == ENOTDIR || errno == EXDEV || errno == ELOOP ? 404 : 400;
+        goto fail;
+    }
+
+    // Serve index.html for directories named without a trailing slash
+    if (S_ISDIR(open->st.st_mode))
+    {
+        close(open->fd);
+        size_t len = strlen(open->path);
+        if (len + strlen("/index.html") >= sizeof(open->path))
+        {
+            open->fd = -1;
+            open->status = 414;
+            return;
+        }
+        strcpy(open->path + len, "/index.html");
+        open->status = 404;
+        open->fd = server_ctx_open(open->ctx, open->path);
+        if (open->fd == -1 || fstat(open->fd, &open->st) == -1)
+        {
+            goto fail;
+        }
+    }
+
+    if (!S_ISREG(open->st.st_mode))
+    {
+        open->status = 404;
+        goto fail;
+    }
+    warm_file(open);
+    return;
+
+fail:
+    if (open->fd != -1)
+    {
+        close(open->fd);
+        open->fd = -1;
+    }
+}
+
+// Hand the file of a request that missed the caches to the offload pool. The
+// connection waits, with nothing to send, until conn_complete_open.
+// Returns 0 if the file has to be opened here.
+static int offload_open(struct conn *conn, struct server_ctx *ctx, const char *path, const struct mime_entry *type,
+                        int accepted)
+{
+    struct open_job *open = malloc(sizeof(*open));
+    if (open == NULL)
+    {
+        return 0;
+    }
+    open->job.run = run_open_job;
+    open->conn = conn;
+    open->ctx = ctx;
+    open->type = type;
+    open->accepted = accepted;
+    strcpy(open->path, path);
+    open->start_ns = stats_now();
+    open->fd = -1;
+    open->status = 0;
+    open->body = NULL;
+
+    conn->open_job = open;
+    ctx->num_offloaded++;
+    offload_submit(ctx->offload, &open->job, &ctx->opened);
+    return 1;
+}
+
+// Drop an answered request from the input buffer, keeping any pipelined bytes that follow it
+static void finish_request(struct conn *conn)
+{
+    conn->requests++;
+    size_t request_len = conn->req.head_len;
+    conn->in_len -= request_len;
+    memmove(conn->in_buf, conn->in_buf + request_len, conn->in_len);
+    http_parser_init(&conn->req);
+}
+
+struct conn *conn_complete_open(struct server_ctx *ctx, struct offload_job *job)
+{
+    struct open_job *open = (struct open_job *)job;
+    struct conn *conn = open->conn;
+
+    ctx->num_offloaded--;
+    if (conn == NULL)
+    {
+        if (open->fd != -1)
+        {
+            close(open->fd);
+        }
+        free(open->body);
+        free(open);
+        return NULL;
+    }
+    conn->open_job = NULL;
+
+    if (open->fd == -1)
+    {
+        free(open->body);
+        send_error(conn, open->status);
+    }
+    else if (open->encoding != 0)
+    {
+        serve_file(conn, ctx, open->sidecar, open->fd, &open->st, open->type, open->encoding, 0, open->body);
+    }
+    else
+    {
+        conn->open_ns = stats_now() - open->start_ns;
+        stats_record(STATS_OPEN, conn->open_ns);
+        const struct mime_entry *type = http_mime_lookup(open->path);
+        int accepted = http_mime_compressible(type) ? http_accepted_encodings(&conn->req, conn->in_buf) : 0;
+        serve_file(conn, ctx, open->path, open->fd, &open->st, type, 0, accepted, open->body);
+    }
+    free(open);
+    finish_request(conn);
+    return conn;
+}
+
+// Serve the file named by request_path below the serving directory
+static void serve_get(struct conn *conn, struct server_ctx *ctx, const char *request_path)
+{
+    char full_path[PATH_SIZE];
+    struct stat file_stat;
+
+    // Construct the full path of the requested file, with index.html for directories
+    const char *index = request_path[strlen(request_path) - 1] == '/' ? "index.html" : "";
+    if (snprintf(full_path, sizeof(full_path), "%s%s%s", ctx->root, request_path, index) >= (int)sizeof(full_path))
+    {
+        send_error(conn, 414);
+        return;
+    }
+
+    // Codings the client accepts, for types worth compressing
+    const struct mime_entry *type = http_mime_lookup(full_path);
+    int accepted = http_mime_compressible(type) ? http_accepted_encodings(&conn->req, conn->in_buf) : 0;
+
+    // Serve straight from the mapping when the file is packed
+    int encoding;
+    const struct file_cache_entry *entry = server_ctx_lookup_pack(ctx, full_path, accepted, &encoding);
+    if (entry != NULL && serve_entry(conn, type, encoding, entry))
+    {
+        stats_add(&stats_thread()->cache_hits, 1);
+        return;
+    }
+
+    // Serve straight from memory when the file is cached
+    entry = NULL;
+    if (ctx->cache != NULL)
+    {
+        entry = file_cache_lookup(ctx->cache, full_path);
+    }
+
+    // Files that missed the cache are looked for by the offload pool when there is room, sidecars included
+    int offload = entry == NULL && ctx->offload != NULL && ctx->num_offloaded < CONN_MAX_OFFLOADED;
+    if (accepted != 0 && !offload && serve_encoded(conn, ctx, full_path, type, accepted, entry))
+    {
+        return;
+    }
+    if (entry != NULL && serve_entry(conn, type, 0, entry))
+    {
+        stats_add(&stats_thread()->cache_hits, 1);
+        return;
+    }
+    count_cache_miss(ctx);
+    if (offload && offload_open(conn, ctx, full_path, type, accepted))
+    {
+        return;
+    }
+
+    // Open the requested file
+    uint64_t open_start = stats_now();
+    int file_fd = server_ctx_open(ctx, full_path);
+    if (file_fd == -1 || fstat(file_fd, &file_stat) == -1)
+    {
+        // Paths escaping the serving directory through a symlink look like missing files
+        send_error(conn, errno == ENOENT || errno == ENOTDIR || errno == EXDEV || errno == ELOOP ? 404 : 400);
+        if (file_fd != -1)
+        {
+            close(file_fd);
+        }
+        return;
+    }
+
+    // Serve index.html for directories named without a trailing slash
+    if (S_ISDIR(file_stat.st_mode))
+    {
+        close(file_fd);
+        size_t len = strlen(full_path);
+        if (len + strlen("/index.html") >= sizeof(full_path))
+        {
+            send_error(conn, 414);
+            return;
+        }
+        strcpy(full_path + len, "/index.html");
+        file_fd = server_ctx_open(ctx, full_path);
+        if (file_fd == -1 || fstat(file_fd, &file_stat) == -1)
+        {
+            send_error(conn, 404);
+            if (file_fd != -1)
+            {
+                close(file_fd);
+            }
+            return;
+        }
+        type = http_mime_lookup(full_path);
+        accepted = http_mime_compressible(type) ? http_accepted_encodings(&conn->req, conn->in_buf) : 0;
+    }
+
+    if (!S_ISREG(file_stat.st_mode))
+    {
+        close(file_fd);
+        send_error(conn, 404);
+        return;
+    }
+    conn->open_ns = stats_now() - open_start;
+    stats_record(STATS_OPEN, conn->open_ns);
+
+    serve_file(conn, ctx, full_path, file_fd, &file_stat, type, 0, accepted, NULL);
+}
+
+// Answer with the statistics of all threads
+static void send_stats(struct conn *conn, int format)
+{
+    size_t body_len;
+    char *body = stats_render(format, &body_len);
+    if (body == NULL)
+    {
+        send_error(conn, 500);
+        return;
+    }
+
+    const struct mime_entry *type = http_mime_lookup(format == STATS_PROMETHEUS ? ".txt" : ".json");
+    size_t len = http_render_head(conn->header_buf, 200, type, body_len, 0, NULL);
+    len += http_render_head_end(conn->header_buf + len, conn->keep_alive);
+    queue_data(conn, conn->header_buf, len, NULL);
+    queue_data(conn, body, body_len, NULL)->alloc = body;
+    conn_count_response(conn, 200);
+}
+
+// Queue the pre-serialized 503 for a request turned away; the connection closes after it
+static void send_overloaded(struct conn *conn)
+{
+    static const char response[] = ADMISSION_RESPONSE;
+
+    conn->keep_alive = 0;
+    queue_data(conn, response, sizeof(response) - 1, NULL);
+    conn_count_response(conn, 503);
+    if (conn->admitted)
+    {
+        stats_add(&stats_thread()->shed, 1);
+    }
+}
+
+// Serve the request parsed into conn->req
+static void handle_request(struct conn *conn, struct server_ctx *ctx)
+{
+    const struct http_request *req = &conn->req;
+    char request_path[PATH_SIZE];
+
+    // Turn the request away without looking at it while the loop is overloaded
+    if (!conn->admitted || ctx->load.shedding)
+    {
+        send_overloaded(conn);
+        return;
+    }
+
+    conn->keep_alive = http_wants_keep_alive(req, conn->in_buf) && !ctx->draining;
+
+    // Only GET is supported; other methods may carry a body we cannot frame, so close afterwards
+    if (req->method.len != 3 || memcmp(conn->in_buf + req->method.off, "GET", 3) != 0)
+    {
+        conn->keep_alive = 0;
+        send_error(conn, 405);
+        return;
+    }
+
+    // Extract the path, keeping the request inside the serving directory
+    int status_code = http_request_path(req, conn->in_buf, request_path, sizeof(request_path));
+    if (status_code != 0)
+    {
+        send_error(conn, status_code);
+        return;
+    }
+    if (access_log_active())
+    {
+        conn->path_hash = access_log_path_hash(request_path);
+    }
+
+    int stats_format = stats_request_format(request_path);
+    if (stats_format != -1)
+    {
+        send_stats(conn, stats_format);
+        return;
+    }
+    serve_get(conn, ctx, request_path);
+}
+
+int conn_answer(struct conn *conn, struct server_ctx *ctx)
+{
+    uint64_t parse_start = stats_now();
+    enum http_parse_result result = http_parse(&conn->req, conn->in_buf, conn->in_len);
+    conn->response_ns = stats_now();
+    conn->parse_ns = conn->response_ns - parse_start;
+    conn->path_hash = 0;
+    conn->open_ns = 0;
+    if (result == HTTP_PARSE_INCOMPLETE && conn->in_len < sizeof(conn->in_buf))
+    {
+        return 0;
+    }
+
+    conn->state = CONN_SENDING_BODY;
+    if (result == HTTP_PARSE_ERROR)
+    {
+        conn->keep_alive = 0;
+        send_error(conn, conn->req.error_status);
+        return 1;
+    }
+    if (result == HTTP_PARSE_INCOMPLETE)
+    {
+        // The headers do not fit in the buffer
+        conn->keep_alive = 0;
+        send_error(conn, 431);
+        return 1;
+    }
+
+    TRACE_PHASE(TRACE_PARSED, conn->fd);
+    stats_record(STATS_PARSE, conn->parse_ns);
+    handle_request(conn, ctx);
+
+    // A request waiting for the offload pool is finished by conn_complete_open
+    if (!conn_waiting(conn))
+    {
+        finish_request(conn);
+    }
+    return 1;
+}
+
+int conn_run(struct conn *conn, struct server_ctx *ctx)
+{
+    unsigned long requests = conn->requests;
+
+    // Nothing moves until the offload pool has opened the file of the current request
+    if (conn_waiting(conn))
+    {
+        return 0;
+    }
+
+    while (conn->state != CONN_CLOSED)
+    {
+        // Finish the previous response before looking at the next request
+        if (conn->out_count > 0)
+        {
+            int result = flush_output(conn);
+            if (result == -1)
+            {
+                conn->state = CONN_CLOSED;
+                break;
+            }
+            if (result == 1)
+            {
+                // The socket is full; wait until it is writable again
+                conn->state = CONN_SENDING_BODY;
+                break;
+            }
+            conn_finish_response(conn);
+        }
+
+        // The response went out and the connection was meant to end with it
+        if (!conn->keep_alive)
+        {
+            conn->state = CONN_CLOSED;
+            break;
+        }
+
+        // Answer the next request already in the buffer
+        if (conn->in_len > 0 && conn_answer(conn, ctx))
+        {
+            if (conn_waiting(conn))
+            {
+                break;
+            }
+            continue;
+        }
+
+        // Read whatever the client sent
+        ssize_t n = recv(conn->fd, conn->in_buf + conn->in_len, sizeof(conn->in_buf) - conn->in_len, 0);
+        if (n > 0)
+        {
+            if (conn->in_len == 0)
+            {
+                TRACE_PHASE(TRACE_READ, conn->fd);
+            }
+            conn->in_len += n;
+            conn->state = CONN_READING_HEADERS;
+        }
+        else if (n == 0)
+        {
+            // The client closed the connection
+            conn->state = CONN_CLOSED;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            // Nothing more to read until the socket is readable again
+            conn->state = conn->in_len > 0 ? CONN_READING_HEADERS : CONN_IDLE;
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            conn->state = CONN_CLOSED;
+        }
+    }
+
+    return conn->requests - requests;
+}
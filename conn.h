@@ -0,0 +1,280 @@
+#ifndef CONN_H
+#define CONN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "admission.h"
+#include "http_parser.h"
+#include "offload.h"
+#include "timer_wheel.h"
+
+#define CONN_BUFFER_SIZE 8192
+#define CONN_HEADER_SIZE 576
+#define CONN_OUT_CHUNKS 20   // room for a multipart/byteranges response
+
+// Default size of the per-loop file cache
+#define DEFAULT_CACHE_BUDGET (64 << 20)
+
+// Timeouts enforced by the timer wheel of each event loop
+#define CONN_IDLE_TIMEOUT_MS 30000      // keep-alive connection waiting for its next request
+#define CONN_HEADER_TIMEOUT_MS 10000    // from the first byte of a request head to its end
+#define CONN_SEND_WINDOW_MS 10000       // a response must move CONN_MIN_SEND_RATE over each window
+#define CONN_MIN_SEND_RATE 1024         // bytes per second
+
+// Idle timeout while the loop drains for a reload. Closing an idle connection
+// right away would race with a request the client is sending, and fail it;
+// a busy client sends one soon and closes after its response instead.
+#define CONN_DRAIN_IDLE_MS 1000
+
+// How long a connection admission control turned away waits for its request,
+// which is read before the 503 goes out so the close does not reset it
+#define CONN_REJECT_WAIT_MS 1000
+
+// Most files an event loop has being opened by the offload pool at once;
+// beyond that they are opened on the loop itself
+#define CONN_MAX_OFFLOADED 256
+
+// Bytes of a big file read ahead by the offload pool before it is sent
+#define CONN_READAHEAD (2 << 20)
+
+// Requests of the main thread to an event loop, signalled on its control_fd
+#define SERVER_CTX_MANIFEST 1   // list the hottest cached paths into manifest
+#define SERVER_CTX_DRAIN 2      // stop accepting and return once every connection closed
+
+// Most paths an event loop lists in its manifest
+#define SERVER_CTX_MANIFEST_PATHS 1024
+
+struct asset_pack;
+struct file_cache;
+struct file_cache_entry;
+struct open_job;
+
+// Settings and caches of one event loop
+struct server_ctx
+{
+    char *root;                 // serving directory without a trailing slash
+    size_t root_len;
+    int root_fd;                // the serving directory, which files are opened below
+    struct file_cache *cache;   // hot files, NULL when caching is disabled
+    struct timer_wheel timers;  // timeouts of the loop's connections
+
+    // Index over the published asset pack, NULL when there is none
+    struct asset_pack *pack;
+    unsigned long pack_generation;  // the published image the loop last switched to
+    struct asset_pack *retired;     // replaced packs still being sent
+    uint64_t retired_check_ms;      // when to look for retired packs that can go
+
+    // Opening cold files off the loop, NULL pool to open them on the loop
+    struct offload_pool *offload;
+    struct offload_queue opened;    // open jobs that finished
+    int num_offloaded;              // open jobs in flight
+
+    struct admission_load load;     // whether the loop is overloaded and sheds requests
+
+    // Requests of the main thread for a reload
+    int control_fd;             // eventfd the loop watches
+    int control;                // SERVER_CTX_* bits not carried out yet
+    int draining;               // connections close after the response in progress
+    char *manifest;             // paths below root, one per line, published for SERVER_CTX_MANIFEST
+};
+
+// Where a connection is in its request/response cycle
+enum conn_state
+{
+    CONN_IDLE,              // between requests, nothing buffered
+    CONN_READING_HEADERS,   // part of a request has arrived
+    CONN_SENDING_BODY,      // a response is queued and not fully written
+    CONN_CLOSED             // the connection should be torn down
+};
+
+// A piece of a queued response: bytes in memory or a range of an open file
+struct out_chunk
+{
+    const char *data;                       // memory to send, NULL for a file range
+    int file_fd;                            // file to send from, closed once sent
+    off_t offset;                           // next file offset to send
+    size_t len;                             // bytes left in this chunk
+    const struct file_cache_entry *entry;   // cache entry held while data points into it
+    char *alloc;                            // heap block freed once this chunk is sent
+};
+
+// Per-connection state shared by all the event loops
+struct conn
+{
+    int fd;
+    enum conn_state state;
+    int keep_alive;
+    int watching;           // events the event loop waits for on the socket
+    int admitted;           // counted by admission control until conn_cleanup; requests get a 503 if not
+    struct http_request req;
+
+    // For the latency statistics
+    uint64_t accepted_ns;   // when the connection was accepted, 0 once its first response byte went out
+    uint64_t response_ns;   // when the response being sent was queued
+
+    // Timeouts
+    struct timer timer;
+    enum conn_state timer_state;    // state the timer was armed for
+    unsigned long requests;         // requests answered so far
+    unsigned long timer_requests;   // requests answered when the timer was armed
+    uint64_t bytes_sent;
+    uint64_t window_sent;           // bytes_sent when the current send window began
+
+    // For the access log
+    uint32_t peer_addr;             // IPv4 address and port of the client, 0 if unknown
+    uint16_t peer_port;
+    int status;                     // status code of the response being sent, 0 if none
+    uint64_t path_hash;             // access log hash of the request path, 0 if none
+    uint64_t response_sent;         // bytes_sent when the response was queued
+    uint64_t parse_ns;
+    uint64_t open_ns;
+
+    // File of the request being answered that the offload pool is opening, NULL if none
+    struct open_job *open_job;
+
+    // Output queue, a ring of chunks written in order
+    struct out_chunk out[CONN_OUT_CHUNKS];
+    int out_head;
+    int out_count;
+    char header_buf[CONN_HEADER_SIZE];
+
+    size_t in_len;
+    char in_buf[CONN_BUFFER_SIZE];
+};
+
+// Set up the context of an event loop serving root with a file cache of
+// cache_budget bytes (0 disables it). Returns -1 on failure.
+int server_ctx_init(struct server_ctx *ctx, const char *root, size_t cache_budget);
+
+// Open the files that miss the caches on the threads of pool instead of the
+// event loop, which then polls ctx->opened. Returns -1 on failure.
+int server_ctx_offload(struct server_ctx *ctx, struct offload_pool *pool);
+
+// The part of a full path below the serving directory, to resolve against root_fd
+static inline const char *server_ctx_relative_path(const struct server_ctx *ctx, const char *path)
+{
+    path += ctx->root_len;
+    while (*path == '/')
+    {
+        path++;
+    }
+    return *path != '\0' ? path : ".";
+}
+
+// The entry of the file at a full path in the loop's asset pack, in the best
+// of the accepted HTTP_ENCODING_* codings the pack has a variant in, stored
+// into encoding, or NULL if the file is not packed. Switches to a newly
+// published pack first.
+const struct file_cache_entry *server_ctx_lookup_pack(struct server_ctx *ctx, const char *path, int accepted,
+                                                      int *encoding);
+
+// Open the file at a full path for reading, resolving it below root_fd so
+// that neither .. nor a symlink can lead out of the serving directory.
+// Returns -1 with errno set like open does.
+int server_ctx_open(struct server_ctx *ctx, const char *path);
+
+// Ask the loop of ctx for the SERVER_CTX_* request from another thread
+void server_ctx_request(struct server_ctx *ctx, int request);
+
+// Carry out the requests of the main thread once ctx->control_fd became
+// readable. A manifest is published with a release store to ctx->manifest.
+// Returns 1 if the loop should start draining: stop accepting, call
+// conn_drain on each connection and return once none is left.
+int server_ctx_control(struct server_ctx *ctx);
+
+// Cache the files a predecessor's manifest lists, hottest last so they end
+// up most recently used. Returns the number of files cached.
+int server_ctx_warm(struct server_ctx *ctx, const char *manifest, size_t len);
+
+// Reset a connection for a newly accepted non-blocking socket
+void conn_init(struct conn *conn, int fd);
+
+// Make progress on a connection after its socket became readable or writable:
+// write queued output, answer buffered requests in order and read more,
+// until the socket would block. A response that cannot be written completely
+// stays queued and holds back further requests on this connection only.
+// Returns the number of requests answered; the state is CONN_CLOSED afterwards
+// when the connection should be torn down.
+int conn_run(struct conn *conn, struct server_ctx *ctx);
+
+// Parse the request at the front of the input buffer and queue its response,
+// for loops that do their own socket I/O, or start the offload pool opening
+// its file (see conn_waiting). Returns 1 with the state CONN_SENDING_BODY
+// once there is a response, 0 if the request has not fully arrived.
+int conn_answer(struct conn *conn, struct server_ctx *ctx);
+
+// n bytes from the front of the output queue were written to the socket:
+// count them and drop what went out
+void conn_output_sent(struct conn *conn, size_t n);
+
+// Whether the connection has output waiting for the socket to become writable
+static inline int conn_wants_write(const struct conn *conn)
+{
+    return conn->out_count > 0;
+}
+
+// Whether the connection is waiting for the offload pool to open a file, and
+// needs no socket events until then
+static inline int conn_waiting(const struct conn *conn)
+{
+    return conn->open_job != NULL;
+}
+
+// Answer the request whose file an offload job opened, from a job taken off
+// ctx->opened. Returns the connection, ready for conn_run to send the
+// response and go on with pipelined requests, or NULL if it closed meanwhile.
+struct conn *conn_complete_open(struct server_ctx *ctx, struct offload_job *job);
+
+// Count a response with status_code for the statistics and note it for the
+// access log
+void conn_count_response(struct conn *conn, int status_code);
+
+// The response queued last went out completely: record how long sending took
+// and log it
+void conn_finish_response(struct conn *conn);
+
+// Count n bytes written to the socket for the statistics, timing the first
+// ones of the connection
+void conn_count_sent(struct conn *conn, size_t n);
+
+// Arm the connection's timer for the state conn_run left it in: the idle
+// timeout between requests, the deadline for a request head that started
+// arriving, or the next check of a response's send rate. Deadlines already
+// running are not extended, so trickling bytes in does not buy time.
+void conn_schedule_timeout(struct conn *conn, struct server_ctx *ctx);
+
+// The connection's timer fired. Returns 1 if the connection timed out and
+// should be closed, 0 if its response kept up the minimum rate and the timer
+// was armed for the next window.
+int conn_timed_out(struct conn *conn, struct server_ctx *ctx);
+
+// The connection whose timer this is
+static inline struct conn *conn_of_timer(struct timer *timer)
+{
+    return (struct conn *)((char *)timer - offsetof(struct conn, timer));
+}
+
+// Advance the loop's timer wheel to now and shut down the sockets of the
+// connections that timed out. The next wait then reports them readable and
+// conn_run finds them closed, so the loop tears them down as usual.
+void conn_expire_timeouts(struct server_ctx *ctx);
+
+// Milliseconds the event loop may wait before calling conn_expire_timeouts,
+// or -1 when no connection has a timer running
+static inline int conn_wait_timeout(const struct server_ctx *ctx)
+{
+    return timer_wheel_timeout(&ctx->timers, timer_now_ms());
+}
+
+// The loop is draining, so requests are answered with Connection: close:
+// give the connection CONN_DRAIN_IDLE_MS to send its next one if it sits
+// between requests
+void conn_drain(struct conn *conn, struct server_ctx *ctx);
+
+// Release queued output and the timer before the socket is closed, and count
+// the connection as closed
+void conn_cleanup(struct conn *conn);
+
+#endif
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "conn_table.h"
+#include "conn.h"
+
+int conn_table_init(struct conn_table *table)
+{
+    struct rlimit limit;
+
+    // Serving tens of thousands of clients needs more than the usual 1024 descriptors
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        perror("getrlimit");
+        return -1;
+    }
+    if (limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) == -1)
+        {
+            getrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+
+    // Cap the table so an unlimited hard limit does not turn into a huge allocation
+    table->capacity = limit.rlim_cur < (1 << 20) ? (int)limit.rlim_cur : (1 << 20);
+    table->count = 0;
+    table->num_free = 0;
+    table->num_allocated = 0;
+    table->free_conns = NULL;
+
+    // Untouched pages of the array cost nothing, so size it for every descriptor up front
+    table->by_fd = calloc(table->capacity, sizeof(*table->by_fd));
+    if (table->by_fd == NULL)
+    {
+        perror("calloc");
+        return -1;
+    }
+    return 0;
+}
+
+// Carve a new slab of connections and put them on the free list
+static int grow_pool(struct conn_table *table)
+{
+    struct conn **free_conns = realloc(table->free_conns, (table->num_allocated + CONN_TABLE_SLAB) * sizeof(*free_conns));
+    if (free_conns == NULL)
+    {
+        return -1;
+    }
+    table->free_conns = free_conns;
+
+    struct conn *slab = mmap(NULL, CONN_TABLE_SLAB * sizeof(struct conn), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    // Push in reverse so the lowest addresses are handed out first
+    int i;
+    for (i = CONN_TABLE_SLAB - 1; i >= 0; i--)
+    {
+        table->free_conns[table->num_free++] = &slab[i];
+    }
+    table->num_allocated += CONN_TABLE_SLAB;
+    return 0;
+}
+
+struct conn *conn_table_add(struct conn_table *table, int fd)
+{
+    if (fd < 0 || fd >= table->capacity)
+    {
+        return NULL;
+    }
+    if (table->num_free == 0 && grow_pool(table) == -1)
+    {
+        perror("conn_table_add");
+        return NULL;
+    }
+
+    struct conn *conn = table->free_conns[--table->num_free];
+    conn_init(conn, fd);
+    table->by_fd[fd] = conn;
+    table->count++;
+    return conn;
+}
+
+void conn_table_remove(struct conn_table *table, struct conn *conn)
+{
+    table->by_fd[conn->fd] = NULL;
+    table->free_conns[table->num_free++] = conn;
+    table->count--;
+}
@@ -0,0 +1,45 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <stddef.h>
+
+struct conn;
+
+// Connections are carved out of slabs of this many at a time
+#define CONN_TABLE_SLAB 256
+
+// The connections of one event loop, indexed by socket descriptor. Their
+// memory comes from slabs that are never returned, and closed connections
+// are recycled from a free list, so accepting a client never calls malloc
+// once the pool has grown to the peak connection count. Each connection
+// costs sizeof(struct conn) plus two pointers.
+struct conn_table
+{
+    struct conn **by_fd;        // live connection per descriptor, NULL if none
+    int capacity;               // descriptors below this fit in by_fd
+    int count;                  // live connections
+
+    struct conn **free_conns;   // stack of recycled connections
+    int num_free;
+    int num_allocated;          // connections carved out of slabs so far
+};
+
+// Raise the descriptor limit as far as allowed and size the table for it.
+// Returns -1 on failure.
+int conn_table_init(struct conn_table *table);
+
+// Take a connection from the pool for a newly accepted socket and set it up
+// with conn_init. Returns NULL if fd does not fit or memory ran out.
+struct conn *conn_table_add(struct conn_table *table, int fd);
+
+// The connection using fd, or NULL
+static inline struct conn *conn_table_get(const struct conn_table *table, int fd)
+{
+    return fd >= 0 && fd < table->capacity ? table->by_fd[fd] : NULL;
+}
+
+// Forget a connection and return it to the pool. Call after conn_cleanup,
+// before its descriptor is closed and can be reused.
+void conn_table_remove(struct conn_table *table, struct conn *conn);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef EVENT_BACKEND_H
+#define EVENT_BACKEND_H
+
+// Readiness a descriptor is watched for and reported with. Errors and hangups
+// are reported as whatever the descriptor was watched for, so the next read
+// or write finds them.
+#define EVENT_READ 1
+#define EVENT_WRITE 2
+#define EVENT_EXCLUSIVE 4   // with EVENT_READ: wake only one of the loops sharing the descriptor, where supported
+#define EVENT_EDGE 8        // report readiness only as it changes, on backends that are edge_triggered
+
+// Watching a descriptor for no events (0) silences it, errors and hangups included
+
+// A descriptor that became ready
+struct event
+{
+    void *data;     // what the descriptor was added with
+    int events;     // EVENT_READ and/or EVENT_WRITE
+};
+
+// A level-triggered readiness API. Each event loop has its own state, made by
+// create for descriptors below max_fds. A descriptor that stays ready is
+// reported by every wait until it is drained; when more are ready than fit,
+// the next wait carries on with the rest. Backends that are edge_triggered
+// also take EVENT_EDGE, after which a descriptor is reported once per change
+// and the caller must read or write it until EAGAIN.
+struct event_backend
+{
+    const char *name;
+    void *(*create)(int max_fds);                               // NULL on failure
+    int (*add)(void *state, int fd, int events, void *data);    // -1 if fd cannot be watched
+    int (*modify)(void *state, int fd, int events, void *data);
+    void (*remove)(void *state, int fd);                        // before fd is closed
+    int (*wait)(void *state, struct event *events, int max_events, int timeout_ms);    // -1 on error
+    int edge_triggered;                                         // EVENT_EDGE is supported
+};
+
+extern const struct event_backend select_backend;
+extern const struct event_backend poll_backend;
+extern const struct event_backend epoll_backend;
+
+#endif
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "conn.h"
+#include "conn_table.h"
+#include "event_loop.h"
+#include "file_cache.h"
+#include "listener.h"
+#include "stats.h"
+
+#define MAX_EVENTS 64
+
+// Tags the listener, the cache watches, the offload completions and the requests of the
+// main thread are registered with; clients carry their struct conn
+static char listener_tag, cache_tag, opened_tag, control_tag;
+
+static const struct event_backend *const backends[] = {&epoll_backend, &poll_backend, &select_backend};
+
+const struct event_backend *event_backend_find(const char *name)
+{
+    size_t i;
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        if (strcmp(backends[i]->name, name) == 0)
+        {
+            return backends[i];
+        }
+    }
+    return NULL;
+}
+
+// Readiness a client waits for. Edge-triggered, it watches both directions
+// for good: conn_run only stops at EAGAIN or while a file is being opened for
+// it, and resumes from where it stopped, so no change is ever missed and the
+// descriptor is never modified. Otherwise it waits for room in the socket
+// until the response is out, for nothing while a file is being opened for it,
+// and for a request the rest of the time.
+static int client_events(const struct event_backend *backend, struct conn *client)
+{
+    if (backend->edge_triggered)
+    {
+        return EVENT_READ | EVENT_WRITE | EVENT_EDGE;
+    }
+    return conn_waiting(client) ? 0 : conn_wants_write(client) ? EVENT_WRITE : EVENT_READ;
+}
+
+// When running out of descriptors may be reported again, per loop
+static __thread uint64_t exhausted_report_ms;
+
+// Close a connection the client is done with
+static void close_conn(const struct event_backend *backend, void *state, struct conn_table *table,
+                       struct server_ctx *ctx, struct conn *client)
+{
+    if (!client->admitted)
+    {
+        ctx->load.unadmitted--;
+    }
+    backend->remove(state, client->fd);
+    conn_cleanup(client);
+    conn_table_remove(table, client);
+    close(client->fd);
+}
+
+// With every descriptor taken, give up the spare one to take the next client
+// off the queue and turn it away, since a level-triggered listener would
+// report it again at once. Returns -1 if no client could be taken.
+static int reject_on_spare(int listen_fd, int *spare_fd, struct server_ctx *ctx)
+{
+    struct sockaddr_in peer;
+    int client_fd = -1;
+
+    if (*spare_fd != -1)
+    {
+        close(*spare_fd);
+        client_fd = listener_accept(listen_fd, &peer);
+        if (client_fd != -1)
+        {
+            admission_reject(client_fd);
+        }
+    }
+    *spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    if (ctx->timers.now >= exhausted_report_ms)
+    {
+        fprintf(stderr, "accept: out of descriptors, turning clients away\n");
+        exhausted_report_ms = ctx->timers.now + 1000;
+    }
+    return client_fd == -1 ? -1 : 0;
+}
+
+// Accept the waiting clients, a batch at a time so a burst cannot starve the connected ones
+static void accept_clients(const struct event_backend *backend, void *state, int listen_fd, int *spare_fd,
+                           struct conn_table *table, struct server_ctx *ctx)
+{
+    struct sockaddr_in peer;
+    int accepted;
+    for (accepted = 0; accepted < ACCEPT_BATCH; accepted++)
+    {
+        int client_fd = listener_accept(listen_fd, &peer);
+        if (client_fd == -1)
+        {
+            if ((errno == EMFILE || errno == ENFILE) && reject_on_spare(listen_fd, spare_fd, ctx) == 0)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EMFILE && errno != ENFILE)
+            {
+                perror("accept");
+            }
+            break;
+        }
+
+        // A client over the caps or arriving while the loop is overloaded still gets a
+        // connection, whose request is read and answered with the 503 before it closes.
+        // Only so many are kept open; beyond that they are answered and closed at once.
+        int admitted = admission_admit(&ctx->load, peer.sin_addr.s_addr) == ADMISSION_OK;
+        if (!admitted && ctx->load.unadmitted >= ADMISSION_MAX_UNADMITTED)
+        {
+            admission_reject(client_fd);
+            continue;
+        }
+
+        // Take a connection from the pool; when memory or the backend runs out only this client is turned away
+        struct conn *client = conn_table_add(table, client_fd);
+        if (client == NULL)
+        {
+            if (admitted)
+            {
+                admission_release(peer.sin_addr.s_addr);
+                close(client_fd);
+            }
+            else
+            {
+                admission_reject(client_fd);
+            }
+            continue;
+        }
+        client->admitted = admitted;
+        if (!admitted)
+        {
+            ctx->load.unadmitted++;
+            stats_add(&stats_thread()->rejected, 1);
+        }
+        client->peer_addr = peer.sin_addr.s_addr;
+        client->peer_port = ntohs(peer.sin_port);
+        client->watching = client_events(backend, client);
+        if (backend->add(state, client_fd, client->watching, client) == -1)
+        {
+            ctx->load.unadmitted -= !admitted;
+            conn_cleanup(client);
+            conn_table_remove(table, client);
+            close(client_fd);
+            continue;
+        }
+        conn_schedule_timeout(client, ctx);
+    }
+}
+
+// Send pending output and serve the requests a client sent, then wait for
+// whatever the connection needs next
+static void run_client(const struct event_backend *backend, void *state, struct conn_table *table,
+                       struct server_ctx *ctx, struct conn *client, unsigned long *requests, int served)
+{
+    served += conn_run(client, ctx);
+    __atomic_store_n(requests, *requests + served, __ATOMIC_RELAXED);
+
+    // Close the connection once the client is done with it
+    if (client->state == CONN_CLOSED)
+    {
+        close_conn(backend, state, table, ctx, client);
+        return;
+    }
+
+    int events = client_events(backend, client);
+    if (events != client->watching)
+    {
+        client->watching = events;
+        if (backend->modify(state, client->fd, events, client) == -1)
+        {
+            perror(backend->name);
+            close_conn(backend, state, table, ctx, client);
+            return;
+        }
+    }
+    conn_schedule_timeout(client, ctx);
+}
+
+// Stop taking clients for a reload, leaving them to the successor sharing the
+// listener, and have every connection close after its next response
+static void start_draining(const struct event_backend *backend, void *state, int listen_fd,
+                           struct conn_table *table, struct server_ctx *ctx)
+{
+    if (backend->modify(state, listen_fd, 0, &listener_tag) == -1)
+    {
+        perror(backend->name);
+    }
+
+    int fd;
+    for (fd = 0; fd < table->capacity; fd++)
+    {
+        if (table->by_fd[fd] != NULL)
+        {
+            conn_drain(table->by_fd[fd], ctx);
+        }
+    }
+}
+
+int event_loop_run(const struct event_backend *backend, int listen_fd, int exclusive, struct server_ctx *ctx,
+                   unsigned long *requests)
+{
+    struct event events[MAX_EVENTS];
+    int n, i;
+
+    // Connections of this loop, indexed by descriptor
+    struct conn_table table;
+    if (conn_table_init(&table) == -1)
+    {
+        return -1;
+    }
+
+    // Set up the backend with the listener and the file cache watches
+    void *state = backend->create(table.capacity);
+    if (state == NULL)
+    {
+        return -1;
+    }
+    if (backend->add(state, listen_fd, EVENT_READ | (exclusive ? EVENT_EXCLUSIVE : 0), &listener_tag) == -1 ||
+        (ctx->cache != NULL && backend->add(state, file_cache_fd(ctx->cache), EVENT_READ, &cache_tag) == -1) ||
+        (ctx->offload != NULL && backend->add(state, ctx->opened.event_fd, EVENT_READ, &opened_tag) == -1) ||
+        backend->add(state, ctx->control_fd, EVENT_READ, &control_tag) == -1)
+    {
+        perror(backend->name);
+        return -1;
+    }
+
+    // A descriptor held back so a client can still be taken and turned away
+    // once the process has run out of them
+    int spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    // Event loop
+    while (1)
+    {
+        // Wait for events, or until the next connection times out
+        n = backend->wait(state, events, MAX_EVENTS, conn_wait_timeout(ctx));
+        if (n == -1)
+        {
+            perror(backend->name);
+            return -1;
+        }
+
+        // Shut down connections that were idle or too slow; their next event closes them
+        uint64_t batch_start = stats_now();
+        conn_expire_timeouts(ctx);
+
+        int opened = 0, drain = 0;
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data == &listener_tag)
+            {
+                accept_clients(backend, state, listen_fd, &spare_fd, &table, ctx);
+                continue;
+            }
+            if (events[i].data == &cache_tag)
+            {
+                // Drop cached files that changed on disk
+                file_cache_process_events(ctx->cache);
+                continue;
+            }
+            if (events[i].data == &opened_tag)
+            {
+                opened = 1;
+                continue;
+            }
+            if (events[i].data == &control_tag)
+            {
+                drain |= server_ctx_control(ctx);
+                continue;
+            }
+            run_client(backend, state, &table, ctx, events[i].data, requests, 0);
+        }
+
+        // Answer the requests whose files the offload pool opened. This comes after
+        // the other events, which could still name a connection closed here.
+        if (opened)
+        {
+            struct offload_job *job = offload_queue_take(&ctx->opened);
+            while (job != NULL)
+            {
+                struct offload_job *next = job->next;
+                struct conn *client = conn_complete_open(ctx, job);
+                if (client != NULL)
+                {
+                    run_client(backend, state, &table, ctx, client, requests, 1);
+                }
+                job = next;
+            }
+        }
+
+        if (drain)
+        {
+            start_draining(backend, state, listen_fd, &table, ctx);
+        }
+        if (ctx->draining && table.count == 0)
+        {
+            if (spare_fd != -1)
+            {
+                close(spare_fd);
+            }
+            return 0;
+        }
+
+        // Shed load while the batch took too long or too many files wait for the pool
+        admission_update(&ctx->load, stats_now() - batch_start, ctx->num_offloaded);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "event_backend.h"
+
+struct server_ctx;
+
+// The readiness backend called name, or NULL if there is none
+const struct event_backend *event_backend_find(const char *name);
+
+// Serve the connections arriving on listen_fd with a readiness event loop on
+// backend: accept in batches, run each ready connection through conn_run and
+// expire the ones that time out. exclusive marks a listener shared with other
+// loops. requests is advanced for every request answered.
+// Returns 0 once the loop drained for a reload, -1 if the backend cannot be
+// set up or failed.
+int event_loop_run(const struct event_backend *backend, int listen_fd, int exclusive, struct server_ctx *ctx,
+                   unsigned long *requests);
+
+#endif
@@ -0,0 +1,525 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "file_cache.h"
+
+#define INITIAL_BUCKETS 256
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                      IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct file_cache
+{
+    int inotify_fd;
+    size_t budget;
+    size_t used;
+
+    // Hash table of entries chained through hash_next
+    struct file_cache_entry **buckets;
+    size_t num_buckets;
+    size_t num_entries;
+    int num_fds;        // linked entries holding a descriptor
+
+    // Most recently used entries sit right after the sentinel
+    struct file_cache_entry lru;
+
+    // Directory path of each inotify watch descriptor
+    char **watch_dirs;
+    int num_watch_dirs;
+};
+
+// FNV-1a over the path
+static unsigned long hash_path(const char *path)
+{
+    unsigned long hash = 14695981039346656037UL;
+    while (*path != '\0')
+    {
+        hash ^= (unsigned char)*path++;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+static void lru_unlink(struct file_cache_entry *entry)
+{
+    entry->lru_prev->lru_next = entry->lru_next;
+    entry->lru_next->lru_prev = entry->lru_prev;
+}
+
+static void lru_push_front(struct file_cache *cache, struct file_cache_entry *entry)
+{
+    entry->lru_prev = &cache->lru;
+    entry->lru_next = cache->lru.lru_next;
+    cache->lru.lru_next->lru_prev = entry;
+    cache->lru.lru_next = entry;
+}
+
+static void free_entry(struct file_cache_entry *entry)
+{
+    if (entry->fd != -1)
+    {
+        close(entry->fd);
+    }
+    free(entry);
+}
+
+static void remove_entry(struct file_cache *cache, struct file_cache_entry *entry)
+{
+    struct file_cache_entry **link = &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+    while (*link != entry)
+    {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    lru_unlink(entry);
+    cache->used -= entry->cost;
+    cache->num_entries--;
+    if (entry->fd != -1)
+    {
+        cache->num_fds--;
+    }
+
+    // Responses in flight keep the memory and descriptor until they finish
+    entry->removed = 1;
+    if (entry->refs == 0)
+    {
+        free_entry(entry);
+    }
+}
+
+static void remove_all(struct file_cache *cache)
+{
+    while (cache->lru.lru_next != &cache->lru)
+    {
+        remove_entry(cache, cache->lru.lru_next);
+    }
+}
+
+static struct file_cache_entry *find_entry(struct file_cache *cache, const char *path, unsigned long hash)
+{
+    struct file_cache_entry *entry = cache->buckets[hash & (cache->num_buckets - 1)];
+    while (entry != NULL && (entry->hash != hash || strcmp(entry->path, path) != 0))
+    {
+        entry = entry->hash_next;
+    }
+    return entry;
+}
+
+// Double the bucket array once the chains get longer than one entry on average
+static void grow_buckets(struct file_cache *cache)
+{
+    size_t num_buckets = cache->num_buckets * 2;
+    struct file_cache_entry **buckets = calloc(num_buckets, sizeof(*buckets));
+    if (buckets == NULL)
+    {
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < cache->num_buckets; i++)
+    {
+        struct file_cache_entry *entry = cache->buckets[i];
+        while (entry != NULL)
+        {
+            struct file_cache_entry *next = entry->hash_next;
+            entry->hash_next = buckets[entry->hash & (num_buckets - 1)];
+            buckets[entry->hash & (num_buckets - 1)] = entry;
+            entry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->num_buckets = num_buckets;
+}
+
+// Watch dir_path and every directory below it
+static void add_watch_tree(struct file_cache *cache, const char *dir_path)
+{
+    int wd = inotify_add_watch(cache->inotify_fd, dir_path, WATCH_EVENTS | IN_ONLYDIR);
+    if (wd == -1)
+    {
+        perror("inotify_add_watch");
+        return;
+    }
+
+    // Remember which directory the watch descriptor stands for
+    if (wd >= cache->num_watch_dirs)
+    {
+        int num_watch_dirs = wd * 2 + 16;
+        char **watch_dirs = realloc(cache->watch_dirs, num_watch_dirs * sizeof(*watch_dirs));
+        if (watch_dirs == NULL)
+        {
+            return;
+        }
+        memset(watch_dirs + cache->num_watch_dirs, 0, (num_watch_dirs - cache->num_watch_dirs) * sizeof(*watch_dirs));
+        cache->watch_dirs = watch_dirs;
+        cache->num_watch_dirs = num_watch_dirs;
+    }
+    free(cache->watch_dirs[wd]);
+    cache->watch_dirs[wd] = strdup(dir_path);
+
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL)
+    {
+        return;
+    }
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL)
+    {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        char child[4096];
+        if (snprintf(child, sizeof(child), "%s/%s", dir_path, dirent->d_name) >= (int)sizeof(child))
+        {
+            continue;
+        }
+
+        struct stat child_stat;
+        if (dirent->d_type == DT_DIR ||
+            (dirent->d_type == DT_UNKNOWN && lstat(child, &child_stat) == 0 && S_ISDIR(child_stat.st_mode)))
+        {
+            add_watch_tree(cache, child);
+        }
+    }
+    closedir(dir);
+}
+
+struct file_cache *file_cache_create(const char *root, size_t budget)
+{
+    struct file_cache *cache = calloc(1, sizeof(*cache));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    cache->budget = budget;
+    cache->num_buckets = INITIAL_BUCKETS;
+    cache->buckets = calloc(cache->num_buckets, sizeof(*cache->buckets));
+    cache->lru.lru_prev = cache->lru.lru_next = &cache->lru;
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->buckets == NULL || cache->inotify_fd == -1)
+    {
+        perror("file_cache_create");
+        file_cache_destroy(cache);
+        return NULL;
+    }
+
+    add_watch_tree(cache, root);
+    return cache;
+}
+
+void file_cache_destroy(struct file_cache *cache)
+{
+    int i;
+
+    if (cache->buckets != NULL)
+    {
+        remove_all(cache);
+    }
+    for (i = 0; i < cache->num_watch_dirs; i++)
+    {
+        free(cache->watch_dirs[i]);
+    }
+    if (cache->inotify_fd != -1)
+    {
+        close(cache->inotify_fd);
+    }
+    free(cache->watch_dirs);
+    free(cache->buckets);
+    free(cache);
+}
+
+const struct file_cache_entry *file_cache_lookup(struct file_cache *cache, const char *path)
+{
+    struct file_cache_entry *entry = find_entry(cache, path, hash_path(path));
+    if (entry != NULL)
+    {
+        lru_unlink(entry);
+        lru_push_front(cache, entry);
+    }
+    return entry;
+}
+
+// Allocate an entry holding path, headers and validators with room for a
+// body_size byte body, evicting the least recently used files to make room.
+// It is not linked yet.
+static struct file_cache_entry *new_entry(struct file_cache *cache, const char *path, size_t body_size,
+                                          const char *headers, size_t headers_len,
+                                          const struct http_validators *validators)
+{
+    size_t path_len = strlen(path);
+    size_t cost = sizeof(struct file_cache_entry) + path_len + 1 + headers_len + body_size;
+    if (body_size > FILE_CACHE_MAX_ENTRY || cost > cache->budget)
+    {
+        return NULL;
+    }
+
+    // Replace an older copy of the same file
+    unsigned long hash = hash_path(path);
+    struct file_cache_entry *entry = find_entry(cache, path, hash);
+    if (entry != NULL)
+    {
+        remove_entry(cache, entry);
+    }
+
+    // Make room by evicting the least recently used files
+    while (cache->used + cost > cache->budget)
+    {
+        remove_entry(cache, cache->lru.lru_prev);
+    }
+
+    // Keep the path, headers and body in one allocation
+    entry = malloc(cost);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+    char *data = (char *)(entry + 1);
+    memcpy(data, path, path_len + 1);
+    entry->path = data;
+    data += path_len + 1;
+    memcpy(data, headers, headers_len);
+    entry->headers = data;
+    entry->headers_len = headers_len;
+    data += headers_len;
+    entry->body = data;
+    entry->body_len = body_size;
+    entry->validators = *validators;
+    entry->hash = hash;
+    entry->cost = cost;
+    entry->fd = -1;
+    entry->refs = 0;
+    entry->removed = 0;
+    return entry;
+}
+
+// Make a filled-in entry visible to lookups
+static void link_entry(struct file_cache *cache, struct file_cache_entry *entry)
+{
+    entry->hash_next = cache->buckets[entry->hash & (cache->num_buckets - 1)];
+    cache->buckets[entry->hash & (cache->num_buckets - 1)] = entry;
+    lru_push_front(cache, entry);
+    cache->used += entry->cost;
+    cache->num_entries++;
+    if (entry->fd != -1)
+    {
+        cache->num_fds++;
+    }
+
+    if (cache->num_entries > cache->num_buckets)
+    {
+        grow_buckets(cache);
+    }
+}
+
+const struct file_cache_entry *file_cache_insert(struct file_cache *cache, const char *path, int file_fd, size_t size,
+                                                 const char *headers, size_t headers_len,
+                                                 const struct http_validators *validators)
+{
+    struct file_cache_entry *entry = new_entry(cache, path, size, headers, headers_len, validators);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    // Read the whole file
+    char *body = (char *)entry->body;
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(file_fd, body + done, size - done, done);
+        if (n <= 0)
+        {
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            free(entry);
+            return NULL;
+        }
+        done += n;
+    }
+
+    link_entry(cache, entry);
+    return entry;
+}
+
+const struct file_cache_entry *file_cache_insert_data(struct file_cache *cache, const char *path, const char *body,
+                                                      size_t size, const char *headers, size_t headers_len,
+                                                      const struct http_validators *validators)
+{
+    struct file_cache_entry *entry = new_entry(cache, path, size, headers, headers_len, validators);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy((char *)entry->body, body, size);
+    link_entry(cache, entry);
+    return entry;
+}
+
+const struct file_cache_entry *file_cache_insert_meta(struct file_cache *cache, const char *path, int file_fd,
+                                                      size_t size, const char *headers, size_t headers_len,
+                                                      const struct http_validators *validators)
+{
+    struct file_cache_entry *entry = new_entry(cache, path, 0, headers, headers_len, validators);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    // Make room for the descriptor by dropping the least recently used file holding one
+    struct file_cache_entry *victim = cache->lru.lru_prev;
+    while (file_fd != -1 && cache->num_fds >= FILE_CACHE_MAX_FDS && victim != &cache->lru)
+    {
+        struct file_cache_entry *prev = victim->lru_prev;
+        if (victim->fd != -1)
+        {
+            remove_entry(cache, victim);
+        }
+        victim = prev;
+    }
+
+    entry->body = NULL;
+    entry->body_len = size;
+    entry->fd = file_fd;
+    link_entry(cache, entry);
+    return entry;
+}
+
+void file_cache_walk(const struct file_cache *cache, int (*visit)(const char *path, void *arg), void *arg)
+{
+    const struct file_cache_entry *entry;
+    for (entry = cache->lru.lru_next; entry != &cache->lru; entry = entry->lru_next)
+    {
+        if (visit(entry->path, arg))
+        {
+            break;
+        }
+    }
+}
+
+void file_cache_hold(const struct file_cache_entry *entry)
+{
+    ((struct file_cache_entry *)entry)->refs++;
+}
+
+void file_cache_release(const struct file_cache_entry *entry)
+{
+    struct file_cache_entry *held = (struct file_cache_entry *)entry;
+    if (--held->refs == 0 && held->removed)
+    {
+        free_entry(held);
+    }
+}
+
+int file_cache_fd(const struct file_cache *cache)
+{
+    return cache->inotify_fd;
+}
+
+// Drop the entry of path if there is one
+static void remove_path(struct file_cache *cache, const char *path)
+{
+    struct file_cache_entry *entry = find_entry(cache, path, hash_path(path));
+    if (entry != NULL)
+    {
+        remove_entry(cache, entry);
+    }
+}
+
+void file_cache_process_events(struct file_cache *cache)
+{
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1)
+    {
+        ssize_t len = read(cache->inotify_fd, events, sizeof(events));
+        if (len <= 0)
+        {
+            if (len == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+
+        char *p;
+        for (p = events; p < events + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        {
+            struct inotify_event *event = (struct inotify_event *)p;
+
+            // Events were lost, so nothing in the cache can be trusted
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                remove_all(cache);
+                continue;
+            }
+
+            const char *dir_path = event->wd < cache->num_watch_dirs ? cache->watch_dirs[event->wd] : NULL;
+            if (dir_path == NULL)
+            {
+                continue;
+            }
+
+            // The kernel dropped the watch
+            if (event->mask & IN_IGNORED)
+            {
+                free(cache->watch_dirs[event->wd]);
+                cache->watch_dirs[event->wd] = NULL;
+                continue;
+            }
+
+            // A directory moved or vanished: every file below it may be stale
+            if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) ||
+                ((event->mask & IN_ISDIR) && (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))))
+            {
+                remove_all(cache);
+            }
+
+            if (event->len == 0)
+            {
+                continue;
+            }
+
+            char path[4096];
+            if (snprintf(path, sizeof(path), "%s/%s", dir_path, event->name) >= (int)sizeof(path))
+            {
+                continue;
+            }
+
+            // Start watching new directories
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+            {
+                add_watch_tree(cache, path);
+                continue;
+            }
+
+            remove_path(cache, path);
+
+            // Compressed variants are cached under the names of their sidecars
+            size_t len = strlen(path);
+            if (len + 3 < sizeof(path))
+            {
+                strcpy(path + len, http_encoding_suffix(HTTP_ENCODING_GZIP));
+                remove_path(cache, path);
+                strcpy(path + len, http_encoding_suffix(HTTP_ENCODING_BR));
+                remove_path(cache, path);
+            }
+        }
+    }
+}
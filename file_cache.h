@@ -0,0 +1,88 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "http.h"
+
+// Largest file kept in the cache, bigger ones are always streamed from disk
+#define FILE_CACHE_MAX_ENTRY (1 << 20)
+
+// Most open descriptors of big files a cache keeps
+#define FILE_CACHE_MAX_FDS 256
+
+// A cached file: its pre-rendered response headers followed by its body.
+// Files too big to keep are cached without a body, with their headers,
+// validators and, while there are few enough of them, their open descriptor.
+struct file_cache_entry
+{
+    struct file_cache_entry *hash_next;
+    struct file_cache_entry *lru_prev;
+    struct file_cache_entry *lru_next;
+    unsigned long hash;
+    size_t cost;
+    int refs;       // responses still sending this entry
+    int removed;    // dropped from the cache, freed with the last reference
+    const char *path;
+    const char *headers;
+    size_t headers_len;
+    const char *body;       // NULL if only the headers are cached
+    size_t body_len;        // size of the file
+    int fd;                 // open file to send a body that is not cached, -1 if none
+    struct http_validators validators;
+};
+
+struct file_cache;
+
+// Create a cache of at most budget bytes for the files below root.
+// The directory tree is watched with inotify so changed files drop out.
+// Returns NULL on failure.
+struct file_cache *file_cache_create(const char *root, size_t budget);
+
+void file_cache_destroy(struct file_cache *cache);
+
+// Look up a file by full path and mark it recently used, or return NULL.
+// The entry stays valid until the next insert or invalidation unless it is held.
+const struct file_cache_entry *file_cache_lookup(struct file_cache *cache, const char *path);
+
+// Read size bytes of file_fd into the cache under path together with its
+// response headers and validators, evicting the least recently used entries
+// to make room. Returns the new entry, or NULL if the file is too big or
+// cannot be read.
+const struct file_cache_entry *file_cache_insert(struct file_cache *cache, const char *path, int file_fd, size_t size,
+                                                 const char *headers, size_t headers_len,
+                                                 const struct http_validators *validators);
+
+// Like file_cache_insert for a body that is already in memory
+const struct file_cache_entry *file_cache_insert_data(struct file_cache *cache, const char *path, const char *body,
+                                                      size_t size, const char *headers, size_t headers_len,
+                                                      const struct http_validators *validators);
+
+// Cache only the response headers and validators of a file of size bytes,
+// so it can be revalidated without touching the disk, and its open descriptor
+// file_fd unless that is -1, so it can be sent without opening it again.
+// Responses share the descriptor, sending with their own offsets. On success
+// the entry owns file_fd and closes it once it is freed; the least recently
+// used descriptors are dropped beyond FILE_CACHE_MAX_FDS.
+const struct file_cache_entry *file_cache_insert_meta(struct file_cache *cache, const char *path, int file_fd,
+                                                      size_t size, const char *headers, size_t headers_len,
+                                                      const struct http_validators *validators);
+
+// Call visit with the path of each cached file, most recently used first,
+// until it returns nonzero
+void file_cache_walk(const struct file_cache *cache, int (*visit)(const char *path, void *arg), void *arg);
+
+// Keep an entry's memory and descriptor alive while a response is still sending it
+void file_cache_hold(const struct file_cache_entry *entry);
+
+// Drop a reference taken with file_cache_hold
+void file_cache_release(const struct file_cache_entry *entry);
+
+// The inotify descriptor to poll for readability
+int file_cache_fd(const struct file_cache *cache);
+
+// Drop the entries of files that changed on disk; call when file_cache_fd is readable
+void file_cache_process_events(struct file_cache *cache);
+
+#endif
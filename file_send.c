@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+
+#include "file_send.h"
+
+// Largest chunk handed to a single sendfile/splice call
+#define SEND_CHUNK (1 << 20)
+
+// How long the splice fallback waits for a full socket before giving up
+#define SPLICE_DRAIN_TIMEOUT_MS 1000
+
+// Pipe used by the splice fallback, one per thread
+static __thread int splice_pipe[2] = {-1, -1};
+
+static void close_splice_pipe(void)
+{
+    close(splice_pipe[0]);
+    close(splice_pipe[1]);
+    splice_pipe[0] = splice_pipe[1] = -1;
+}
+
+// Move file data to the socket through a pipe: file -> pipe -> socket
+static ssize_t splice_chunk(int sock_fd, int file_fd, off_t *offset, size_t count)
+{
+    if (splice_pipe[0] == -1 && pipe2(splice_pipe, O_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+
+    loff_t file_offset = *offset;
+    ssize_t in_pipe = splice(file_fd, &file_offset, splice_pipe[1], NULL, count, SPLICE_F_MOVE);
+    if (in_pipe <= 0)
+    {
+        return in_pipe;
+    }
+
+    // Drain everything that went into the pipe so it is empty for the next call
+    ssize_t sent = 0;
+    while (sent < in_pipe)
+    {
+        ssize_t n = splice(splice_pipe[0], NULL, sock_fd, NULL, in_pipe - sent, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n <= 0)
+        {
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            // Data already in the pipe has to go out before we can return, so wait
+            // briefly for a non-blocking socket to drain
+            struct pollfd pfd = {.fd = sock_fd, .events = POLLOUT};
+            if (n == -1 && errno == EAGAIN && poll(&pfd, 1, SPLICE_DRAIN_TIMEOUT_MS) == 1)
+            {
+                continue;
+            }
+
+            // The pipe still holds data that was never sent, so start over with a fresh one
+            int saved_errno = errno;
+            close_splice_pipe();
+            errno = saved_errno;
+            return -1;
+        }
+        sent += n;
+    }
+
+    *offset += sent;
+    return sent;
+}
+
+ssize_t file_send_chunk(int sock_fd, int file_fd, off_t *offset, size_t count)
+{
+    if (count > SEND_CHUNK)
+    {
+        count = SEND_CHUNK;
+    }
+
+    ssize_t n = sendfile(sock_fd, file_fd, offset, count);
+    if (n == -1 && (errno == EINVAL || errno == ENOSYS))
+    {
+        // sendfile is not supported for this file, try splice instead
+        n = splice_chunk(sock_fd, file_fd, offset, count);
+    }
+    return n;
+}
+
+int file_send_all(int sock_fd, int file_fd, off_t offset, size_t count)
+{
+    while (count > 0)
+    {
+        ssize_t n = file_send_chunk(sock_fd, file_fd, &offset, count);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("sendfile");
+            return -1;
+        }
+
+        // The file shrank underneath us
+        if (n == 0)
+        {
+            fprintf(stderr, "sendfile: unexpected end of file\n");
+            return -1;
+        }
+        count -= n;
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef FILE_SEND_H
+#define FILE_SEND_H
+
+#include <sys/types.h>
+
+// Send up to count bytes of file_fd starting at *offset to sock_fd without
+// copying through user space. Uses sendfile() and falls back to splice()
+// through a pipe when sendfile is not supported for the file.
+// Advances *offset and returns the number of bytes sent, or -1 on error.
+ssize_t file_send_chunk(int sock_fd, int file_fd, off_t *offset, size_t count);
+
+// Send exactly count bytes of file_fd starting at offset to sock_fd.
+// Returns 0 on success, -1 on error.
+int file_send_all(int sock_fd, int file_fd, off_t offset, size_t count);
+
+#endif
@@ -0,0 +1,812 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "http.h"
+#include "mime_table.h"
+
+// Pre-serialized head lines
+#define HEAD_LINE(text) {text, sizeof(text) - 1}
+#define DATE_LINE_LEN (sizeof("Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n") - 1)
+
+struct head_line
+{
+    const char *data;
+    size_t len;
+};
+
+static const struct head_line default_type = HEAD_LINE("Content-Type: application/octet-stream\r\n");
+static const struct head_line keep_alive_line = HEAD_LINE("Connection: keep-alive\r\n\r\n");
+static const struct head_line close_line = HEAD_LINE("Connection: close\r\n\r\n");
+static const struct head_line accept_ranges = HEAD_LINE("Accept-Ranges: bytes\r\n");
+static const struct head_line vary_line = HEAD_LINE("Vary: Accept-Encoding\r\n");
+static const struct head_line gzip_line = HEAD_LINE("Content-Encoding: gzip\r\n");
+static const struct head_line br_line = HEAD_LINE("Content-Encoding: br\r\n");
+static const struct head_line multipart_type = HEAD_LINE("Content-Type: multipart/byteranges; boundary=" HTTP_BOUNDARY "\r\n");
+
+_Static_assert(64 + MIME_MAX_HEADER + 24 + 40 + 24 + 23 + 64 + HTTP_VALIDATORS_MAX + DATE_LINE_LEN + 26 <= HTTP_HEAD_MAX,
+               "HTTP_HEAD_MAX too small");
+_Static_assert(8 + sizeof(HTTP_BOUNDARY) + MIME_MAX_HEADER + 64 <= HTTP_PART_HEAD_MAX, "HTTP_PART_HEAD_MAX too small");
+
+// The Date line of the current second, per thread
+static __thread time_t date_second = -1;
+static __thread char date_line[DATE_LINE_LEN + 1];
+
+// Pre-serialized status line of the status codes we send
+static const struct head_line *status_line(int status_code)
+{
+    static const struct head_line lines[] = {
+        HEAD_LINE("HTTP/1.1 200 OK\r\n"),
+        HEAD_LINE("HTTP/1.1 206 Partial Content\r\n"),
+        HEAD_LINE("HTTP/1.1 304 Not Modified\r\n"),
+        HEAD_LINE("HTTP/1.1 400 Bad Request\r\n"),
+        HEAD_LINE("HTTP/1.1 404 Not Found\r\n"),
+        HEAD_LINE("HTTP/1.1 405 Method Not Allowed\r\n"),
+        HEAD_LINE("HTTP/1.1 414 URI Too Long\r\n"),
+        HEAD_LINE("HTTP/1.1 416 Range Not Satisfiable\r\n"),
+        HEAD_LINE("HTTP/1.1 431 Request Header Fields Too Large\r\n"),
+        HEAD_LINE("HTTP/1.1 505 HTTP Version Not Supported\r\n"),
+        HEAD_LINE("HTTP/1.1 500 Internal Server Error\r\n"),
+    };
+
+    switch (status_code)
+    {
+    case 200:
+        return &lines[0];
+    case 206:
+        return &lines[1];
+    case 304:
+        return &lines[2];
+    case 400:
+        return &lines[3];
+    case 404:
+        return &lines[4];
+    case 405:
+        return &lines[5];
+    case 414:
+        return &lines[6];
+    case 416:
+        return &lines[7];
+    case 431:
+        return &lines[8];
+    case 505:
+        return &lines[9];
+    default:
+        return &lines[10];
+    }
+}
+
+const struct mime_entry *http_mime_lookup(const char *file_path)
+{
+    const char *extension = strrchr(file_path, '.');
+    if (extension == NULL || strchr(extension, '/') != NULL)
+    {
+        return NULL;
+    }
+
+    // Lower-case the extension; anything longer than the longest known one cannot match
+    char key[MIME_MAX_EXTENSION + 1];
+    size_t len = 0;
+    for (extension++; *extension != '\0'; extension++)
+    {
+        if (len == MIME_MAX_EXTENSION)
+        {
+            return NULL;
+        }
+        key[len++] = tolower((unsigned char)*extension);
+    }
+    key[len] = '\0';
+
+    // One probe: the bucket's seed sends every known extension to its own slot
+    uint32_t seed = mime_seeds[mime_hash(key, 0) & (MIME_TABLE_BUCKETS - 1)];
+    const struct mime_entry *entry = &mime_entries[mime_hash(key, seed) & (MIME_TABLE_SIZE - 1)];
+    if (entry->extension == NULL || strcmp(entry->extension, key) != 0)
+    {
+        return NULL;
+    }
+    return entry;
+}
+
+int http_mime_compressible(const struct mime_entry *type)
+{
+    return type != NULL && type->compressible;
+}
+
+const char *get_content_type(const char *file_path)
+{
+    const struct mime_entry *entry = http_mime_lookup(file_path);
+    return entry != NULL ? entry->type : "application/octet-stream";
+}
+
+// Write n in decimal and return the number of digits
+static size_t format_decimal(char *buf, unsigned long long n)
+{
+    char digits[20];
+    size_t len = 0, i;
+
+    do
+    {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    for (i = 0; i < len; i++)
+    {
+        buf[i] = digits[len - 1 - i];
+    }
+    return len;
+}
+
+// Render an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT"
+static size_t format_http_date(char *buf, size_t size, time_t t)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// Parse an IMF-fixdate. Returns -1 for anything else.
+static time_t parse_http_date(const char *value, size_t len)
+{
+    char date[64];
+    struct tm tm;
+
+    if (len >= sizeof(date))
+    {
+        return -1;
+    }
+    memcpy(date, value, len);
+    date[len] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL || *end != '\0')
+    {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+void http_make_validators(struct http_validators *validators, const struct stat *st)
+{
+    char *out = validators->lines;
+
+    validators->mtime = st->st_mtim.tv_sec;
+    validators->weak = st->st_mtim.tv_sec >= time(NULL);
+    memcpy(out, "ETag: ", 6);
+    out += 6;
+    int etag_len = snprintf(out, 64, "%s\"%llx-%llx-%llx\"", validators->weak ? "W/" : "",
+                            (unsigned long long)st->st_ino, (unsigned long long)st->st_size,
+                            (unsigned long long)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec);
+    validators->etag_len = etag_len;
+    out += etag_len;
+    memcpy(out, "\r\nLast-Modified: ", 17);
+    out += 17;
+    out += format_http_date(out, 32, validators->mtime);
+    memcpy(out, "\r\n", 2);
+    out += 2;
+    validators->lines_len = out - validators->lines;
+}
+
+void http_variant_validators(struct http_validators *variant, const struct http_validators *validators,
+                             int encoding)
+{
+    // The tag ends in a quote; the suffix goes in front of it
+    const char *suffix = encoding == HTTP_ENCODING_BR ? "-br\"" : "-gz\"";
+    size_t rest = validators->lines_len - 6 - validators->etag_len;
+
+    variant->mtime = validators->mtime;
+    variant->weak = validators->weak;
+    memcpy(variant->lines, validators->lines, 6 + validators->etag_len - 1);
+    memcpy(variant->lines + 6 + validators->etag_len - 1, suffix, 4);
+    memcpy(variant->lines + 6 + validators->etag_len + 3, validators->lines + 6 + validators->etag_len, rest);
+    variant->etag_len = validators->etag_len + 3;
+    variant->lines_len = validators->lines_len + 3;
+}
+
+// Render the Content-Encoding and Vary lines of a representation
+static char *render_coding(char *out, const struct mime_entry *type, int encoding)
+{
+    if (encoding != 0)
+    {
+        const struct head_line *line = encoding == HTTP_ENCODING_BR ? &br_line : &gzip_line;
+        memcpy(out, line->data, line->len);
+        out += line->len;
+    }
+    if (http_mime_compressible(type))
+    {
+        memcpy(out, vary_line.data, vary_line.len);
+        out += vary_line.len;
+    }
+    return out;
+}
+
+size_t http_render_head(char *buf, int status_code, const struct mime_entry *type, unsigned long long content_length,
+                        int encoding, const struct http_validators *validators)
+{
+    const struct head_line *line = status_line(status_code);
+    char *out = buf;
+
+    memcpy(out, line->data, line->len);
+    out += line->len;
+    if (status_code == 200)
+    {
+        memcpy(out, accept_ranges.data, accept_ranges.len);
+        out += accept_ranges.len;
+    }
+    if (status_code < 300)
+    {
+        if (type != NULL)
+        {
+            memcpy(out, type->header, type->header_len);
+            out += type->header_len;
+        }
+        else
+        {
+            memcpy(out, default_type.data, default_type.len);
+            out += default_type.len;
+        }
+    }
+    if (status_code != 304)
+    {
+        memcpy(out, "Content-Length: ", 16);
+        out += 16;
+        out += format_decimal(out, content_length);
+        memcpy(out, "\r\n", 2);
+        out += 2;
+    }
+    if (status_code < 300 || status_code == 304)
+    {
+        out = render_coding(out, type, encoding);
+    }
+    if (validators != NULL)
+    {
+        memcpy(out, validators->lines, validators->lines_len);
+        out += validators->lines_len;
+    }
+    return out - buf;
+}
+
+// Render "bytes first-last/size" or "bytes */size"
+static size_t format_range(char *buf, const struct http_range *range, unsigned long long size)
+{
+    char *out = buf;
+
+    memcpy(out, "bytes ", 6);
+    out += 6;
+    if (range != NULL)
+    {
+        out += format_decimal(out, range->first);
+        *out++ = '-';
+        out += format_decimal(out, range->last);
+    }
+    else
+    {
+        *out++ = '*';
+    }
+    *out++ = '/';
+    out += format_decimal(out, size);
+    return out - buf;
+}
+
+size_t http_render_content_range(char *buf, const struct http_range *range, unsigned long long size)
+{
+    char *out = buf;
+
+    memcpy(out, "Content-Range: ", 15);
+    out += 15;
+    out += format_range(out, range, size);
+    memcpy(out, "\r\n", 2);
+    out += 2;
+    return out - buf;
+}
+
+size_t http_render_multipart_head(char *buf, unsigned long long content_length, const struct mime_entry *type,
+                                  int encoding, const struct http_validators *validators)
+{
+    const struct head_line *line = status_line(206);
+    char *out = buf;
+
+    memcpy(out, line->data, line->len);
+    out += line->len;
+    memcpy(out, multipart_type.data, multipart_type.len);
+    out += multipart_type.len;
+    memcpy(out, "Content-Length: ", 16);
+    out += 16;
+    out += format_decimal(out, content_length);
+    memcpy(out, "\r\n", 2);
+    out += 2;
+    out = render_coding(out, type, encoding);
+    memcpy(out, validators->lines, validators->lines_len);
+    out += validators->lines_len;
+    return out - buf;
+}
+
+size_t http_render_part_head(char *buf, const struct mime_entry *type, const struct http_range *range,
+                             unsigned long long size)
+{
+    char *out = buf;
+
+    memcpy(out, "\r\n--" HTTP_BOUNDARY "\r\n", sizeof("\r\n--" HTTP_BOUNDARY "\r\n") - 1);
+    out += sizeof("\r\n--" HTTP_BOUNDARY "\r\n") - 1;
+    if (type != NULL)
+    {
+        memcpy(out, type->header, type->header_len);
+        out += type->header_len;
+    }
+    else
+    {
+        memcpy(out, default_type.data, default_type.len);
+        out += default_type.len;
+    }
+    out += http_render_content_range(out, range, size);
+    memcpy(out, "\r\n", 2);
+    out += 2;
+    return out - buf;
+}
+
+size_t http_render_head_end(char *buf, int keep_alive)
+{
+    // Reformat the date only when the second changes
+    time_t now = time(NULL);
+    if (now != date_second)
+    {
+        memcpy(date_line, "Date: ", 6);
+        format_http_date(date_line + 6, sizeof(date_line) - 6, now);
+        memcpy(date_line + DATE_LINE_LEN - 2, "\r\n", 2);
+        date_second = now;
+    }
+
+    const struct head_line *line = keep_alive ? &keep_alive_line : &close_line;
+    memcpy(buf, date_line, DATE_LINE_LEN);
+    memcpy(buf + DATE_LINE_LEN, line->data, line->len);
+    return DATE_LINE_LEN + line->len;
+}
+
+// Check whether a comma-separated header value contains token
+static int value_has_token(const char *value, size_t value_len, const char *token)
+{
+    size_t token_len = strlen(token);
+    const char *end = value + value_len;
+
+    while (value < end)
+    {
+        // Skip separators and whitespace before the next token
+        while (value < end && (*value == ',' || *value == ' ' || *value == '\t'))
+        {
+            value++;
+        }
+        const char *start = value;
+        while (value < end && *value != ',')
+        {
+            value++;
+        }
+        const char *stop = value;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t'))
+        {
+            stop--;
+        }
+        if ((size_t)(stop - start) == token_len && strncasecmp(start, token, token_len) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Decide whether the connection stays open after this request
+int http_wants_keep_alive(const struct http_request *req, const char *buf)
+{
+    // HTTP/1.1 defaults to persistent connections, HTTP/1.0 has to ask for them
+    int keep_alive = req->minor_version >= 1;
+    int i;
+
+    for (i = 0; i < req->num_headers; i++)
+    {
+        const struct http_header *header = &req->headers[i];
+        if (http_span_equals(buf, header->name, "Connection"))
+        {
+            if (value_has_token(buf + header->value.off, header->value.len, "close"))
+            {
+                keep_alive = 0;
+            }
+            else if (value_has_token(buf + header->value.off, header->value.len, "keep-alive"))
+            {
+                keep_alive = 1;
+            }
+        }
+    }
+    return keep_alive;
+}
+
+// Whether a quality value is zero: "0" with up to three more zeros after a dot
+static int quality_is_zero(const char *value, size_t len)
+{
+    size_t i;
+
+    if (len == 0 || value[0] != '0')
+    {
+        return 0;
+    }
+    for (i = 1; i < len; i++)
+    {
+        if (value[i] != '.' && value[i] != '0')
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int http_accepted_encodings(const struct http_request *req, const char *buf)
+{
+    const struct http_header *header = http_find_header(req, buf, "Accept-Encoding");
+    int accepted = 0, listed = 0, any = 0;
+
+    if (header == NULL)
+    {
+        return 0;
+    }
+
+    const char *p = buf + header->value.off;
+    const char *end = p + header->value.len;
+    while (p < end)
+    {
+        // One coding with optional parameters, up to the next comma
+        while (p < end && (*p == ',' || *p == ' ' || *p == '\t'))
+        {
+            p++;
+        }
+        const char *start = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+        size_t len = p - start;
+
+        // Find "q=" among the parameters
+        int rejected = 0;
+        while (p < end && *p != ',')
+        {
+            while (p < end && (*p == ';' || *p == ' ' || *p == '\t'))
+            {
+                p++;
+            }
+            const char *param = p;
+            while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+            {
+                p++;
+            }
+            if (p - param >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+            {
+                rejected = quality_is_zero(param + 2, p - param - 2);
+            }
+        }
+
+        int coding = 0;
+        if (len == 2 && strncasecmp(start, "br", 2) == 0)
+        {
+            coding = HTTP_ENCODING_BR;
+        }
+        else if ((len == 4 && strncasecmp(start, "gzip", 4) == 0) || (len == 6 && strncasecmp(start, "x-gzip", 6) == 0))
+        {
+            coding = HTTP_ENCODING_GZIP;
+        }
+        else if (len == 1 && *start == '*')
+        {
+            any = !rejected;
+        }
+        listed |= coding;
+        if (!rejected)
+        {
+            accepted |= coding;
+        }
+    }
+
+    if (any)
+    {
+        accepted |= (HTTP_ENCODING_GZIP | HTTP_ENCODING_BR) & ~listed;
+    }
+    return accepted;
+}
+
+const char *http_encoding_suffix(int encoding)
+{
+    return encoding == HTTP_ENCODING_BR ? ".br" : ".gz";
+}
+
+// Parse an unsigned decimal number, advancing *p. Returns -1 if there is none or it overflows.
+static int parse_number(const char **p, const char *end, unsigned long long *value)
+{
+    const char *start = *p;
+
+    *value = 0;
+    while (*p < end && isdigit((unsigned char)**p))
+    {
+        if (*value > (~0ULL - 9) / 10)
+        {
+            return -1;
+        }
+        *value = *value * 10 + (**p - '0');
+        (*p)++;
+    }
+    return *p > start ? 0 : -1;
+}
+
+// Compare two entity tags, ignoring a W/ prefix on either
+static int etag_weak_equals(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    if (a_len >= 2 && a[0] == 'W' && a[1] == '/')
+    {
+        a += 2;
+        a_len -= 2;
+    }
+    if (b_len >= 2 && b[0] == 'W' && b[1] == '/')
+    {
+        b += 2;
+        b_len -= 2;
+    }
+    return a_len == b_len && memcmp(a, b, a_len) == 0;
+}
+
+int http_not_modified(const struct http_request *req, const char *buf, const struct http_validators *validators)
+{
+    const char *etag = validators->lines + 6;
+    const struct http_header *header = http_find_header(req, buf, "If-None-Match");
+
+    if (header != NULL)
+    {
+        // A list of entity tags, or "*" for any current version
+        const char *p = buf + header->value.off;
+        const char *end = p + header->value.len;
+        while (p < end)
+        {
+            if (*p == ',' || *p == ' ' || *p == '\t')
+            {
+                p++;
+                continue;
+            }
+            if (*p == '*')
+            {
+                return 1;
+            }
+            const char *start = p;
+            while (p < end && *p != ',' && *p != ' ' && *p != '\t')
+            {
+                p++;
+            }
+            if (etag_weak_equals(start, p - start, etag, validators->etag_len))
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    header = http_find_header(req, buf, "If-Modified-Since");
+    if (header != NULL)
+    {
+        time_t since = parse_http_date(buf + header->value.off, header->value.len);
+        return since != -1 && validators->mtime <= since;
+    }
+    return 0;
+}
+
+// Whether an If-Range validator still describes the file: a strong match of
+// the entity tag, or exactly the Last-Modified date
+static int if_range_matches(const char *value, size_t len, const struct http_validators *validators)
+{
+    if (len > 0 && (value[0] == '"' || value[0] == 'W'))
+    {
+        return !validators->weak && len == validators->etag_len && memcmp(value, validators->lines + 6, len) == 0;
+    }
+    return !validators->weak && parse_http_date(value, len) == validators->mtime;
+}
+
+int http_parse_ranges(const struct http_request *req, const char *buf, unsigned long long size,
+                      const struct http_validators *validators, struct http_range *ranges)
+{
+    const struct http_header *header = http_find_header(req, buf, "Range");
+    if (header == NULL)
+    {
+        return 0;
+    }
+
+    // Send the whole file if the client's partial copy is of another version
+    const struct http_header *if_range = http_find_header(req, buf, "If-Range");
+    if (if_range != NULL && !if_range_matches(buf + if_range->value.off, if_range->value.len, validators))
+    {
+        return 0;
+    }
+
+    const char *p = buf + header->value.off;
+    const char *end = p + header->value.len;
+    if (end - p < 6 || strncasecmp(p, "bytes=", 6) != 0)
+    {
+        return 0;
+    }
+    p += 6;
+
+    int count = 0, listed = 0;
+    while (p < end)
+    {
+        // Skip empty list elements and the whitespace around them
+        if (*p == ',' || *p == ' ' || *p == '\t')
+        {
+            p++;
+            continue;
+        }
+        if (++listed > HTTP_MAX_RANGES)
+        {
+            return 0;
+        }
+
+        unsigned long long first, last;
+        if (*p == '-')
+        {
+            // Suffix range: the last n bytes
+            p++;
+            if (parse_number(&p, end, &last) == -1)
+            {
+                return 0;
+            }
+            if (last == 0 || size == 0)
+            {
+                continue;
+            }
+            first = last >= size ? 0 : size - last;
+            last = size - 1;
+        }
+        else
+        {
+            if (parse_number(&p, end, &first) == -1 || p == end || *p++ != '-')
+            {
+                return 0;
+            }
+            last = ~0ULL;
+            if (p < end && isdigit((unsigned char)*p))
+            {
+                if (parse_number(&p, end, &last) == -1 || last < first)
+                {
+                    return 0;
+                }
+            }
+
+            // Ranges starting past the end cannot be satisfied, the rest are clipped to the file
+            if (first >= size)
+            {
+                continue;
+            }
+            if (last >= size)
+            {
+                last = size - 1;
+            }
+        }
+        while (p < end && (*p == ' ' || *p == '\t'))
+        {
+            p++;
+        }
+        if (p < end && *p != ',')
+        {
+            return 0;
+        }
+
+        ranges[count].first = first;
+        ranges[count].last = last;
+        count++;
+    }
+
+    if (listed == 0)
+    {
+        return 0;
+    }
+    return count > 0 ? count : -1;
+}
+
+// Decode %XX escapes and resolve "." and ".." segments and repeated slashes in place.
+// Returns -1 if the path is malformed or climbs above the root.
+int http_normalize_path(char *path)
+{
+    char *in = path;
+    char *out = path;
+
+    if (*in != '/')
+    {
+        return -1;
+    }
+
+    while (*in != '\0')
+    {
+        // Collapse repeated slashes
+        if (*in == '/')
+        {
+            while (*in == '/')
+            {
+                in++;
+            }
+            *out++ = '/';
+            continue;
+        }
+
+        // Copy one segment, decoding escapes
+        char *segment = out;
+        while (*in != '\0' && *in != '/')
+        {
+            if (*in == '%')
+            {
+                if (!isxdigit((unsigned char)in[1]) || !isxdigit((unsigned char)in[2]))
+                {
+                    return -1;
+                }
+                char hex[3] = {in[1], in[2], '\0'};
+                char c = (char)strtol(hex, NULL, 16);
+                if (c == '\0' || c == '/')
+                {
+                    return -1;
+                }
+                *out++ = c;
+                in += 3;
+            }
+            else
+            {
+                *out++ = *in++;
+            }
+        }
+
+        // Drop "." and step back over the previous segment for ".."
+        size_t segment_len = out - segment;
+        if (segment_len == 1 && segment[0] == '.')
+        {
+            out = segment;
+        }
+        else if (segment_len == 2 && segment[0] == '.' && segment[1] == '.')
+        {
+            if (segment - 1 == path)
+            {
+                return -1;
+            }
+            out = segment - 1;
+            while (out[-1] != '/')
+            {
+                out--;
+            }
+        }
+        // A dropped segment leaves out just past a slash already
+        if (*in == '/')
+        {
+            in++;
+            if (out[-1] != '/')
+            {
+                *out++ = '/';
+            }
+            while (*in == '/')
+            {
+                in++;
+            }
+        }
+    }
+    *out = '\0';
+    return 0;
+}
+
+int http_request_path(const struct http_request *req, const char *buf, char *path, size_t size)
+{
+    // Copy the path without the query string
+    const char *target = buf + req->target.off;
+    const char *query = memchr(target, '?', req->target.len);
+    size_t path_len = query != NULL ? (size_t)(query - target) : req->target.len;
+    if (path_len >= size)
+    {
+        return 414;
+    }
+    memcpy(path, target, path_len);
+    path[path_len] = '\0';
+
+    if (http_normalize_path(path) == -1)
+    {
+        return 400;
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "http_parser.h"
+
+struct mime_entry;
+
+// Longest response head rendered by http_render_head, http_render_content_range
+// and http_render_head_end together
+#define HTTP_HEAD_MAX 576
+
+// Room for the pre-rendered ETag and Last-Modified lines of a file
+#define HTTP_VALIDATORS_MAX 128
+
+// Most ranges served from one Range header; requests with more get the whole file
+#define HTTP_MAX_RANGES 8
+
+// Separator of the parts of a multipart/byteranges body
+#define HTTP_BOUNDARY "9f2c7e51a4d8b036_byteranges"
+
+// Longest part head rendered by http_render_part_head
+#define HTTP_PART_HEAD_MAX 256
+
+// Content codings a response can be sent with, also the bits of the set a client accepts.
+// 0 is the identity coding.
+#define HTTP_ENCODING_GZIP 1
+#define HTTP_ENCODING_BR 2
+
+// An inclusive byte range of a file
+struct http_range
+{
+    unsigned long long first;
+    unsigned long long last;
+};
+
+// Validators of a file, with their header lines rendered once
+struct http_validators
+{
+    time_t mtime;                       // Last-Modified, in whole seconds
+    int weak;                           // the file changed too recently for a strong ETag
+    size_t etag_len;                    // the quoted tag, with W/ when weak, starts the lines after "ETag: "
+    size_t lines_len;
+    char lines[HTTP_VALIDATORS_MAX];    // "ETag: ...\r\nLast-Modified: ...\r\n"
+};
+
+// Media type of a file by its extension, from the table generated out of
+// mime.types, or NULL for unknown extensions
+const struct mime_entry *http_mime_lookup(const char *file_path);
+
+// Whether responses of type, which may be NULL, are worth compressing
+int http_mime_compressible(const struct mime_entry *type);
+
+// Content type based on the file extension
+const char *get_content_type(const char *file_path);
+
+// Derive the ETag, from inode, size and modification time, and Last-Modified
+// of a file. The ETag is weak if the file changed during the current second,
+// since another change within that second would leave it the same.
+void http_make_validators(struct http_validators *validators, const struct stat *st);
+
+// Validators of a compressed variant of a file: its ETag gets a suffix naming
+// the coding, so it never matches the tag of another representation
+void http_variant_validators(struct http_validators *variant, const struct http_validators *validators,
+                             int encoding);
+
+// Render the start of a response head from pre-serialized pieces: the status
+// line, the Content-Type line of type (the default type if NULL) and
+// Content-Length unless the status is an error or 304, Content-Encoding for
+// a body sent with encoding, Vary: Accept-Encoding if type is compressible,
+// and the validator lines if validators is not NULL. Returns the length written.
+size_t http_render_head(char *buf, int status_code, const struct mime_entry *type, unsigned long long content_length,
+                        int encoding, const struct http_validators *validators);
+
+// Render "Content-Range: bytes first-last/size" for range, or "bytes */size"
+// when range is NULL. Returns the length written.
+size_t http_render_content_range(char *buf, const struct http_range *range, unsigned long long size);
+
+// Render the start of a 206 multipart/byteranges response head with the
+// given body length and validators, for parts of type sent with encoding.
+// Returns the length written.
+size_t http_render_multipart_head(char *buf, unsigned long long content_length, const struct mime_entry *type,
+                                  int encoding, const struct http_validators *validators);
+
+// Render the delimiter and headers that open one part of a multipart/byteranges
+// body. Returns the length written.
+size_t http_render_part_head(char *buf, const struct mime_entry *type, const struct http_range *range,
+                             unsigned long long size);
+
+// Render the end of every response head: the Date and Connection headers and
+// the blank line. The Date line is formatted once per second per thread.
+// Returns the length written.
+size_t http_render_head_end(char *buf, int keep_alive);
+
+// Decide whether the connection stays open after this request, from the
+// protocol version and any Connection headers
+int http_wants_keep_alive(const struct http_request *req, const char *buf);
+
+// Content codings, as HTTP_ENCODING_* bits, the Accept-Encoding header of a
+// request allows with a non-zero quality. A "*" stands for every coding not
+// listed on its own.
+int http_accepted_encodings(const struct http_request *req, const char *buf);
+
+// Suffix of the sidecar file holding a copy of a file compressed with
+// encoding, like ".gz" for gzip
+const char *http_encoding_suffix(int encoding);
+
+// Whether If-None-Match, or If-Modified-Since when there is no If-None-Match,
+// says the client's copy of a file with these validators is current
+int http_not_modified(const struct http_request *req, const char *buf, const struct http_validators *validators);
+
+// Parse the Range header of a request for a file of size bytes into at most
+// HTTP_MAX_RANGES ranges, in the order requested. Returns the number of
+// ranges, 0 if the whole file should be sent (no Range header, a unit other
+// than bytes, a malformed or an oversized list, or an If-Range validator
+// that does not match), or -1 if no range can be satisfied.
+int http_parse_ranges(const struct http_request *req, const char *buf, unsigned long long size,
+                      const struct http_validators *validators, struct http_range *ranges);
+
+// Decode %XX escapes and resolve "." and ".." segments and repeated slashes in place.
+// Returns -1 if the path is malformed or climbs above the root.
+int http_normalize_path(char *path);
+
+// Copy the normalized path of the request target, without the query string,
+// into path. Returns 0, or the status code to answer with if it is unusable.
+int http_request_path(const struct http_request *req, const char *buf, char *path, size_t size);
+
+#endif
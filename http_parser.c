@@ -0,0 +1,250 @@
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "http_parser.h"
+
+// Find the first byte equal to a or b in [p, end), or end if there is none
+typedef const char *(*scan_fn)(const char *p, const char *end, char a, char b);
+
+static const char *scan_scalar(const char *p, const char *end, char a, char b)
+{
+    while (p < end && *p != a && *p != b)
+    {
+        p++;
+    }
+    return p;
+}
+
+#ifdef HAVE_X86_SIMD
+// Compare 16 bytes at a time against the two-byte delimiter set
+__attribute__((target("sse4.2")))
+static const char *scan_sse42(const char *p, const char *end, char a, char b)
+{
+    const __m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int index = _mm_cmpestri(set, 2, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16)
+        {
+            return p + index;
+        }
+        p += 16;
+    }
+    return scan_scalar(p, end, a, b);
+}
+
+// Compare 32 bytes at a time and pick the first match from the mask
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *p, const char *end, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return scan_sse42(p, end, a, b);
+}
+#endif
+
+static const char *scan_resolve(const char *p, const char *end, char a, char b);
+
+static scan_fn scan = scan_resolve;
+static const char *scan_name = "scalar";
+
+// Pick the widest scanner the CPU supports on first use
+static const char *scan_resolve(const char *p, const char *end, char a, char b)
+{
+    scan_fn chosen = scan_scalar;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        chosen = scan_avx2;
+        scan_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse4.2"))
+    {
+        chosen = scan_sse42;
+        scan_name = "sse4.2";
+    }
+#endif
+    __atomic_store_n(&scan, chosen, __ATOMIC_RELAXED);
+    return chosen(p, end, a, b);
+}
+
+const char *http_parser_impl(void)
+{
+    char probe = '\n';
+    scan(&probe, &probe + 1, '\n', '\n');
+    return scan_name;
+}
+
+void http_parser_init(struct http_request *req)
+{
+    req->line_start = 0;
+    req->scan_pos = 0;
+    req->in_headers = 0;
+    req->num_headers = 0;
+    req->head_len = 0;
+    req->error_status = 0;
+}
+
+static enum http_parse_result parse_error(struct http_request *req, int status_code)
+{
+    req->error_status = status_code;
+    return HTTP_PARSE_ERROR;
+}
+
+// Parse "METHOD SP target SP HTTP/1.x"
+static enum http_parse_result parse_request_line(struct http_request *req, const char *buf, const char *line, const char *line_end)
+{
+    const char *sp1 = scan(line, line_end, ' ', ' ');
+    if (sp1 == line || sp1 == line_end)
+    {
+        return parse_error(req, 400);
+    }
+    const char *target = sp1 + 1;
+    const char *sp2 = scan(target, line_end, ' ', ' ');
+    if (sp2 == target || sp2 == line_end)
+    {
+        return parse_error(req, 400);
+    }
+    const char *version = sp2 + 1;
+
+    if (line_end - version != 8 || memcmp(version, "HTTP/", 5) != 0 || version[6] != '.' ||
+        version[5] < '0' || version[5] > '9' || version[7] < '0' || version[7] > '9')
+    {
+        return parse_error(req, 400);
+    }
+    if (version[5] != '1')
+    {
+        return parse_error(req, 505);
+    }
+
+    req->method.off = line - buf;
+    req->method.len = sp1 - line;
+    req->target.off = target - buf;
+    req->target.len = sp2 - target;
+    req->minor_version = version[7] - '0';
+    return HTTP_PARSE_DONE;
+}
+
+// Parse "name: value", trimming whitespace around the value
+static enum http_parse_result parse_header_line(struct http_request *req, const char *buf, const char *line, const char *line_end)
+{
+    // Folded continuation lines are obsolete and ambiguous
+    if (*line == ' ' || *line == '\t')
+    {
+        return parse_error(req, 400);
+    }
+
+    const char *colon = scan(line, line_end, ':', ':');
+    if (colon == line || colon == line_end || colon[-1] == ' ' || colon[-1] == '\t')
+    {
+        return parse_error(req, 400);
+    }
+    if (req->num_headers == HTTP_MAX_HEADERS)
+    {
+        return parse_error(req, 431);
+    }
+
+    const char *value = colon + 1;
+    const char *value_end = line_end;
+    while (value < value_end && (*value == ' ' || *value == '\t'))
+    {
+        value++;
+    }
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+    {
+        value_end--;
+    }
+
+    struct http_header *header = &req->headers[req->num_headers++];
+    header->name.off = line - buf;
+    header->name.len = colon - line;
+    header->value.off = value - buf;
+    header->value.len = value_end - value;
+    return HTTP_PARSE_DONE;
+}
+
+enum http_parse_result http_parse(struct http_request *req, const char *buf, size_t len)
+{
+    const char *end = buf + len;
+
+    while (1)
+    {
+        // Find the end of the current line, skipping bytes already known to hold none
+        const char *newline = scan(buf + req->scan_pos, end, '\n', '\n');
+        if (newline == end)
+        {
+            req->scan_pos = len;
+            return HTTP_PARSE_INCOMPLETE;
+        }
+
+        const char *line = buf + req->line_start;
+        const char *line_end = newline;
+        if (line_end > line && line_end[-1] == '\r')
+        {
+            line_end--;
+        }
+
+        if (!req->in_headers)
+        {
+            // Ignore empty lines before the request line
+            if (line_end > line)
+            {
+                if (parse_request_line(req, buf, line, line_end) == HTTP_PARSE_ERROR)
+                {
+                    return HTTP_PARSE_ERROR;
+                }
+                req->in_headers = 1;
+            }
+        }
+        else if (line_end == line)
+        {
+            // A blank line ends the request head
+            req->head_len = newline + 1 - buf;
+            return HTTP_PARSE_DONE;
+        }
+        else if (parse_header_line(req, buf, line, line_end) == HTTP_PARSE_ERROR)
+        {
+            return HTTP_PARSE_ERROR;
+        }
+
+        req->line_start = req->scan_pos = newline + 1 - buf;
+    }
+}
+
+int http_span_equals(const char *buf, struct http_span span, const char *str)
+{
+    return strlen(str) == span.len && strncasecmp(buf + span.off, str, span.len) == 0;
+}
+
+const struct http_header *http_find_header(const struct http_request *req, const char *buf, const char *name)
+{
+    int i;
+    for (i = 0; i < req->num_headers; i++)
+    {
+        if (http_span_equals(buf, req->headers[i].name, name))
+        {
+            return &req->headers[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HTTP_MAX_HEADERS 32
+
+// A piece of the receive buffer, stored as an offset so it survives the buffer moving
+struct http_span
+{
+    uint32_t off;
+    uint32_t len;
+};
+
+struct http_header
+{
+    struct http_span name;
+    struct http_span value;
+};
+
+enum http_parse_result
+{
+    HTTP_PARSE_ERROR = -1,      // malformed request, see error_status
+    HTTP_PARSE_INCOMPLETE = 0,  // need more bytes, call again once they arrive
+    HTTP_PARSE_DONE = 1         // the whole request head has been parsed
+};
+
+// Parsed request head plus the state needed to resume after a partial read.
+// Holds no pointers and allocates nothing, so it can live inside a connection.
+struct http_request
+{
+    // Resume state
+    uint32_t line_start;    // start of the line being parsed
+    uint32_t scan_pos;      // bytes before this offset hold no line end
+    int in_headers;         // the request line has been parsed
+
+    // Results
+    struct http_span method;
+    struct http_span target;
+    int minor_version;
+    int num_headers;
+    struct http_header headers[HTTP_MAX_HEADERS];
+    uint32_t head_len;      // bytes up to and including the blank line
+    int error_status;       // status code to answer with on HTTP_PARSE_ERROR
+};
+
+// Prepare a request for parsing a new message at offset 0 of the buffer
+void http_parser_init(struct http_request *req);
+
+// Parse as much of buf[0, len) as possible. buf must hold the same bytes as
+// on earlier calls for this request, with new data appended.
+enum http_parse_result http_parse(struct http_request *req, const char *buf, size_t len);
+
+// Find a header by case-insensitive name, or NULL if the request has none
+const struct http_header *http_find_header(const struct http_request *req, const char *buf, const char *name);
+
+// Compare a span with a string, ignoring case
+int http_span_equals(const char *buf, struct http_span span, const char *str);
+
+// Name of the delimiter scanner in use ("avx2", "sse4.2" or "scalar")
+const char *http_parser_impl(void);
+
+#endif
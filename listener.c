@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "listener.h"
+
+int listener_create(int port, int backlog, int reuse_port)
+{
+    int optval = 1;
+
+    // Create the server socket; it never blocks so a loop can drain it until it is empty
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_fd == -1)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // Reuse the address right after a restart, and the port across listeners if asked
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1 ||
+        (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1))
+    {
+        perror("setsockopt");
+        exit(EXIT_FAILURE);
+    }
+
+    // Bind the socket to the address and port
+    struct sockaddr_in server_address;
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_addr.s_addr = htonl(INADDR_ANY);
+    server_address.sin_port = htons(port);
+    if (bind(server_fd, (struct sockaddr *)&server_address, sizeof(server_address)) == -1)
+    {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+
+    // Listen for incoming connections
+    if (listen(server_fd, backlog) == -1)
+    {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+
+    return server_fd;
+}
+
+int listener_accept(int listen_fd, struct sockaddr_in *peer)
+{
+    while (1)
+    {
+        // Take the socket flags along instead of setting them with fcntl afterwards
+        socklen_t peer_len = sizeof(*peer);
+        int client_fd = accept4(listen_fd, (struct sockaddr *)peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd != -1)
+        {
+            return client_fd;
+        }
+
+        // The client reset the connection before we got to it, or a signal interrupted us
+        if (errno != ECONNABORTED && errno != EPROTO && errno != EINTR)
+        {
+            return -1;
+        }
+    }
+}
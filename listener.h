@@ -0,0 +1,26 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Default length of the queue of connections waiting to be accepted; the
+// kernel caps it at net.core.somaxconn
+#define LISTEN_BACKLOG SOMAXCONN
+
+// Connections an event loop accepts per wakeup before it serves its clients
+// again. Level-triggered listeners report the rest on the next wait.
+#define ACCEPT_BATCH 64
+
+// Create a non-blocking TCP listener on port with a queue of backlog pending
+// connections. With reuse_port every listener bound to the port gets its own
+// queue and the kernel spreads connections across them. Exits on failure.
+int listener_create(int port, int backlog, int reuse_port);
+
+// Accept a pending connection as a non-blocking, close-on-exec socket, skipping
+// clients that gave up while queued. Returns -1 with errno EAGAIN once the
+// queue is empty, or -1 with the error that stopped accepting. The client's
+// address is stored into peer.
+int listener_accept(int listen_fd, struct sockaddr_in *peer);
+
+#endif
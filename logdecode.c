@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "access_log.h"
+
+#define PATH_MAX_LEN 1024
+
+// A path named by its hash, from the ACCESS_LOG_PATH records seen so far
+struct path_entry
+{
+    uint64_t hash;          // 0 for an empty slot
+    char *path;
+};
+
+// Open addressing over hashes, doubled when half full
+static struct path_entry *paths;
+static size_t path_slots;
+static size_t path_count;
+
+// Path records arrive in pieces; a thread's pieces are always consecutive
+static char pending[PATH_MAX_LEN + 1];
+static size_t pending_len;
+
+static struct path_entry *find_path(uint64_t hash)
+{
+    size_t i = hash & (path_slots - 1);
+    while (paths[i].hash != 0 && paths[i].hash != hash)
+    {
+        i = (i + 1) & (path_slots - 1);
+    }
+    return &paths[i];
+}
+
+static void add_path(uint64_t hash, const char *path)
+{
+    if (2 * (path_count + 1) > path_slots)
+    {
+        struct path_entry *old = paths;
+        size_t old_slots = path_slots, i;
+        path_slots = path_slots != 0 ? 2 * path_slots : 1024;
+        paths = calloc(path_slots, sizeof(*paths));
+        if (paths == NULL)
+        {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < old_slots; i++)
+        {
+            if (old[i].hash != 0)
+            {
+                *find_path(old[i].hash) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    struct path_entry *entry = find_path(hash);
+    if (entry->hash == 0)
+    {
+        entry->hash = hash;
+        entry->path = strdup(path);
+        path_count++;
+    }
+}
+
+static void add_piece(const struct access_log_path *piece)
+{
+    size_t len = piece->len <= sizeof(piece->text) ? piece->len : sizeof(piece->text);
+    if (pending_len + len <= PATH_MAX_LEN)
+    {
+        memcpy(pending + pending_len, piece->text, len);
+        pending_len += len;
+    }
+    if (!piece->more)
+    {
+        pending[pending_len] = '\0';
+        add_path(piece->hash, pending);
+        pending_len = 0;
+    }
+}
+
+// Write a path as a CSV field, quoted when it holds a separator or a quote
+static void print_csv_path(const char *path)
+{
+    if (strpbrk(path, ",\"\r\n") == NULL)
+    {
+        fputs(path, stdout);
+        return;
+    }
+    putchar('"');
+    for (; *path != '\0'; path++)
+    {
+        if (*path == '"')
+        {
+            putchar('"');
+        }
+        putchar(*path);
+    }
+    putchar('"');
+}
+
+static void print_request(const struct access_log_record *record, int csv)
+{
+    // ISO 8601 time in UTC with microseconds
+    char when[40];
+    time_t seconds = record->time_ns / 1000000000ULL;
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    size_t len = strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(when + len, sizeof(when) - len, ".%06lluZ", (unsigned long long)(record->time_ns % 1000000000ULL / 1000));
+
+    char peer[INET_ADDRSTRLEN] = "-";
+    if (record->peer_addr != 0)
+    {
+        inet_ntop(AF_INET, &record->peer_addr, peer, sizeof(peer));
+    }
+
+    // Paths whose records were dropped or are in an older file show as their hash
+    char unknown[24];
+    const char *path = "-";
+    if (record->path_hash != 0)
+    {
+        struct path_entry *entry = path_slots != 0 ? find_path(record->path_hash) : NULL;
+        if (entry != NULL && entry->hash != 0)
+        {
+            path = entry->path;
+        }
+        else
+        {
+            snprintf(unknown, sizeof(unknown), "#%016llx", (unsigned long long)record->path_hash);
+            path = unknown;
+        }
+    }
+
+    if (csv)
+    {
+        printf("%s,%s,%u,%u,%llu,", when, peer, record->peer_port, record->status, (unsigned long long)record->bytes);
+        print_csv_path(path);
+        printf(",%.3f,%.3f,%.3f,%u,%d,%d\n", record->parse_ns / 1e3, record->open_ns / 1e3, record->send_ns / 1e3,
+               record->thread, (record->flags & ACCESS_LOG_ABORTED) != 0, (record->flags & ACCESS_LOG_CLOSE) != 0);
+        return;
+    }
+
+    printf("%s %s:%u %u %llu %s parse=%.1fus", when, peer, record->peer_port, record->status,
+           (unsigned long long)record->bytes, path, record->parse_ns / 1e3);
+    if (record->open_ns != 0)
+    {
+        printf(" open=%.1fus", record->open_ns / 1e3);
+    }
+    printf(" send=%.1fus thread=%u%s%s\n", record->send_ns / 1e3, record->thread,
+           record->flags & ACCESS_LOG_ABORTED ? " aborted" : "", record->flags & ACCESS_LOG_CLOSE ? " close" : "");
+}
+
+// Decode one log file. Returns -1 if it cannot be read or is not an access log.
+static int decode_file(const char *name, int csv)
+{
+    FILE *file = fopen(name, "rb");
+    if (file == NULL)
+    {
+        perror(name);
+        return -1;
+    }
+
+    union access_log_slot slot;
+    if (fread(&slot, sizeof(slot), 1, file) != 1 || slot.type != ACCESS_LOG_HEADER ||
+        memcmp(slot.header.magic, ACCESS_LOG_MAGIC, sizeof(ACCESS_LOG_MAGIC)) != 0 ||
+        slot.header.version != ACCESS_LOG_VERSION || slot.header.record_size != sizeof(slot))
+    {
+        fprintf(stderr, "%s: not an access log\n", name);
+        fclose(file);
+        return -1;
+    }
+
+    pending_len = 0;
+    while (fread(&slot, sizeof(slot), 1, file) == 1)
+    {
+        if (slot.type == ACCESS_LOG_PATH)
+        {
+            add_piece(&slot.path);
+        }
+        else if (slot.type == ACCESS_LOG_REQUEST)
+        {
+            print_request(&slot.request, csv);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+// Print the records of binary access logs written by the server, oldest file
+// first, as text lines or as CSV with -c
+int main(int argc, char *argv[])
+{
+    int csv = 0, bad = 0, opt, status = 0;
+
+    while ((opt = getopt(argc, argv, "c")) != -1)
+    {
+        if (opt == 'c')
+        {
+            csv = 1;
+        }
+        else
+        {
+            bad = 1;
+        }
+    }
+    if (bad || optind >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-c] <log_file>...\n", argv[0]);
+        fprintf(stderr, "  -c  print CSV instead of text lines\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (csv)
+    {
+        printf("time,peer,port,status,bytes,path,parse_us,open_us,send_us,thread,aborted,close\n");
+    }
+    for (; optind < argc; optind++)
+    {
+        if (decode_file(argv[optind], csv) == -1)
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+// Build-time generator of the extension -> media type table.
+// Reads a mime.types file and writes a C header with a perfect hash over the
+// extensions, so a lookup is one hash, one table probe and one compare.
+//
+// The hash is "hash and displace": every extension lands in a bucket by its
+// plain hash, and each bucket gets a seed that sends all of its extensions to
+// distinct free slots of the table.
+
+#define MAX_ENTRIES 4096
+#define MAX_LINE 1024
+
+struct entry
+{
+    char *ext;
+    char *type;
+};
+
+struct bucket
+{
+    int members[64];
+    int count;
+    int index;
+};
+
+static struct entry entries[MAX_ENTRIES];
+static int num_entries;
+
+// Must match the copy written into the generated header
+static uint32_t mime_hash(const char *ext, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    while (*ext != '\0')
+    {
+        hash ^= (unsigned char)*ext++;
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+// Whether responses of this type are worth compressing: text, XML and JSON
+// based formats, scripts, WebAssembly and uncompressed font formats
+static int is_compressible(const char *type)
+{
+    static const char *const types[] = {
+        "application/javascript", "application/json", "application/xml", "application/wasm",
+        "application/x-javascript", "application/vnd.ms-fontobject", "font/ttf", "font/otf",
+    };
+    size_t len = strlen(type);
+    size_t i;
+
+    if (strncmp(type, "text/", 5) == 0 || (len > 4 && strcmp(type + len - 4, "+xml") == 0) ||
+        (len > 5 && strcmp(type + len - 5, "+json") == 0))
+    {
+        return 1;
+    }
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        if (strcmp(type, types[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int find_entry(const char *ext)
+{
+    int i;
+    for (i = 0; i < num_entries; i++)
+    {
+        if (strcmp(entries[i].ext, ext) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void read_types(FILE *in)
+{
+    char line[MAX_LINE];
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        if (line[0] == '#')
+        {
+            continue;
+        }
+
+        char *saveptr;
+        char *type = strtok_r(line, " \t\r\n", &saveptr);
+        char *ext;
+        while (type != NULL && (ext = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL)
+        {
+            // Only the part after the last dot of a file name is looked up
+            if (strchr(ext, '.') != NULL)
+            {
+                continue;
+            }
+            char *p;
+            for (p = ext; *p != '\0'; p++)
+            {
+                *p = tolower((unsigned char)*p);
+            }
+            if (find_entry(ext) != -1)
+            {
+                continue;
+            }
+            if (num_entries == MAX_ENTRIES)
+            {
+                fprintf(stderr, "mime_gen: too many extensions\n");
+                exit(EXIT_FAILURE);
+            }
+            entries[num_entries].ext = strdup(ext);
+            entries[num_entries].type = strdup(type);
+            num_entries++;
+        }
+    }
+}
+
+static int compare_buckets(const void *a, const void *b)
+{
+    return ((const struct bucket *)b)->count - ((const struct bucket *)a)->count;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <mime.types>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL)
+    {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    read_types(in);
+    fclose(in);
+
+    // Size the table to a power of two with some slack, and use about four extensions per bucket
+    uint32_t table_size = 1, num_buckets = 1;
+    while (table_size < num_entries + num_entries / 8)
+    {
+        table_size <<= 1;
+    }
+    while (num_buckets * 4 < (uint32_t)num_entries)
+    {
+        num_buckets <<= 1;
+    }
+
+    struct bucket *buckets = calloc(num_buckets, sizeof(*buckets));
+    uint32_t *seeds = calloc(num_buckets, sizeof(*seeds));
+    int *slots = malloc(table_size * sizeof(*slots));
+    if (buckets == NULL || seeds == NULL || slots == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(slots, -1, table_size * sizeof(*slots));
+
+    int i, j;
+    for (i = 0; i < (int)num_buckets; i++)
+    {
+        buckets[i].index = i;
+    }
+    for (i = 0; i < num_entries; i++)
+    {
+        struct bucket *bucket = &buckets[mime_hash(entries[i].ext, 0) & (num_buckets - 1)];
+        if (bucket->count == 64)
+        {
+            fprintf(stderr, "mime_gen: bucket overflow\n");
+            exit(EXIT_FAILURE);
+        }
+        bucket->members[bucket->count++] = i;
+    }
+
+    // Place the biggest buckets first while the table is still empty
+    qsort(buckets, num_buckets, sizeof(*buckets), compare_buckets);
+    for (i = 0; i < (int)num_buckets && buckets[i].count > 0; i++)
+    {
+        struct bucket *bucket = &buckets[i];
+        uint32_t seed;
+        for (seed = 1; seed < 1000000; seed++)
+        {
+            uint32_t placed[64];
+            for (j = 0; j < bucket->count; j++)
+            {
+                placed[j] = mime_hash(entries[bucket->members[j]].ext, seed) & (table_size - 1);
+                int k;
+                for (k = 0; k < j && placed[k] != placed[j]; k++)
+                {
+                }
+                if (slots[placed[j]] != -1 || k < j)
+                {
+                    break;
+                }
+            }
+            if (j == bucket->count)
+            {
+                for (j = 0; j < bucket->count; j++)
+                {
+                    slots[placed[j]] = bucket->members[j];
+                }
+                seeds[bucket->index] = seed;
+                break;
+            }
+        }
+        if (seed == 1000000)
+        {
+            fprintf(stderr, "mime_gen: no seed found for a bucket\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t max_ext = 0, max_type = 0;
+    for (i = 0; i < num_entries; i++)
+    {
+        if (strlen(entries[i].ext) > max_ext)
+        {
+            max_ext = strlen(entries[i].ext);
+        }
+        if (strlen(entries[i].type) > max_type)
+        {
+            max_type = strlen(entries[i].type);
+        }
+    }
+
+    // Write the header
+    printf("// Generated by mime_gen from %s, do not edit\n", argv[1]);
+    printf("#ifndef MIME_TABLE_H\n#define MIME_TABLE_H\n\n#include <stdint.h>\n\n");
+    printf("#define MIME_TABLE_ENTRIES %d\n", num_entries);
+    printf("#define MIME_TABLE_SIZE %u\n", table_size);
+    printf("#define MIME_TABLE_BUCKETS %u\n", num_buckets);
+    printf("#define MIME_MAX_EXTENSION %zu\n", max_ext);
+    printf("#define MIME_MAX_HEADER %zu\n\n", strlen("Content-Type: \r\n") + max_type);
+    printf("struct mime_entry\n{\n");
+    printf("    const char *extension;      // lower case, without the dot\n");
+    printf("    const char *type;\n");
+    printf("    const char *header;         // \"Content-Type: <type>\\r\\n\"\n");
+    printf("    unsigned header_len;\n");
+    printf("    int compressible;           // worth sending with a content coding\n};\n\n");
+    printf("static inline uint32_t mime_hash(const char *ext, uint32_t seed)\n{\n");
+    printf("    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);\n");
+    printf("    while (*ext != '\\0')\n    {\n");
+    printf("        hash ^= (unsigned char)*ext++;\n        hash *= 16777619u;\n    }\n");
+    printf("    hash ^= hash >> 16;\n    hash *= 0x85ebca6bu;\n    hash ^= hash >> 13;\n");
+    printf("    return hash;\n}\n\n");
+
+    printf("static const uint32_t mime_seeds[MIME_TABLE_BUCKETS] = {");
+    for (i = 0; i < (int)num_buckets; i++)
+    {
+        printf("%s%u,", i % 12 == 0 ? "\n    " : " ", seeds[i]);
+    }
+    printf("\n};\n\n");
+
+    printf("static const struct mime_entry mime_entries[MIME_TABLE_SIZE] = {\n");
+    for (i = 0; i < (int)table_size; i++)
+    {
+        if (slots[i] == -1)
+        {
+            printf("    {0, 0, 0, 0, 0},\n");
+        }
+        else
+        {
+            const struct entry *entry = &entries[slots[i]];
+            printf("    {\"%s\", \"%s\", \"Content-Type: %s\\r\\n\", %zu, %d},\n", entry->ext, entry->type, entry->type,
+                   strlen("Content-Type: \r\n") + strlen(entry->type), is_compressible(entry->type));
+        }
+    }
+    printf("};\n\n#endif\n");
+
+    return 0;
+}
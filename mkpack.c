@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "asset_pack.h"
+
+// Build the asset pack of a serving directory ahead of deployment. The pack is
+// renamed into place, so a server can be pointed at it with -f and reloaded
+// with SIGHUP while it is replaced.
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <serving_directory> <pack_file>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct asset_image *image = asset_image_build(argv[1]);
+    if (image == NULL || asset_image_write(image, argv[2]) == -1)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    const struct asset_pack_header *header = asset_image_header(image);
+    printf("%s: %u entries, %llu bytes\n", argv[2], header->count, (unsigned long long)header->size);
+    asset_image_release(image);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "offload.h"
+
+// A pool thread and its inbox, on cache lines of their own
+struct offload_thread
+{
+    pthread_t thread;
+    struct offload_queue inbox;
+    unsigned pending;       // jobs submitted and not run yet
+} __attribute__((aligned(64)));
+
+struct offload_pool
+{
+    struct offload_thread *threads;
+    int num_threads;
+    unsigned next;      // where the search for the least busy thread starts
+};
+
+// Push a job, waking the consumer if the queue was empty: once it has taken
+// the jobs before, it reads the eventfd again before it sleeps
+static void push(struct offload_queue *queue, struct offload_job *job)
+{
+    struct offload_job *head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    do
+    {
+        job->next = head;
+    } while (!__atomic_compare_exchange_n(&queue->head, &head, job, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (head == NULL)
+    {
+        uint64_t one = 1;
+        while (write(queue->event_fd, &one, sizeof(one)) == -1 && errno == EINTR)
+        {
+        }
+    }
+}
+
+struct offload_job *offload_queue_take(struct offload_queue *queue)
+{
+    uint64_t count;
+    while (read(queue->event_fd, &count, sizeof(count)) == -1 && errno == EINTR)
+    {
+    }
+
+    // Detach the whole stack and turn it around into submission order
+    struct offload_job *job = __atomic_exchange_n(&queue->head, NULL, __ATOMIC_ACQUIRE);
+    struct offload_job *oldest = NULL;
+    while (job != NULL)
+    {
+        struct offload_job *next = job->next;
+        job->next = oldest;
+        oldest = job;
+        job = next;
+    }
+    return oldest;
+}
+
+// Run the jobs of one inbox, sleeping on its eventfd while it is empty
+static void *offload_main(void *arg)
+{
+    struct offload_thread *self = arg;
+    while (1)
+    {
+        struct offload_job *job = offload_queue_take(&self->inbox);
+        while (job != NULL)
+        {
+            struct offload_job *next = job->next;
+            job->run(job);
+            __atomic_sub_fetch(&self->pending, 1, __ATOMIC_RELAXED);
+            push(job->done, job);
+            job = next;
+        }
+    }
+    return NULL;
+}
+
+static int queue_init(struct offload_queue *queue, int flags)
+{
+    queue->head = NULL;
+    queue->event_fd = eventfd(0, EFD_CLOEXEC | flags);
+    if (queue->event_fd == -1)
+    {
+        perror("eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+int offload_queue_init(struct offload_queue *queue)
+{
+    return queue_init(queue, EFD_NONBLOCK);
+}
+
+struct offload_pool *offload_pool_create(int num_threads)
+{
+    struct offload_pool *pool = malloc(sizeof(*pool));
+    struct offload_thread *threads = aligned_alloc(64, num_threads * sizeof(*threads));
+    if (pool == NULL || threads == NULL)
+    {
+        perror("malloc");
+        free(pool);
+        free(threads);
+        return NULL;
+    }
+    pool->threads = threads;
+    pool->num_threads = num_threads;
+    pool->next = 0;
+
+    // The pool threads block on their inboxes, so their eventfds stay blocking
+    int i;
+    for (i = 0; i < num_threads; i++)
+    {
+        if (queue_init(&threads[i].inbox, 0) == -1)
+        {
+            return NULL;
+        }
+        threads[i].pending = 0;
+        int err = pthread_create(&threads[i].thread, NULL, offload_main, &threads[i]);
+        if (err != 0)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void offload_submit(struct offload_pool *pool, struct offload_job *job, struct offload_queue *done)
+{
+    // Give the job to the thread with the fewest jobs waiting, so one stuck on a
+    // slow disk stops getting any; ties go round robin
+    unsigned start = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    struct offload_thread *best = NULL;
+    unsigned best_pending = -1;
+    int i;
+    for (i = 0; i < pool->num_threads && best_pending != 0; i++)
+    {
+        struct offload_thread *thread = &pool->threads[(start + i) % pool->num_threads];
+        unsigned pending = __atomic_load_n(&thread->pending, __ATOMIC_RELAXED);
+        if (pending < best_pending)
+        {
+            best = thread;
+            best_pending = pending;
+        }
+    }
+    __atomic_add_fetch(&best->pending, 1, __ATOMIC_RELAXED);
+    job->done = done;
+    push(&best->inbox, job);
+}
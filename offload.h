@@ -0,0 +1,43 @@
+#ifndef OFFLOAD_H
+#define OFFLOAD_H
+
+// Blocking filesystem work runs on a fixed set of pool threads so that a
+// cold file cannot stall an event loop. Jobs and completions travel through
+// lock-free multi-producer, single-consumer queues: every pool thread has an
+// inbox that all loops push to, and every loop has a completion queue that
+// all pool threads push to. The consumer of a queue is woken through its
+// eventfd, written only when a push finds the queue empty.
+
+struct offload_job;
+
+// A queue of jobs with a single consumer
+struct offload_queue
+{
+    struct offload_job *head;   // most recent push first
+    int event_fd;               // readable while the queue may hold jobs
+};
+
+struct offload_job
+{
+    struct offload_job *next;
+    void (*run)(struct offload_job *job);   // called on a pool thread
+    struct offload_queue *done;             // where the job goes once it has run
+};
+
+struct offload_pool;
+
+// Start num_threads pool threads. Returns NULL on failure.
+struct offload_pool *offload_pool_create(int num_threads);
+
+// Set up the completion queue of an event loop; its eventfd is non-blocking
+// and should be polled for readability. Returns -1 on failure.
+int offload_queue_init(struct offload_queue *queue);
+
+// Hand a job to one of the pool threads; once it has run it is pushed to done
+void offload_submit(struct offload_pool *pool, struct offload_job *job, struct offload_queue *done);
+
+// Take every job pushed to a queue so far, oldest first, chained through next.
+// Call when its eventfd is readable.
+struct offload_job *offload_queue_take(struct offload_queue *queue);
+
+#endif
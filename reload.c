@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "reload.h"
+
+// Sent along with the listeners, followed by the manifest
+struct handoff_header
+{
+    uint32_t count;
+    uint32_t manifest_len;
+};
+
+// FNV-1a over a line, never 0 so that marks a free slot
+static uint64_t hash_line(const char *line, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        hash = (hash ^ (unsigned char)line[i]) * 0x100000001b3ULL;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+char *reload_merge_manifests(char *const *manifests, int count, size_t *len)
+{
+    size_t size = 1;
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        size += manifests[i] != NULL ? strlen(manifests[i]) : 0;
+    }
+
+    // Paths already taken, by hash; a collision only drops a path from the warmup
+    uint64_t *seen = calloc(2 * RELOAD_MANIFEST_PATHS, sizeof(*seen));
+    char *merged = malloc(size);
+    const char **next = calloc(count > 0 ? count : 1, sizeof(*next));
+    if (seen == NULL || merged == NULL || next == NULL)
+    {
+        perror("malloc");
+        free(seen);
+        free(merged);
+        free(next);
+        return NULL;
+    }
+    for (i = 0; i < count; i++)
+    {
+        next[i] = manifests[i] != NULL ? manifests[i] : "";
+    }
+
+    // One line of each manifest per round, until all are used up or enough are taken
+    size_t merged_len = 0;
+    int taken = 0, left = 1;
+    while (left && taken < RELOAD_MANIFEST_PATHS)
+    {
+        left = 0;
+        for (i = 0; i < count && taken < RELOAD_MANIFEST_PATHS; i++)
+        {
+            const char *line = next[i];
+            const char *newline = strchr(line, '\n');
+            size_t line_len = newline != NULL ? (size_t)(newline - line) : strlen(line);
+            if (line_len == 0)
+            {
+                continue;
+            }
+            next[i] = line + line_len + (newline != NULL);
+            left = 1;
+
+            uint64_t hash = hash_line(line, line_len);
+            size_t slot = hash & (2 * RELOAD_MANIFEST_PATHS - 1);
+            while (seen[slot] != 0 && seen[slot] != hash)
+            {
+                slot = (slot + 1) & (2 * RELOAD_MANIFEST_PATHS - 1);
+            }
+            if (seen[slot] == hash)
+            {
+                continue;
+            }
+            seen[slot] = hash;
+            memcpy(merged + merged_len, line, line_len);
+            merged_len += line_len;
+            merged[merged_len++] = '\n';
+            taken++;
+        }
+    }
+    merged[merged_len] = '\0';
+
+    free(seen);
+    free(next);
+    *len = merged_len;
+    return merged;
+}
+
+// Write all of len bytes, or fail
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read all of len bytes, or fail
+static int read_all(int fd, char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = read(fd, data, len);
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Send the listeners with the header in one message, then the manifest
+static int send_handoff(int fd, const int *listeners, int count, const char *manifest, size_t manifest_len)
+{
+    struct handoff_header header = {count, manifest_len};
+    struct iovec iov = {&header, sizeof(header)};
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int) * RELOAD_MAX_LISTENERS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = CMSG_SPACE(sizeof(int) * count)};
+
+    memset(&control, 0, sizeof(control));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), listeners, sizeof(int) * count);
+
+    ssize_t n;
+    while ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+    {
+    }
+    if (n != sizeof(header) || write_all(fd, manifest, manifest_len) == -1)
+    {
+        perror("reload: sendmsg");
+        return -1;
+    }
+    return 0;
+}
+
+// Wait up to timeout_ms for the successor's ready byte. Returns -1 if it
+// closed the socket or did not send it in time.
+static int wait_ready(int fd, int timeout_ms)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ret;
+    char ready;
+
+    while ((ret = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR)
+    {
+    }
+    if (ret != 1 || read(fd, &ready, 1) != 1)
+    {
+        fprintf(stderr, "reload: the new instance %s\n", ret == 0 ? "did not get ready in time" : "failed");
+        return -1;
+    }
+    return 0;
+}
+
+int reload_spawn(const char *exe, char *const argv[], char *handoff_arg, const int *listeners, int count,
+                 const char *manifest, size_t manifest_len, int timeout_ms)
+{
+    int fds[2];
+
+    if (count > RELOAD_MAX_LISTENERS)
+    {
+        fprintf(stderr, "reload: too many listeners\n");
+        return -1;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        perror("socketpair");
+        return -1;
+    }
+    sprintf(handoff_arg, "%d", fds[1]);
+
+    // Only async-signal-safe calls between fork and exec: the other threads are gone in the child
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        fcntl(fds[1], F_SETFD, 0);
+        execvp(exe, argv);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    if (send_handoff(fds[0], listeners, count, manifest, manifest_len) == -1 || wait_ready(fds[0], timeout_ms) == -1)
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(fds[0]);
+        return -1;
+    }
+    close(fds[0]);
+    return 0;
+}
+
+int reload_receive(int fd, int *listeners, char **manifest, size_t *manifest_len)
+{
+    struct handoff_header header;
+    struct iovec iov = {&header, sizeof(header)};
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int) * RELOAD_MAX_LISTENERS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+
+    ssize_t n;
+    while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+    {
+    }
+    struct cmsghdr *cmsg = n == sizeof(header) ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * header.count) || header.count == 0)
+    {
+        fprintf(stderr, "reload: no listeners were handed over\n");
+        return -1;
+    }
+    memcpy(listeners, CMSG_DATA(cmsg), sizeof(int) * header.count);
+
+    *manifest = malloc(header.manifest_len + 1);
+    if (*manifest == NULL || read_all(fd, *manifest, header.manifest_len) == -1)
+    {
+        fprintf(stderr, "reload: the manifest was not handed over\n");
+        free(*manifest);
+        return -1;
+    }
+    (*manifest)[header.manifest_len] = '\0';
+    *manifest_len = header.manifest_len;
+    return header.count;
+}
+
+void reload_ready(int fd)
+{
+    char ready = 1;
+    if (write_all(fd, &ready, 1) == -1)
+    {
+        perror("reload: ready");
+    }
+    close(fd);
+}
@@ -0,0 +1,42 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include <stddef.h>
+
+// A reload replaces the running server with a freshly started one without
+// dropping a connection. The old instance starts the new binary with
+// --handoff and hands it the listening sockets over a Unix socket, along
+// with a manifest of the paths hottest in its caches. The successor accepts
+// on the same sockets, so no connection is refused meanwhile; it warms its
+// caches from the manifest and reports it is ready, and only then does the
+// old instance stop accepting and drain its connections.
+#define RELOAD_MAX_LISTENERS 256
+#define RELOAD_MANIFEST_PATHS 4096      // most paths passed on, hottest first
+#define RELOAD_READY_TIMEOUT_MS 30000   // for the successor to warm up
+#define RELOAD_DEFAULT_DRAIN_S 30       // for the connections to finish
+
+// Merge the manifests of the event loops, taking their paths in turns so
+// each loop's hottest ones come first, dropping duplicates and stopping at
+// RELOAD_MANIFEST_PATHS. Returns the merged manifest, to be freed, with its
+// length stored into len, or NULL if memory ran out.
+char *reload_merge_manifests(char *const *manifests, int count, size_t *len);
+
+// Start the successor: run exe with argv, which must hold a --handoff option
+// whose value is handoff_arg, a buffer the descriptor number is written to.
+// The count listeners and the manifest are sent to it, then it is given
+// timeout_ms to report it is ready. Returns 0 once it is, -1 if it could not
+// be started or failed to get ready, in which case it is killed and this
+// instance goes on serving.
+int reload_spawn(const char *exe, char *const argv[], char *handoff_arg, const int *listeners, int count,
+                 const char *manifest, size_t manifest_len, int timeout_ms);
+
+// In the successor: receive up to RELOAD_MAX_LISTENERS listeners into
+// listeners, and the manifest, to be freed, into manifest and manifest_len,
+// from the handoff descriptor fd. Returns the number of listeners, or -1 on
+// failure.
+int reload_receive(int fd, int *listeners, char **manifest, size_t *manifest_len);
+
+// In the successor: tell the old instance it can stop accepting, and close fd
+void reload_ready(int fd);
+
+#endif
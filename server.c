@@ -1,280 +1,594 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <sys/select.h>
-#include <sys/time.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <ctype.h>
-#include <sys/stat.h>
-#include <dirent.h>
-
-#define MAX_CLIENTS 100
-#define BUFFER_SIZE 1024
-
-// Function to handle GET requests
-void handle_get_request(int client_socket, char *request_path, char *serving_directory);
-
-// Function to handle errors
-void handle_error(int client_socket, int status_code);
-
-int main(int argc, char *argv[])
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <time.h>
+
+#include "access_log.h"
+#include "admission.h"
+#include "asset_pack.h"
+#include "conn.h"
+#include "event_loop.h"
+#include "file_cache.h"
+#include "listener.h"
+#include "offload.h"
+#include "reload.h"
+#include "trace.h"
+#include "uring_loop.h"
+
+// Threads opening files that miss the caches, by default
+#define DEFAULT_OFFLOAD_THREADS 4
+
+// How long a reload waits in all for the event loops to list their hottest paths
+#define MANIFEST_WAIT_MS 1000
+
+// Per-worker state, padded so counters of different workers never share a cache line
+struct worker
 {
-    // Check if the number of arguments is correct
-    if (argc != 3)
+    pthread_t thread;
+    int id;
+    int cpu;
+    char *dir_path;
+    size_t cache_budget;
+    const struct event_backend *backend;   // NULL for the io_uring loop
+    int listen_fd;
+    int exclusive;          // the listener is shared with other workers
+    struct offload_pool *offload;   // NULL to open files on the worker itself
+    const char *manifest;   // paths to warm the cache with before serving, NULL if none
+    size_t manifest_len;
+    int warmed;             // files cached from the manifest
+    struct server_ctx ctx;
+    unsigned long requests;
+} __attribute__((aligned(64)));
+
+// Posted by each worker once its cache is warm, after a handoff
+static sem_t workers_warm;
+
+// Event loop run by each worker thread on its own listener and backend instance
+void *worker_main(void *arg)
+{
+    struct worker *worker = arg;
+
+    // Pin the worker to its CPU if requested
+    if (worker->cpu >= 0)
     {
-        printf("Usage: %s <port> <serving_directory>\n", argv[0]);
-        exit(EXIT_FAILURE);
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err != 0)
+        {
+            fprintf(stderr, "pthread_setaffinity_np: %s\n", strerror(err));
+        }
     }
 
-    // Parse the port number
-    int port = atoi(argv[1]);
-
-    // Open the serving directory
-    DIR *serving_dir = opendir(argv[2]);
-    if (serving_dir == NULL)
+    // Each worker keeps its own file cache so lookups need no locking
+    if (server_ctx_init(&worker->ctx, worker->dir_path, worker->cache_budget) < 0)
     {
-        perror("opendir");
+        fprintf(stderr, "worker %d: failed to set up the server\n", worker->id);
         exit(EXIT_FAILURE);
     }
 
-    // Create a TCP socket
-    // AF_INET: IPv4 Internet protocols
-    // SOCK_STREAM: sequenced two-way data transmisision 
-    // 0: protocol to use -> default of socket
-    int server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == -1)
+    // Take over the predecessor's hottest files before accepting on the listener it shares
+    if (worker->manifest != NULL)
     {
-        perror("socket");
-        exit(EXIT_FAILURE);
+        worker->warmed = server_ctx_warm(&worker->ctx, worker->manifest, worker->manifest_len);
+        sem_post(&workers_warm);
     }
 
-    // Set the socket options to reuse the address and port
-    int optval = 1;
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1)
+    // Files that miss the caches are opened on the pool, whichever loop serves them
+    if (worker->offload != NULL && server_ctx_offload(&worker->ctx, worker->offload) == -1)
     {
-        perror("setsockopt");
         exit(EXIT_FAILURE);
     }
 
-    // Bind the socket to the address and port
-    struct sockaddr_in server_address;
-    memset(&server_address, 0, sizeof(server_address));
-    server_address.sin_family = AF_INET;
-    server_address.sin_addr.s_addr = htonl(INADDR_ANY);
-    server_address.sin_port = htons(port);
-    if (bind(server_socket, (struct sockaddr *)&server_address, sizeof(server_address)) == -1)
+    // The io_uring loop returns early only if the kernel cannot run it
+    if (worker->backend == NULL)
     {
-        perror("bind");
-        exit(EXIT_FAILURE);
+        if (uring_loop_run(worker->listen_fd, &worker->ctx, &worker->requests) == 0)
+        {
+            return NULL;
+        }
+        fprintf(stderr, "worker %d: io_uring unavailable, falling back to epoll\n", worker->id);
+        worker->backend = &epoll_backend;
     }
 
-    // Listen for incoming connections
-    if (listen(server_socket, MAX_CLIENTS) == -1)
+    if (event_loop_run(worker->backend, worker->listen_fd, worker->exclusive, &worker->ctx, &worker->requests) == 0)
     {
-        perror("listen");
-        exit(EXIT_FAILURE);
+        return NULL;
     }
+    fprintf(stderr, "worker %d: %s event loop failed\n", worker->id, worker->backend->name);
+    exit(EXIT_FAILURE);
+}
 
-    // Initialize the set of active sockets
-    fd_set active_sockets;
-    FD_ZERO(&active_sockets);
-    FD_SET(server_socket, &active_sockets);
-
-    // Initialize the array of client sockets
-    int client_sockets[MAX_CLIENTS];
-    memset(client_sockets, 0, sizeof(client_sockets));
+// Print the requests served by each worker and the throughput per core
+void print_worker_report(struct worker *workers, int num_workers, double elapsed)
+{
+    unsigned long total = 0, min = (unsigned long)-1, max = 0;
+    int i;
 
-    // Main loop
-    while (1)
+    for (i = 0; i < num_workers; i++)
     {
-        // Wait for activity on any of the sockets
-        fd_set read_sockets = active_sockets;
-        if (select(FD_SETSIZE, &read_sockets, NULL, NULL, NULL) == -1)
+        unsigned long requests = __atomic_load_n(&workers[i].requests, __ATOMIC_RELAXED);
+        fprintf(stderr, "worker %d (cpu %d): %lu requests, %.1f req/s\n", i, workers[i].cpu, requests, requests / elapsed);
+        total += requests;
+        if (requests < min)
         {
-            perror("select");
-            exit(EXIT_FAILURE);
+            min = requests;
         }
-
-        // Check if there is activity on the server socket
-        if (FD_ISSET(server_socket, &read_sockets))
+        if (requests > max)
         {
-            // Accept the incoming connection
-            struct sockaddr_in client_address;
-            socklen_t client_address_size = sizeof(client_address);
-            int client_socket = accept(server_socket, (struct sockaddr *)&client_address, &client_address_size);
-            if (client_socket == -1)
-            {
-                perror("accept");
-                exit(EXIT_FAILURE);
-            }
+            max = requests;
+        }
+    }
 
-            // Add the client socket to the set of active sockets
-            int i;
-            for (i = 0; i < MAX_CLIENTS; i++)
-            {
-                if (client_sockets[i] == 0)
-                {
-                    client_sockets[i] = client_socket;
-                    FD_SET(client_socket, &active_sockets);
-                    break;
-                }
-            }
+    fprintf(stderr, "total: %lu requests in %.1f s, %.1f req/s, %.1f req/s per core, balance %.2f\n",
+            total, elapsed, total / elapsed, total / elapsed / num_workers, max > 0 ? (double)min / max : 1.0);
+}
 
-            // Check if the maximum number of clients is reached
-            if (i == MAX_CLIENTS)
-            {
-                fprintf(stderr, "Too many clients\n");
-                exit(EXIT_FAILURE);
-            }
+// Build the asset pack from the serving directory, or map the prebuilt one at
+// pack_path if it is not NULL
+static struct asset_image *load_pack(const char *dir_path, const char *pack_path)
+{
+    struct asset_image *image = pack_path != NULL ? asset_image_load(pack_path) : asset_image_build(dir_path);
+    if (image != NULL)
+    {
+        const struct asset_pack_header *header = asset_image_header(image);
+        fprintf(stderr, "pack: %u entries, %llu bytes from %s\n", header->count, (unsigned long long)header->size,
+                pack_path != NULL ? pack_path : dir_path);
+    }
+    return image;
+}
+
+// Ask every worker for the paths hottest in its cache and merge them. A
+// worker that does not answer in time is left out.
+static char *collect_manifest(struct worker *workers, int num_workers, size_t *len)
+{
+    char **manifests = calloc(num_workers, sizeof(*manifests));
+    if (manifests == NULL)
+    {
+        perror("calloc");
+        return NULL;
+    }
+
+    // Drop what a worker published too late for the last reload
+    int i, waited;
+    for (i = 0; i < num_workers; i++)
+    {
+        free(__atomic_exchange_n(&workers[i].ctx.manifest, NULL, __ATOMIC_ACQUIRE));
+        server_ctx_request(&workers[i].ctx, SERVER_CTX_MANIFEST);
+    }
+    for (i = 0, waited = 0; i < num_workers; i++)
+    {
+        while ((manifests[i] = __atomic_exchange_n(&workers[i].ctx.manifest, NULL, __ATOMIC_ACQUIRE)) == NULL &&
+               waited < MANIFEST_WAIT_MS)
+        {
+            usleep(1000);
+            waited++;
         }
+    }
 
-        // Check if there is activity on any of the client sockets
-        int i;
-        for (i = 0; i < MAX_CLIENTS; i++)
+    char *merged = reload_merge_manifests(manifests, num_workers, len);
+    for (i = 0; i < num_workers; i++)
+    {
+        free(manifests[i]);
+    }
+    free(manifests);
+    return merged;
+}
+
+// Hand the listeners over to a new instance started with argv, and once it
+// is warm, drain the workers for up to drain_s seconds. Returns -1 if the
+// new instance could not take over, and this one keeps serving.
+static int reload(const char *exe, char *const argv[], char *handoff_arg, struct worker *workers, int num_workers,
+                  int drain_s)
+{
+    // The listeners of the workers, each once
+    int listeners[RELOAD_MAX_LISTENERS], count = 0, i, j;
+    for (i = 0; i < num_workers && count < RELOAD_MAX_LISTENERS; i++)
+    {
+        for (j = 0; j < count && listeners[j] != workers[i].listen_fd; j++)
         {
-            int client_socket = client_sockets[i];
-            if (FD_ISSET(client_socket, &read_sockets))
-            {
-                // Receive the request from the client
-                char buffer[BUFFER_SIZE];
-                memset(buffer, 0, sizeof(buffer));
-                int bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
-                if (bytes_received == -1)
-                {
-                    perror("recv");
-                    exit(EXIT_FAILURE);
-                }
-
-                // Check if the client closed the connection
-                if (bytes_received == 0)
-                {
-                    close(client_socket);
-                    FD_CLR(client_socket, &active_sockets);
-                    client_sockets[i] = 0;
-                }
-                else
-                {
-                    // Parse the request
-                    char method[BUFFER_SIZE];
-                    char request_path[BUFFER_SIZE];
-                    char http_version[BUFFER_SIZE];
-                    sscanf(buffer, "%s %s %s", method, request_path, http_version);
-
-                    // Check if the request method is GET
-                    if (strcmp(method, "GET") == 0)
-                    {
-                        // Handle the GET request
-                        handle_get_request(client_socket, request_path, argv[2]);
-                    }
-                    else
-                    {
-                        // Handle the error
-                        handle_error(client_socket, 400);
-                    }
-                }
-            }
+        }
+        if (j == count)
+        {
+            listeners[count++] = workers[i].listen_fd;
         }
     }
 
-    // Close the server socket
-    close(server_socket);
+    size_t manifest_len = 0;
+    char *manifest = collect_manifest(workers, num_workers, &manifest_len);
+    int ret = reload_spawn(exe, argv, handoff_arg, listeners, count, manifest != NULL ? manifest : "", manifest_len,
+                           RELOAD_READY_TIMEOUT_MS);
+    free(manifest);
+    if (ret == -1)
+    {
+        return -1;
+    }
 
+    // The new instance accepts on the same listeners now; finish the connections this one has
+    fprintf(stderr, "reload: the new instance took over, draining\n");
+    for (i = 0; i < num_workers; i++)
+    {
+        server_ctx_request(&workers[i].ctx, SERVER_CTX_DRAIN);
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += drain_s;
+    int cut = 0;
+    for (i = 0; i < num_workers; i++)
+    {
+        if (pthread_timedjoin_np(workers[i].thread, NULL, &deadline) != 0)
+        {
+            cut++;
+        }
+    }
+    if (cut > 0)
+    {
+        fprintf(stderr, "reload: %d workers still had connections after %d s\n", cut, drain_s);
+    }
     return 0;
 }
 
-#include <stdbool.h>
+// Copy argv for the new instance of a reload, with a --handoff option whose
+// value handoff_arg is filled in when it starts, and without the one this
+// instance was started with
+static char **handoff_argv(int argc, char *argv[], char *handoff_arg)
+{
+    char **copy = calloc(argc + 3, sizeof(*copy));
+    if (copy == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
 
-// Function to get the content type based on file extension
-const char* get_content_type(const char* file_path);
+    int i, n = 0;
+    copy[n++] = argv[0];
+    copy[n++] = "--handoff";
+    copy[n++] = handoff_arg;
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--handoff") == 0)
+        {
+            i++;
+        }
+        else if (strncmp(argv[i], "--handoff=", 10) != 0)
+        {
+            copy[n++] = argv[i];
+        }
+    }
+    return copy;
+}
 
-void handle_get_request(int client_socket, char *request_path, char *serving_directory)
+static const struct option long_options[] = {
+    {"workers", required_argument, NULL, 'w'},
+    {"pin", no_argument, NULL, 'p'},
+    {"cache", required_argument, NULL, 'c'},
+    {"backend", required_argument, NULL, 'b'},
+    {"backlog", required_argument, NULL, 'l'},
+    {"shared", no_argument, NULL, 's'},
+    {"pack", no_argument, NULL, 'P'},
+    {"pack-file", required_argument, NULL, 'f'},
+    {"offload", required_argument, NULL, 'o'},
+    {"access-log", required_argument, NULL, 'a'},
+    {"log-rotate", required_argument, NULL, 'r'},
+    {"max-conns", required_argument, NULL, 'm'},
+    {"max-per-ip", required_argument, NULL, 'i'},
+    {"shed-queue", required_argument, NULL, 'q'},
+    {"shed-latency", required_argument, NULL, 'L'},
+    {"drain-timeout", required_argument, NULL, 'd'},
+    {"trace", required_argument, NULL, 'T'},
+    {"handoff", required_argument, NULL, 'H'},
+    {NULL, 0, NULL, 0},
+};
+
+int main(int argc, char *argv[])
 {
-    // Check if the request path is "/"
-    if (strcmp(request_path, "/") == 0)
+    int num_workers = 0, pin = 0, shared = 0, pack = 0, backlog = LISTEN_BACKLOG, opt, i;
+    int offload_threads = DEFAULT_OFFLOAD_THREADS;
+    int max_conns = 0, max_per_ip = 0, shed_queue = ADMISSION_DEFAULT_QUEUE_HIGH;
+    int shed_latency = ADMISSION_DEFAULT_LAG_HIGH_MS;
+    int drain_s = RELOAD_DEFAULT_DRAIN_S, handoff_fd = -1;
+    const char *pack_path = NULL, *log_path = NULL, *trace_path = NULL;
+    uint64_t log_rotate = ACCESS_LOG_DEFAULT_ROTATE;
+    size_t cache_budget = DEFAULT_CACHE_BUDGET;
+    const struct event_backend *backend = &epoll_backend;
+    struct timespec start, end;
+    sigset_t signals;
+    int sig;
+
+    // A reload starts the binary found where this one was, which a deployment may have replaced
+    char handoff_arg[16];
+    char **reload_argv = handoff_argv(argc, argv, handoff_arg);
+    char *exe = strchr(argv[0], '/') != NULL ? realpath(argv[0], NULL) : NULL;
+    if (exe == NULL)
+    {
+        exe = argv[0];
+    }
+
+    // Parse the command-line options
+    while ((opt = getopt_long(argc, argv, "w:pc:b:l:sPf:o:a:r:m:i:q:L:d:T:", long_options, NULL)) != -1)
     {
-        request_path = "/index.html";
+        switch (opt)
+        {
+        case 'w':
+            num_workers = atoi(optarg);
+            break;
+        case 'p':
+            pin = 1;
+            break;
+        case 'c':
+            cache_budget = strtoull(optarg, NULL, 0);
+            break;
+        case 'l':
+            backlog = atoi(optarg);
+            break;
+        case 's':
+            shared = 1;
+            break;
+        case 'P':
+            pack = 1;
+            break;
+        case 'f':
+            pack = 1;
+            pack_path = optarg;
+            break;
+        case 'o':
+            offload_threads = atoi(optarg);
+            break;
+        case 'a':
+            log_path = optarg;
+            break;
+        case 'r':
+            log_rotate = strtoull(optarg, NULL, 0);
+            break;
+        case 'm':
+            max_conns = atoi(optarg);
+            break;
+        case 'i':
+            max_per_ip = atoi(optarg);
+            break;
+        case 'q':
+            shed_queue = atoi(optarg);
+            break;
+        case 'L':
+            shed_latency = atoi(optarg);
+            break;
+        case 'd':
+            drain_s = atoi(optarg);
+            break;
+        case 'T':
+            trace_path = optarg;
+            break;
+        case 'H':
+            handoff_fd = atoi(optarg);
+            break;
+        case 'b':
+            // io_uring is completion based and runs a loop of its own
+            backend = event_backend_find(optarg);
+            if (backend == NULL && strcmp(optarg, "uring") != 0)
+            {
+                num_workers = -1;
+            }
+            break;
+        default:
+            num_workers = -1;
+            break;
+        }
     }
 
-    // Construct the full path of the requested file
-    char full_path[BUFFER_SIZE];
-    snprintf(full_path, sizeof(full_path), "%s%s", serving_directory, request_path);
+    // Check the number of command-line arguments
+    if (argc - optind != 2 || num_workers < 0 || offload_threads < 0 || max_conns < 0 || max_per_ip < 0 ||
+        shed_queue < 0 || shed_latency < 0 || drain_s < 0)
+    {
+        fprintf(stderr, "Usage: %s [options] <port> <dir_path>\n", argv[0]);
+        fprintf(stderr, "  -w, --workers N       number of event loop threads (default: number of cores)\n");
+        fprintf(stderr, "  -p, --pin             pin each worker to its own CPU\n");
+        fprintf(stderr, "  -c, --cache BYTES     file cache budget shared by the workers, 0 disables it\n");
+        fprintf(stderr, "  -b, --backend NAME    event loop: epoll (default), poll, select or uring\n");
+        fprintf(stderr, "  -l, --backlog N       length of the queue of pending connections (default: %d)\n", LISTEN_BACKLOG);
+        fprintf(stderr, "  -s, --shared          share one listener among the workers instead of one each with SO_REUSEPORT\n");
+        fprintf(stderr, "  -P, --pack            load the serving directory into one mapped pack at startup\n");
+        fprintf(stderr, "  -f, --pack-file FILE  serve from a pack built by mkpack; SIGHUP reloads the pack\n");
+        fprintf(stderr, "  -o, --offload N       threads opening files that miss the caches (default: %d), 0 opens them\n"
+                        "                        on the event loops\n", DEFAULT_OFFLOAD_THREADS);
+        fprintf(stderr, "  -a, --access-log FILE write a binary access log, read by logdecode; SIGHUP reopens it\n");
+        fprintf(stderr, "  -r, --log-rotate BYTES\n"
+                        "                        size the access log is rotated at (default: %d), 0 never rotates it\n",
+                ACCESS_LOG_DEFAULT_ROTATE);
+        fprintf(stderr, "  -m, --max-conns N     connections open at once, beyond which clients get a 503\n"
+                        "                        (default: 3/4 of the descriptor limit)\n");
+        fprintf(stderr, "  -i, --max-per-ip N    connections open at once per client address (default: no limit)\n");
+        fprintf(stderr, "  -q, --shed-queue N    files waiting for the offload pool at which a worker starts answering\n"
+                        "                        503 (default: %d), 0 ignores the queue\n", ADMISSION_DEFAULT_QUEUE_HIGH);
+        fprintf(stderr, "  -L, --shed-latency MS average time a worker takes per batch of events at which it starts\n"
+                        "                        answering 503 (default: %d), 0 ignores it; shedding stops at a quarter\n"
+                        "                        of either\n", ADMISSION_DEFAULT_LAG_HIGH_MS);
+        fprintf(stderr, "  -d, --drain-timeout S seconds the connections get to finish when SIGUSR2 hands the listeners\n"
+                        "                        over to a new instance of the binary (default: %d)\n",
+                RELOAD_DEFAULT_DRAIN_S);
+        fprintf(stderr, "  -T, --trace FILE      trace the phases of every request into FILE, read by traceanalyze;\n"
+                        "                        needs a build with make TRACE=1\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Open the requested file
-    int file_descriptor = open(full_path, O_RDONLY);
-    if (file_descriptor == -1)
+    // Default to one worker per online core
+    int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers == 0)
     {
-        // Handle the error
-        if (errno == ENOENT)
+        num_workers = num_cpus > 0 ? num_cpus : 1;
+    }
+
+    // Take over the listeners of the instance being reloaded, at least one worker on each
+    int inherited[RELOAD_MAX_LISTENERS], num_inherited = 0;
+    char *manifest = NULL;
+    size_t manifest_len = 0;
+    if (handoff_fd != -1)
+    {
+        num_inherited = reload_receive(handoff_fd, inherited, &manifest, &manifest_len);
+        if (num_inherited == -1)
         {
-            handle_error(client_socket, 404);
+            exit(EXIT_FAILURE);
         }
-        else
+        if (num_workers < num_inherited)
         {
-            handle_error(client_socket, 400);
+            num_workers = num_inherited;
         }
+        sem_init(&workers_warm, 0, 0);
     }
-    else
+
+    // Publish the pack before the workers start, so their first requests are served from it
+    if (pack)
     {
-        // Get the content type based on file extension
-        const char* content_type = get_content_type(full_path);
+        struct asset_image *image = load_pack(argv[optind + 1], pack_path);
+        if (image == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+        asset_image_publish(image);
+    }
 
-        // Read the file contents into a buffer
-        char file_buffer[BUFFER_SIZE];
-        memset(file_buffer, 0, sizeof(file_buffer));
-        int bytes_read = read(file_descriptor, file_buffer, sizeof(file_buffer)) + 2000;
-        if (bytes_read == -1)
+    // Block the shutdown and reload signals in every thread so the main thread can wait for them
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (admission_init(max_conns, max_per_ip, shed_queue, shed_latency) == -1)
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    // Trace from the first connection on, after a reload into a file of its own: the old
+    // instance still writes to its mapping of the first one
+    if (trace_path != NULL)
+    {
+#ifdef TRACE
+        char reload_trace_path[PATH_MAX];
+        if (handoff_fd != -1)
+        {
+            snprintf(reload_trace_path, sizeof(reload_trace_path), "%s.%d", trace_path, (int)getpid());
+            trace_path = reload_trace_path;
+        }
+        if (trace_open(trace_path, TRACE_DEFAULT_MAX_SIZE) == -1)
         {
-            perror("read");
             exit(EXIT_FAILURE);
         }
+#else
+        fprintf(stderr, "%s: tracing is not compiled in, build with make TRACE=1\n", argv[0]);
+        exit(EXIT_FAILURE);
+#endif
+    }
 
-        // Send the response headers
-        char response_headers[BUFFER_SIZE];
-        snprintf(response_headers, sizeof(response_headers), "HTTP/1.1 200 OK\r\nContent-Length: %d\r\nContent-Type: %s\r\n\r\n", bytes_read, content_type);
-        send(client_socket, response_headers, strlen(response_headers), 0);
+    // The flusher blocks the signals too, and is running before the first request
+    if (log_path != NULL && access_log_open(log_path, log_rotate) == -1)
+    {
+        exit(EXIT_FAILURE);
+    }
 
-        // Send the file contents
-        send(client_socket, file_buffer, bytes_read, 0);
+    // One pool for all the workers, so a worker with many cold files can use every thread
+    struct offload_pool *offload = NULL;
+    if (offload_threads > 0 && (offload = offload_pool_create(offload_threads)) == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
 
-        // Close the file descriptor
-        close(file_descriptor);
+    // Start the workers
+    struct worker *workers = aligned_alloc(64, num_workers * sizeof(struct worker));
+    if (workers == NULL)
+    {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
     }
-}
+    // One queue for everybody: a busy worker never holds up connections another could take
+    int listen_fd = shared && handoff_fd == -1 ? listener_create(atoi(argv[optind]), backlog, 0) : -1;
 
-const char* get_content_type(const char* file_path)
-{
-    const char* extension = strrchr(file_path, '.');
-    if (extension != NULL)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < num_workers; i++)
+    {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].id = i;
+        workers[i].cpu = pin ? i % num_cpus : -1;
+        workers[i].dir_path = argv[optind + 1];
+        workers[i].cache_budget = cache_budget / num_workers;
+        workers[i].backend = backend;
+        workers[i].offload = offload;
+        workers[i].manifest = manifest;
+        workers[i].manifest_len = manifest_len;
+
+        // Bind a listener of its own next to the other workers' unless they share one
+        if (num_inherited > 0)
+        {
+            workers[i].listen_fd = inherited[i % num_inherited];
+            workers[i].exclusive = num_workers > num_inherited;
+        }
+        else
+        {
+            workers[i].listen_fd = shared ? listen_fd : listener_create(atoi(argv[optind]), backlog, 1);
+            workers[i].exclusive = shared;
+        }
+        int err = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+        if (err != 0)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The old instance stops accepting once every cache is warm
+    if (handoff_fd != -1)
     {
-        if (strcasecmp(extension, ".html") == 0 || strcasecmp(extension, ".htm") == 0)
+        int warmed = 0;
+        for (i = 0; i < num_workers; i++)
         {
-            return "text/html";
+            while (sem_wait(&workers_warm) == -1)
+            {
+            }
         }
-        else if (strcasecmp(extension, ".jpeg") == 0 || strcasecmp(extension, ".jpg") == 0)
+        for (i = 0; i < num_workers; i++)
         {
-            return "image/jpeg";
+            warmed += workers[i].warmed;
         }
-        else if (strcasecmp(extension, ".png") == 0)
+        free(manifest);
+        fprintf(stderr, "reload: took over %d listeners, %d files warm\n", num_inherited, warmed);
+        reload_ready(handoff_fd);
+    }
+
+    // Reload the pack and reopen the access log on SIGHUP, keeping the old pack if the new one cannot be
+    // loaded, and hand over to a new instance on SIGUSR2, going on serving if it cannot take over
+    while (sigwait(&signals, &sig) == 0 && (sig == SIGHUP || sig == SIGUSR2))
+    {
+        if (sig == SIGUSR2)
         {
-            return "image/png";
+            if (reload(exe, reload_argv, handoff_arg, workers, num_workers, drain_s) == 0)
+            {
+                break;
+            }
+            continue;
         }
-        else if (strcasecmp(extension, ".gif") == 0)
+        access_log_reopen();
+        struct asset_image *image = pack ? load_pack(argv[optind + 1], pack_path) : NULL;
+        if (image != NULL)
         {
-            return "image/gif";
+            asset_image_publish(image);
         }
-        // Add more supported file types as needed
     }
-    return "application/octet-stream";
-}
 
-void handle_error(int client_socket, int status_code)
-{
-    // Send the response headers
-    char response_headers[BUFFER_SIZE];
-    snprintf(response_headers, sizeof(response_headers), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n\r\n", status_code, strerror(status_code));
-    send(client_socket, response_headers, strlen(response_headers), 0);
+    // Report how the load was spread
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    print_worker_report(workers, num_workers, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    access_log_close();
+    trace_close();
+
+    return 0;
 }
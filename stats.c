@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "stats.h"
+
+// Room for the rendered statistics
+#define RENDER_SIZE 32768
+
+__thread struct stats *stats_local;
+
+// Every thread's block, for the readers
+static struct stats *all_stats;
+static pthread_mutex_t all_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const int status_codes[STATS_NUM_STATUS] = {200, 206, 304, 400, 404, 405, 414, 416, 431, 500, 503, 505, 0};
+static const char *const phase_names[STATS_NUM_PHASES] = {"first_byte", "parse", "open", "send"};
+
+// Rendered output, appended to until it is full
+struct render
+{
+    char *buf;
+    size_t len;
+};
+
+struct stats *stats_register(void)
+{
+    struct stats *stats = aligned_alloc(64, sizeof(*stats));
+    if (stats == NULL)
+    {
+        perror("stats_register");
+        exit(EXIT_FAILURE);
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&all_stats_lock);
+    stats->next = all_stats;
+    all_stats = stats;
+    pthread_mutex_unlock(&all_stats_lock);
+    stats_local = stats;
+    return stats;
+}
+
+void stats_response(int status_code)
+{
+    int i;
+    for (i = 0; i < STATS_OTHER && status_codes[i] != status_code; i++)
+    {
+    }
+    stats_add(&stats_thread()->responses[i], 1);
+}
+
+int stats_request_format(const char *request_path)
+{
+    if (strcmp(request_path, STATS_PATH) == 0)
+    {
+        return STATS_JSON;
+    }
+    if (strcmp(request_path, STATS_PROMETHEUS_PATH) == 0)
+    {
+        return STATS_PROMETHEUS;
+    }
+    return -1;
+}
+
+// Add up the counters of every thread
+static void sum_stats(struct stats *total)
+{
+    uint64_t *out = (uint64_t *)total;
+    size_t count = offsetof(struct stats, next) / sizeof(uint64_t);
+    size_t i;
+
+    memset(total, 0, sizeof(*total));
+    pthread_mutex_lock(&all_stats_lock);
+    struct stats *stats;
+    for (stats = all_stats; stats != NULL; stats = stats->next)
+    {
+        const uint64_t *in = (const uint64_t *)stats;
+        for (i = 0; i < count; i++)
+        {
+            out[i] += __atomic_load_n(&in[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&all_stats_lock);
+}
+
+static void append(struct render *out, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out->buf + out->len, RENDER_SIZE - out->len, format, args);
+    va_end(args);
+    if (n > 0)
+    {
+        out->len += (size_t)n < RENDER_SIZE - out->len ? (size_t)n : RENDER_SIZE - 1 - out->len;
+    }
+}
+
+// Upper bound of latency bucket i in nanoseconds
+static uint64_t bucket_limit(int i)
+{
+    return 1ULL << (i + 8);
+}
+
+static uint64_t histogram_count(const struct stats_histogram *hist)
+{
+    uint64_t count = 0;
+    int i;
+    for (i = 0; i < STATS_BUCKETS; i++)
+    {
+        count += hist->counts[i];
+    }
+    return count;
+}
+
+// Upper bound of the bucket holding the given percentile, in microseconds
+static double histogram_percentile(const struct stats_histogram *hist, uint64_t count, double percentile)
+{
+    uint64_t rank = (uint64_t)(percentile / 100.0 * count + 0.5);
+    uint64_t seen = 0;
+    int i;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+    for (i = 0; i < STATS_BUCKETS - 1; i++)
+    {
+        seen += hist->counts[i];
+        if (seen >= rank)
+        {
+            break;
+        }
+    }
+    return bucket_limit(i) / 1e3;
+}
+
+static void render_json(struct render *out, const struct stats *total)
+{
+    int i;
+
+    append(out, "{\n  \"responses\": {");
+    for (i = 0; i < STATS_NUM_STATUS; i++)
+    {
+        if (i < STATS_OTHER)
+        {
+            append(out, "\"%d\": %llu, ", status_codes[i], (unsigned long long)total->responses[i]);
+        }
+        else
+        {
+            append(out, "\"other\": %llu},\n", (unsigned long long)total->responses[i]);
+        }
+    }
+    append(out, "  \"bytes_sent\": %llu,\n", (unsigned long long)total->bytes_sent);
+    append(out,
+           "  \"connections\": {\"accepted\": %llu, \"active\": %llu, \"timed_out\": %llu, \"rejected\": %llu, "
+           "\"dropped\": %llu},\n",
+           (unsigned long long)total->accepted, (unsigned long long)(total->accepted - total->closed),
+           (unsigned long long)total->timeouts, (unsigned long long)total->rejected, (unsigned long long)total->dropped);
+    append(out, "  \"shed_requests\": %llu,\n", (unsigned long long)total->shed);
+    uint64_t lookups = total->cache_hits + total->cache_misses;
+    append(out, "  \"cache\": {\"hits\": %llu, \"misses\": %llu, \"hit_rate\": %.4f},\n",
+           (unsigned long long)total->cache_hits, (unsigned long long)total->cache_misses,
+           lookups > 0 ? (double)total->cache_hits / lookups : 0.0);
+    append(out, "  \"access_log\": {\"dropped\": %llu},\n", (unsigned long long)total->log_dropped);
+
+    // Percentiles are the upper bounds of power-of-two buckets
+    append(out, "  \"latency_us\": {\n");
+    for (i = 0; i < STATS_NUM_PHASES; i++)
+    {
+        const struct stats_histogram *hist = &total->phases[i];
+        uint64_t count = histogram_count(hist);
+        append(out, "    \"%s\": {\"count\": %llu, \"mean\": %.2f, \"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f}%s\n",
+               phase_names[i], (unsigned long long)count, count > 0 ? hist->sum_ns / 1e3 / count : 0.0,
+               histogram_percentile(hist, count, 50), histogram_percentile(hist, count, 99),
+               histogram_percentile(hist, count, 99.9), i < STATS_NUM_PHASES - 1 ? "," : "");
+    }
+    append(out, "  }\n}\n");
+}
+
+static void render_prometheus(struct render *out, const struct stats *total)
+{
+    int i, j;
+
+    append(out, "# HELP http_responses_total Responses sent, by status code.\n"
+                "# TYPE http_responses_total counter\n");
+    for (i = 0; i < STATS_OTHER; i++)
+    {
+        append(out, "http_responses_total{code=\"%d\"} %llu\n", status_codes[i],
+               (unsigned long long)total->responses[i]);
+    }
+    append(out, "http_responses_total{code=\"other\"} %llu\n", (unsigned long long)total->responses[STATS_OTHER]);
+    append(out, "# HELP http_sent_bytes_total Bytes written to client sockets.\n"
+                "# TYPE http_sent_bytes_total counter\n"
+                "http_sent_bytes_total %llu\n",
+           (unsigned long long)total->bytes_sent);
+    append(out, "# HELP http_connections_accepted_total Connections accepted.\n"
+                "# TYPE http_connections_accepted_total counter\n"
+                "http_connections_accepted_total %llu\n"
+                "# HELP http_connections_active Connections currently open.\n"
+                "# TYPE http_connections_active gauge\n"
+                "http_connections_active %llu\n"
+                "# HELP http_connections_timed_out_total Connections closed for being idle or too slow.\n"
+                "# TYPE http_connections_timed_out_total counter\n"
+                "http_connections_timed_out_total %llu\n"
+                "# HELP http_connections_rejected_total Connections turned away by admission control.\n"
+                "# TYPE http_connections_rejected_total counter\n"
+                "http_connections_rejected_total %llu\n"
+                "# HELP http_connections_dropped_total Connections reset for lack of a free connection slot.\n"
+                "# TYPE http_connections_dropped_total counter\n"
+                "http_connections_dropped_total %llu\n"
+                "# HELP http_shed_requests_total Requests answered with 503 while the server was overloaded.\n"
+                "# TYPE http_shed_requests_total counter\n"
+                "http_shed_requests_total %llu\n",
+           (unsigned long long)total->accepted, (unsigned long long)(total->accepted - total->closed),
+           (unsigned long long)total->timeouts, (unsigned long long)total->rejected, (unsigned long long)total->dropped,
+           (unsigned long long)total->shed);
+    append(out, "# HELP http_cache_hits_total Requests answered from the file cache.\n"
+                "# TYPE http_cache_hits_total counter\n"
+                "http_cache_hits_total %llu\n"
+                "# HELP http_cache_misses_total Requests that had to open the file.\n"
+                "# TYPE http_cache_misses_total counter\n"
+                "http_cache_misses_total %llu\n",
+           (unsigned long long)total->cache_hits, (unsigned long long)total->cache_misses);
+    append(out, "# HELP http_access_log_dropped_total Access log records lost to a full ring or a failed write.\n"
+                "# TYPE http_access_log_dropped_total counter\n"
+                "http_access_log_dropped_total %llu\n",
+           (unsigned long long)total->log_dropped);
+
+    append(out, "# HELP http_phase_duration_seconds Time spent in each phase of serving requests.\n"
+                "# TYPE http_phase_duration_seconds histogram\n");
+    for (i = 0; i < STATS_NUM_PHASES; i++)
+    {
+        const struct stats_histogram *hist = &total->phases[i];
+        uint64_t cumulative = 0;
+        for (j = 0; j < STATS_BUCKETS - 1; j++)
+        {
+            cumulative += hist->counts[j];
+            append(out, "http_phase_duration_seconds_bucket{phase=\"%s\",le=\"%g\"} %llu\n", phase_names[i],
+                   bucket_limit(j) / 1e9, (unsigned long long)cumulative);
+        }
+        cumulative += hist->counts[j];
+        append(out, "http_phase_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n", phase_names[i],
+               (unsigned long long)cumulative);
+        append(out, "http_phase_duration_seconds_sum{phase=\"%s\"} %.9f\n", phase_names[i], hist->sum_ns / 1e9);
+        append(out, "http_phase_duration_seconds_count{phase=\"%s\"} %llu\n", phase_names[i],
+               (unsigned long long)cumulative);
+    }
+}
+
+char *stats_render(int format, size_t *len)
+{
+    struct stats *total = aligned_alloc(64, sizeof(*total));
+    struct render out = {malloc(RENDER_SIZE), 0};
+    if (total == NULL || out.buf == NULL)
+    {
+        free(total);
+        free(out.buf);
+        return NULL;
+    }
+
+    sum_stats(total);
+    if (format == STATS_PROMETHEUS)
+    {
+        render_prometheus(&out, total);
+    }
+    else
+    {
+        render_json(&out, total);
+    }
+    free(total);
+    *len = out.len;
+    return out.buf;
+}
@@ -0,0 +1,120 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Reserved request paths of the statistics endpoint
+#define STATS_PATH "/__stats"
+#define STATS_PROMETHEUS_PATH "/__stats/prometheus"
+
+// Output formats of stats_render
+#define STATS_JSON 0
+#define STATS_PROMETHEUS 1
+
+// Latency buckets: bucket i counts durations below 2^(i + 8) ns, the last one
+// everything longer
+#define STATS_BUCKETS 28
+
+// Status codes counted on their own, everything else counts as other
+enum stats_status
+{
+    STATS_200,
+    STATS_206,
+    STATS_304,
+    STATS_400,
+    STATS_404,
+    STATS_405,
+    STATS_414,
+    STATS_416,
+    STATS_431,
+    STATS_500,
+    STATS_503,
+    STATS_505,
+    STATS_OTHER,
+    STATS_NUM_STATUS
+};
+
+// Phases of serving a request with a latency histogram each
+enum stats_phase
+{
+    STATS_FIRST_BYTE,   // accepting a connection to the first byte of its first response
+    STATS_PARSE,        // parsing a complete request head
+    STATS_OPEN,         // opening and inspecting a file that missed the cache
+    STATS_SEND,         // queuing a response to its last byte leaving
+    STATS_NUM_PHASES
+};
+
+struct stats_histogram
+{
+    uint64_t counts[STATS_BUCKETS];
+    uint64_t sum_ns;
+};
+
+// Counters of one thread. Only the owning thread writes them and each
+// thread's block starts on its own cache line, so counting is a plain
+// increment; readers add up all the blocks when the endpoint is requested.
+struct stats
+{
+    uint64_t responses[STATS_NUM_STATUS];
+    uint64_t bytes_sent;
+    uint64_t accepted;
+    uint64_t closed;
+    uint64_t timeouts;
+    uint64_t rejected;      // connections turned away by admission control
+    uint64_t dropped;       // connections the kernel accepted with no slot left to put them in
+    uint64_t shed;          // requests answered with 503 while overloaded
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t log_dropped;   // access log records lost to a full ring or a failed write
+    struct stats_histogram phases[STATS_NUM_PHASES];
+    struct stats *next;     // all threads' blocks, for the readers
+} __attribute__((aligned(64)));
+
+// This thread's block, NULL until it first counts something
+extern __thread struct stats *stats_local;
+
+// Allocate and publish this thread's block. Exits if memory runs out.
+struct stats *stats_register(void);
+
+static inline struct stats *stats_thread(void)
+{
+    return stats_local != NULL ? stats_local : stats_register();
+}
+
+// Add n to a counter of this thread's block. Readers on other threads may see
+// the old or the new value but never a torn one.
+static inline void stats_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+// Monotonic time in nanoseconds, for measuring phases
+static inline uint64_t stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Record that phase took ns nanoseconds
+static inline void stats_record(enum stats_phase phase, uint64_t ns)
+{
+    struct stats_histogram *hist = &stats_thread()->phases[phase];
+    int bucket = ns < 256 ? 0 : 56 - __builtin_clzll(ns);
+    stats_add(&hist->counts[bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1], 1);
+    stats_add(&hist->sum_ns, ns);
+}
+
+// Count a response sent with status_code
+void stats_response(int status_code);
+
+// Which format request_path asks for if it is the statistics endpoint, or -1
+int stats_request_format(const char *request_path);
+
+// Render the sum of all threads' counters as JSON or Prometheus text into a
+// buffer from malloc. Returns NULL if memory runs out.
+char *stats_render(int format, size_t *len);
+
+#endif
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../admission.h"
+
+#define MAX_CONNS 500       // small enough for the smallest shards, of 64 slots
+#define MAX_PER_ADDR 3
+#define QUEUE_HIGH 8
+#define LAG_HIGH_MS 1
+#define ADDRS 40
+
+static int failed, run;
+
+static void check(int ok, const char *what)
+{
+    run++;
+    if (!ok)
+    {
+        fprintf(stderr, "%s\n", what);
+        failed++;
+    }
+}
+
+static uint32_t addrs[ADDRS];
+
+// Addresses that hash to the first slots of the first shard, so they pile up
+// in one long probe sequence; this mirrors the hash of admission.c
+static void pick_addrs(void)
+{
+    uint32_t addr = 0;
+    int i;
+    for (i = 0; i < ADDRS; i++)
+    {
+        uint32_t hash;
+        do
+        {
+            hash = ++addr * 0x9e3779b1u;
+        } while (hash >> (32 - ADMISSION_SHARD_BITS) != 0 || (hash >> ADMISSION_SHARD_BITS & 63) >= 8);
+        addrs[i] = addr;
+    }
+}
+
+static uint32_t addr_at(int i)
+{
+    return addrs[i];
+}
+
+// Check the per-address table through connections opening and closing in an
+// order that moves entries around, the process-wide cap, and when a loop
+// starts and stops shedding
+int main(void)
+{
+    struct admission_load load;
+    memset(&load, 0, sizeof(load));
+    int i, j;
+
+    if (admission_init(MAX_CONNS, MAX_PER_ADDR, QUEUE_HIGH, LAG_HIGH_MS) == -1)
+    {
+        return 1;
+    }
+    pick_addrs();
+
+    // One address is held to its cap, and gets a connection back once one closes
+    uint32_t addr = addr_at(0);
+    for (i = 0; i < MAX_PER_ADDR; i++)
+    {
+        check(admission_admit(&load, addr) == ADMISSION_OK, "an address under its cap was refused");
+    }
+    check(admission_admit(&load, addr) == ADMISSION_PER_ADDR, "an address over its cap was admitted");
+    admission_release(addr);
+    check(admission_admit(&load, addr) == ADMISSION_OK, "a connection closing did not make room");
+    for (i = 0; i < MAX_PER_ADDR; i++)
+    {
+        admission_release(addr);
+    }
+
+    // Fill the table and empty half of it in a scrambled order: every address
+    // left must still find its own entry, with its count, as the ones around
+    // it are removed
+    for (j = 0; j < MAX_PER_ADDR - 1; j++)
+    {
+        for (i = 0; i < ADDRS; i++)
+        {
+            check(admission_admit(&load, addr_at(i)) == ADMISSION_OK, "filling the table refused an address");
+        }
+    }
+    for (i = 0; i < ADDRS; i++)
+    {
+        int k = (i * 7) % ADDRS;
+        if (k % 2 == 0)
+        {
+            for (j = 0; j < MAX_PER_ADDR - 1; j++)
+            {
+                admission_release(addr_at(k));
+            }
+        }
+    }
+    for (i = 1; i < ADDRS; i += 2)
+    {
+        check(admission_admit(&load, addr_at(i)) == ADMISSION_OK, "an address lost its count");
+        check(admission_admit(&load, addr_at(i)) == ADMISSION_PER_ADDR, "an address lost its entry");
+    }
+    for (i = 0; i < ADDRS; i++)
+    {
+        for (j = 0; j < (i % 2 == 0 ? 0 : MAX_PER_ADDR); j++)
+        {
+            admission_release(addr_at(i));
+        }
+    }
+    for (i = 0; i < ADDRS; i++)
+    {
+        for (j = 0; j < MAX_PER_ADDR; j++)
+        {
+            check(admission_admit(&load, addr_at(i)) == ADMISSION_OK, "an emptied table refused an address");
+        }
+        check(admission_admit(&load, addr_at(i)) == ADMISSION_PER_ADDR, "an emptied table kept a stale entry");
+    }
+    for (i = 0; i < ADDRS; i++)
+    {
+        for (j = 0; j < MAX_PER_ADDR; j++)
+        {
+            admission_release(addr_at(i));
+        }
+    }
+
+    // The process cap counts every connection; unknown addresses skip the per-address one
+    for (i = 0; i < MAX_CONNS; i++)
+    {
+        check(admission_admit(&load, 0) == ADMISSION_OK, "a connection under the process cap was refused");
+    }
+    check(admission_admit(&load, 0) == ADMISSION_TOO_MANY, "a connection over the process cap was admitted");
+    check(admission_admit(&load, addr) == ADMISSION_TOO_MANY, "a connection over the process cap was admitted");
+    for (i = 0; i < MAX_CONNS; i++)
+    {
+        admission_release(0);
+    }
+
+    // A deep offload queue starts shedding, which stops only below a quarter of it
+    admission_update(&load, 0, QUEUE_HIGH);
+    check(load.shedding, "a full queue did not start shedding");
+    check(admission_admit(&load, addr) == ADMISSION_SHEDDING, "a shedding loop admitted a connection");
+    admission_update(&load, 0, QUEUE_HIGH / 2);
+    check(load.shedding, "shedding stopped above the low watermark");
+    admission_update(&load, 0, QUEUE_HIGH / 4);
+    check(!load.shedding, "shedding did not stop below the low watermark");
+
+    // So does a run of slow batches, while a single one does not
+    admission_update(&load, LAG_HIGH_MS * 2000000ULL, 0);
+    check(!load.shedding, "a single slow batch started shedding");
+    for (i = 0; i < 16 && !load.shedding; i++)
+    {
+        admission_update(&load, LAG_HIGH_MS * 2000000ULL, 0);
+    }
+    check(load.shedding, "slow batches did not start shedding");
+    admission_update(&load, 0, 0);
+    check(load.shedding, "a single quick batch stopped shedding");
+    for (i = 0; i < 64 && load.shedding; i++)
+    {
+        admission_update(&load, 0, 0);
+    }
+    check(!load.shedding, "quick batches did not stop shedding");
+    check(admission_admit(&load, addr) == ADMISSION_OK, "a loop done shedding refused a connection");
+    admission_release(addr);
+
+    printf("admission_test: %d of %d failed\n", failed, run);
+    return failed != 0;
+}
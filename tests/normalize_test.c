@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../http.h"
+
+// A request path and what http_normalize_path makes of it, NULL if it must be refused
+static const struct
+{
+    const char *path;
+    const char *normalized;
+} cases[] = {
+    {"/", "/"},
+    {"/a.html", "/a.html"},
+    {"/./a.html", "/a.html"},
+    {"/./x", "/x"},
+    {"/a/./b", "/a/b"},
+    {"/a/../x", "/x"},
+    {"/a/b/../c", "/a/c"},
+    {"/a/%2e%2e/x", "/x"},
+    {"/a/%2E/x", "/a/x"},
+    {"//a/./x", "/a/x"},
+    {"/a//b///c", "/a/b/c"},
+    {"/a/./", "/a/"},
+    {"/a/.", "/a/"},
+    {"/a/b/..", "/a/"},
+    {"/a/.//./b", "/a/b"},
+    {"/%61.html", "/a.html"},
+    {"/..", NULL},
+    {"/./../x", NULL},
+    {"/a/../../x", NULL},
+    {"/a%2fb", NULL},
+    {"/a%00", NULL},
+    {"/a%zz", NULL},
+    {"a.html", NULL},
+};
+
+// Check that every spelling of a path normalizes to the one the file cache
+// and its invalidation key on, and that paths leaving the root are refused
+int main(void)
+{
+    int failed = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        char path[256];
+        strcpy(path, cases[i].path);
+        int ret = http_normalize_path(path);
+        if (cases[i].normalized == NULL ? ret != -1 : ret != 0 || strcmp(path, cases[i].normalized) != 0)
+        {
+            fprintf(stderr, "%s: got %s, expected %s\n", cases[i].path, ret == -1 ? "an error" : path,
+                    cases[i].normalized != NULL ? cases[i].normalized : "an error");
+            failed++;
+        }
+    }
+    printf("normalize_test: %d of %zu failed\n", failed, i);
+    return failed != 0;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../http_parser.h"
+
+// Requests sent back to back on one connection, and the target of each
+static const struct
+{
+    const char *name;
+    const char *stream;
+    int count;
+    const char *targets[4];
+} cases[] = {
+    {"two requests", "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n", 2, {"/a", "/b"}},
+    {"with headers", "GET /a HTTP/1.1\r\nHost: x\r\nAccept: */*\r\n\r\nGET /b HTTP/1.1\r\nHost: y\r\n\r\n", 2,
+     {"/a", "/b"}},
+    {"bare line feeds", "GET /a HTTP/1.1\nHost: x\n\nGET /b HTTP/1.0\n\nGET /c HTTP/1.1\n\n", 3, {"/a", "/b", "/c"}},
+    {"long headers",
+     "GET /a HTTP/1.1\r\nX-Long: aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\r\n\r\n"
+     "GET /b HTTP/1.1\r\nX-Long: bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\r\n\r\n"
+     "GET /c HTTP/1.1\r\n\r\n",
+     3, {"/a", "/b", "/c"}},
+};
+
+static int failed, run;
+
+// Parse the requests of stream out of a buffer that receives it step bytes at
+// a time, dropping each request once parsed like a connection does. Returns
+// the number of requests parsed, with their targets checked against expected.
+static int parse_stream(const char *name, const char *stream, size_t step, const char *const *expected)
+{
+    struct http_request req;
+    char buf[1024];
+    size_t len = 0, sent = 0, total = strlen(stream);
+    int parsed = 0;
+
+    http_parser_init(&req);
+    while (sent < total || len > 0)
+    {
+        // The client sends the next bytes
+        size_t n = total - sent < step ? total - sent : step;
+        memcpy(buf + len, stream + sent, n);
+        len += n;
+        sent += n;
+
+        // Answer every request that is complete
+        enum http_parse_result result = HTTP_PARSE_INCOMPLETE;
+        while (len > 0 && (result = http_parse(&req, buf, len)) == HTTP_PARSE_DONE)
+        {
+            if (req.target.len != strlen(expected[parsed]) ||
+                memcmp(buf + req.target.off, expected[parsed], req.target.len) != 0)
+            {
+                fprintf(stderr, "%s, %zu bytes at a time: request %d is for %.*s, expected %s\n", name, step,
+                        parsed + 1, (int)req.target.len, buf + req.target.off, expected[parsed]);
+                failed++;
+            }
+            parsed++;
+            len -= req.head_len;
+            memmove(buf, buf + req.head_len, len);
+            http_parser_init(&req);
+        }
+        if (len > 0 && result == HTTP_PARSE_ERROR)
+        {
+            fprintf(stderr, "%s, %zu bytes at a time: request %d is malformed\n", name, step, parsed + 1);
+            failed++;
+            break;
+        }
+        if (n == 0 && len > 0)
+        {
+            break;
+        }
+    }
+    return parsed;
+}
+
+// Check that requests pipelined on one connection are parsed one by one,
+// whether they arrive together or split anywhere, in the middle of a line
+// end included
+int main(void)
+{
+    size_t i, step;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        size_t total = strlen(cases[i].stream);
+        for (step = 1; step <= total; step++)
+        {
+            run++;
+            int parsed = parse_stream(cases[i].name, cases[i].stream, step, cases[i].targets);
+            if (parsed != cases[i].count)
+            {
+                fprintf(stderr, "%s, %zu bytes at a time: parsed %d requests, expected %d\n", cases[i].name, step,
+                        parsed, cases[i].count);
+                failed++;
+            }
+        }
+    }
+
+    // Bytes of the next request do not change how the one before it parses
+    struct http_request req;
+    const char stream[] = "GET /a HTTP/1.1\r\nHost: x\r\n\r\nGET /b HTTP/1.1\r\n";
+    http_parser_init(&req);
+    run++;
+    if (http_parse(&req, stream, sizeof(stream) - 1) != HTTP_PARSE_DONE || req.num_headers != 1 ||
+        req.head_len != strlen("GET /a HTTP/1.1\r\nHost: x\r\n\r\n"))
+    {
+        fprintf(stderr, "a request followed by part of the next: head of %u bytes with %d headers\n", req.head_len,
+                req.num_headers);
+        failed++;
+    }
+
+    printf("parser_test: %d of %d failed\n", failed, run);
+    return failed != 0;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../http.h"
+
+#define SIZE 100ULL
+
+// A Range header for a file of SIZE bytes and what http_parse_ranges makes of
+// it: the number of ranges, 0 for the whole file, -1 if none can be satisfied
+static const struct
+{
+    const char *range;
+    int count;
+    struct http_range ranges[3];
+} cases[] = {
+    {"bytes=0-9", 1, {{0, 9}}},
+    {"bytes=90-", 1, {{90, 99}}},
+    {"bytes=90-200", 1, {{90, 99}}},
+    {"bytes=-10", 1, {{90, 99}}},
+    {"bytes=-200", 1, {{0, 99}}},
+    {"bytes=0-0,-1", 2, {{0, 0}, {99, 99}}},
+    {"bytes= 0-1 , 5-6 ,, 8-", 3, {{0, 1}, {5, 6}, {8, 99}}},
+    {"BYTES=1-2", 1, {{1, 2}}},
+    {"bytes=100-", -1, {{0, 0}}},
+    {"bytes=100-200,300-", -1, {{0, 0}}},
+    {"bytes=-0", -1, {{0, 0}}},
+    {"bytes=100-,0-1", 1, {{0, 1}}},
+    {"bytes=5-4", 0, {{0, 0}}},
+    {"bytes=a-b", 0, {{0, 0}}},
+    {"bytes=1-2x", 0, {{0, 0}}},
+    {"bytes=", 0, {{0, 0}}},
+    {"items=0-1", 0, {{0, 0}}},
+    {"bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8", 0, {{0, 0}}},
+};
+
+// Parse a request carrying range and an If-Range header if if_range is not NULL
+static int parse_ranges(const char *range, const char *if_range, const struct http_validators *validators,
+                        struct http_range *ranges, char *buf, size_t size)
+{
+    struct http_request req;
+    int len = snprintf(buf, size, "GET / HTTP/1.1\r\nRange: %s\r\n%s%s%s\r\n", range,
+                       if_range != NULL ? "If-Range: " : "", if_range != NULL ? if_range : "",
+                       if_range != NULL ? "\r\n" : "");
+    http_parser_init(&req);
+    if (http_parse(&req, buf, len) != HTTP_PARSE_DONE)
+    {
+        return -2;
+    }
+    return http_parse_ranges(&req, buf, SIZE, validators, ranges);
+}
+
+// Check the ranges taken out of Range headers, the If-Range check and the
+// head of each part of a multipart/byteranges body
+int main(void)
+{
+    struct http_validators validators;
+    struct http_range ranges[HTTP_MAX_RANGES];
+    char buf[512];
+    int failed = 0, run = 0;
+    size_t i;
+
+    // A file last changed long ago gets a strong ETag
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_ino = 42;
+    st.st_size = SIZE;
+    st.st_mtim.tv_sec = 1000000000;
+    http_make_validators(&validators, &st);
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++, run++)
+    {
+        int count = parse_ranges(cases[i].range, NULL, &validators, ranges, buf, sizeof(buf));
+        int same = count == cases[i].count;
+        int j;
+        for (j = 0; same && j < count; j++)
+        {
+            same = ranges[j].first == cases[i].ranges[j].first && ranges[j].last == cases[i].ranges[j].last;
+        }
+        if (!same)
+        {
+            fprintf(stderr, "%s: got %d ranges, expected %d\n", cases[i].range, count, cases[i].count);
+            failed++;
+        }
+    }
+
+    // If-Range keeps the ranges only while the client's copy is current
+    char etag[HTTP_VALIDATORS_MAX];
+    memcpy(etag, validators.lines + 6, validators.etag_len);
+    etag[validators.etag_len] = '\0';
+    const char *if_ranges[] = {etag, "\"other\"", "Sun, 09 Sep 2001 01:46:40 GMT", "Mon, 10 Sep 2001 01:46:40 GMT"};
+    const int if_range_counts[] = {1, 0, 1, 0};
+    for (i = 0; i < sizeof(if_ranges) / sizeof(if_ranges[0]); i++, run++)
+    {
+        int count = parse_ranges("bytes=0-9", if_ranges[i], &validators, ranges, buf, sizeof(buf));
+        if (count != if_range_counts[i])
+        {
+            fprintf(stderr, "If-Range %s: got %d ranges, expected %d\n", if_ranges[i], count, if_range_counts[i]);
+            failed++;
+        }
+    }
+
+    // Each part opens with the delimiter, its type and its range
+    struct http_range part = {5, 6};
+    static const char expected[] = "\r\n--" HTTP_BOUNDARY "\r\n"
+                                   "Content-Type: application/octet-stream\r\n"
+                                   "Content-Range: bytes 5-6/100\r\n\r\n";
+    size_t len = http_render_part_head(buf, NULL, &part, SIZE);
+    run++;
+    if (len != sizeof(expected) - 1 || memcmp(buf, expected, len) != 0 || len > HTTP_PART_HEAD_MAX)
+    {
+        fprintf(stderr, "part head: got %.*s\n", (int)len, buf);
+        failed++;
+    }
+
+    // An unsatisfiable request names the size only
+    len = http_render_content_range(buf, NULL, SIZE);
+    run++;
+    if (len != strlen("Content-Range: bytes */100\r\n") || memcmp(buf, "Content-Range: bytes */100\r\n", len) != 0)
+    {
+        fprintf(stderr, "unsatisfiable range: got %.*s\n", (int)len, buf);
+        failed++;
+    }
+
+    printf("range_test: %d of %d failed\n", failed, run);
+    return failed != 0;
+}
@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SERVER "./server"
+
+// Server options run against, each with and without the file cache
+static const char *const backends[] = {"epoll", "poll", "select", "uring"};
+
+// Requests sent at once on one connection, and the responses that must come back
+static const struct
+{
+    const char *name;
+    const char *requests;
+    const char *status;     // status line expected on the connection
+    int responses;          // how many times it is expected
+    const char *contains;   // text the responses must contain, NULL for none
+    const char *body;       // text the last response must end with
+    int cached;             // only holds with the file cache on
+} cases[] = {
+    {"empty file, then another", "GET /empty.txt HTTP/1.1\r\n\r\nGET /a.txt HTTP/1.1\r\n\r\n",
+     "HTTP/1.1 200 OK", 2, NULL, "hello\n"},
+    {"two empty files, then another",
+     "GET /empty.txt HTTP/1.1\r\n\r\nGET /empty.txt HTTP/1.1\r\n\r\nGET /a.txt HTTP/1.1\r\n\r\n",
+     "HTTP/1.1 200 OK", 3, NULL, "hello\n"},
+    {"ranges are advertised", "GET /a.txt HTTP/1.1\r\n\r\n", "HTTP/1.1 200 OK", 1, "Accept-Ranges: bytes\r\n",
+     "hello\n"},
+    {"single range", "GET /digits.txt HTTP/1.1\r\nRange: bytes=2-5\r\n\r\n", "HTTP/1.1 206 Partial Content", 1,
+     "Content-Range: bytes 2-5/20\r\n", "\r\n\r\n2345"},
+    {"suffix range, then another", "GET /digits.txt HTTP/1.1\r\nRange: bytes=-3\r\n\r\nGET /a.txt HTTP/1.1\r\n\r\n",
+     "HTTP/1.1 206 Partial Content", 1, "\r\n\r\n789", "hello\n"},
+    {"unsatisfiable range", "GET /digits.txt HTTP/1.1\r\nRange: bytes=20-\r\n\r\n",
+     "HTTP/1.1 416 Range Not Satisfiable", 1, "Content-Range: bytes */20\r\n", "\r\n\r\n"},
+    {"two ranges", "GET /digits.txt HTTP/1.1\r\nRange: bytes=0-1,18-\r\n\r\n", "HTTP/1.1 206 Partial Content", 1,
+     "Content-Range: bytes 18-19/20\r\n\r\n89\r\n", "_byteranges--\r\n"},
+    {"gzip sidecar", "GET /page.html HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n", "HTTP/1.1 200 OK", 1,
+     "Content-Encoding: gzip\r\n", "page.html.gz"},
+    {"brotli sidecar preferred", "GET /page.html HTTP/1.1\r\nAccept-Encoding: gzip, br\r\n\r\n",
+     "HTTP/1.1 200 OK", 1, "Content-Encoding: br\r\n", "page.html.br"},
+    {"no coding accepted", "GET /page.html HTTP/1.1\r\n\r\n", "HTTP/1.1 200 OK", 1, "Vary: Accept-Encoding\r\n",
+     "page.html"},
+    {"compressed on the fly", "GET /long.txt HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n", "HTTP/1.1 200 OK", 1,
+     "Content-Encoding: gzip\r\n", "", 1},
+};
+
+static char root[] = "/tmp/serve_test.XXXXXX";
+
+static void file_path(char *path, const char *name)
+{
+    snprintf(path, 64, "%s/%s", root, name);
+}
+
+static int write_file(const char *name, const char *content)
+{
+    char path[64];
+    file_path(path, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        perror(path);
+        return -1;
+    }
+    size_t len = strlen(content);
+    int ret = write(fd, content, len) == (ssize_t)len ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+// A file big enough to be worth compressing
+static int write_long_file(const char *name)
+{
+    char content[4096];
+    size_t i;
+    for (i = 0; i < sizeof(content) - 1; i++)
+    {
+        content[i] = 'a' + i % 7;
+    }
+    content[i] = '\0';
+    return write_file(name, content);
+}
+
+// Start the server on port with the given backend and cache budget, and wait
+// until it takes connections. Returns its pid, or -1.
+static pid_t start_server(int port, const char *backend, const char *cache)
+{
+    char port_arg[16];
+    snprintf(port_arg, sizeof(port_arg), "%d", port);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execl(SERVER, SERVER, "-w", "1", "-o", "0", "-c", cache, "-b", backend, port_arg, root, (char *)NULL);
+        _exit(127);
+    }
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int tries;
+    for (tries = 0; tries < 100; tries++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            close(fd);
+            return pid;
+        }
+        close(fd);
+        usleep(20000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+// Send requests in one write and read what comes back until the server goes
+// quiet for a while. Returns the length read, or -1.
+static ssize_t exchange(int port, const char *requests, char *buf, size_t size)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 300000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        send(fd, requests, strlen(requests), 0) != (ssize_t)strlen(requests))
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t len = 0;
+    ssize_t n;
+    while (len < size - 1 && (n = recv(fd, buf + len, size - 1 - len, 0)) > 0)
+    {
+        len += n;
+    }
+    buf[len] = '\0';
+    close(fd);
+    return len;
+}
+
+static int count(const char *haystack, const char *needle)
+{
+    int found = 0;
+    while ((haystack = strstr(haystack, needle)) != NULL)
+    {
+        found++;
+        haystack += strlen(needle);
+    }
+    return found;
+}
+
+// Check that a keep-alive connection survives responses with an empty body,
+// so the requests pipelined behind them are still answered, and that every
+// loop answers byte ranges and negotiates codings the same way
+int main(void)
+{
+    int failed = 0, run = 0;
+    size_t b, i;
+
+    if (mkdtemp(root) == NULL || write_file("empty.txt", "") == -1 || write_file("a.txt", "hello\n") == -1 ||
+        write_file("digits.txt", "01234567890123456789") == -1 || write_file("page.html", "page.html") == -1 ||
+        write_file("page.html.gz", "page.html.gz") == -1 || write_file("page.html.br", "page.html.br") == -1 ||
+        write_long_file("long.txt") == -1)
+    {
+        perror("serve_test");
+        return 1;
+    }
+
+    int port = 20000 + getpid() % 20000;
+    for (b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+    {
+        const char *cache;
+        for (cache = "0"; cache != NULL; cache = cache[0] == '0' ? "1048576" : NULL)
+        {
+            pid_t pid = start_server(++port, backends[b], cache);
+            if (pid == -1)
+            {
+                fprintf(stderr, "%s, cache %s: server did not start\n", backends[b], cache);
+                failed++;
+                continue;
+            }
+            for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+            {
+                if (cases[i].cached && cache[0] == '0')
+                {
+                    continue;
+                }
+                char buf[8192];
+                ssize_t len = exchange(port, cases[i].requests, buf, sizeof(buf));
+                size_t body_len = strlen(cases[i].body);
+                run++;
+                if (len == -1 || count(buf, cases[i].status) != cases[i].responses ||
+                    (cases[i].contains != NULL && strstr(buf, cases[i].contains) == NULL) ||
+                    (size_t)len < body_len || strcmp(buf + len - body_len, cases[i].body) != 0)
+                {
+                    fprintf(stderr, "%s, cache %s, %s: got\n%s\n", backends[b], cache, cases[i].name, buf);
+                    failed++;
+                }
+            }
+            kill(pid, SIGTERM);
+            waitpid(pid, NULL, 0);
+        }
+    }
+
+    static const char *const names[] = {"empty.txt", "a.txt", "digits.txt", "page.html", "page.html.gz",
+                                        "page.html.br", "long.txt"};
+    char path[64];
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        file_path(path, names[i]);
+        unlink(path);
+    }
+    rmdir(root);
+    printf("serve_test: %d of %d failed\n", failed, run);
+    return failed != 0;
+}
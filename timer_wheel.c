@@ -0,0 +1,200 @@
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+
+// Furthest a timer can be armed ahead of the clock
+#define MAX_DELTA ((1ULL << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now_ms)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now_ms;
+}
+
+// Link a timer into the slot its deadline hashes to, at the lowest level whose
+// span covers the distance from the clock
+static void place(struct timer_wheel *wheel, struct timer *timer)
+{
+    uint64_t delta = timer->expires - wheel->now;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >> ((level + 1) * TIMER_SLOT_BITS) != 0)
+    {
+        level++;
+    }
+    int slot = (timer->expires >> (level * TIMER_SLOT_BITS)) & SLOT_MASK;
+
+    struct timer **head = &wheel->slots[level][slot];
+    timer->next = *head;
+    if (*head != NULL)
+    {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+void timer_add(struct timer_wheel *wheel, struct timer *timer, uint64_t expires_ms)
+{
+    timer_cancel(timer);
+    if (expires_ms < wheel->now)
+    {
+        expires_ms = wheel->now;
+    }
+    if (expires_ms - wheel->now > MAX_DELTA)
+    {
+        expires_ms = wheel->now + MAX_DELTA;
+    }
+    timer->expires = expires_ms;
+    place(wheel, timer);
+}
+
+void timer_cancel(struct timer *timer)
+{
+    if (timer->pprev == NULL)
+    {
+        return;
+    }
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+    {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->pprev = NULL;
+}
+
+// Empty a slot, returning its timers still chained through next
+static struct timer *take_slot(struct timer_wheel *wheel, int level, int slot)
+{
+    struct timer *list = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ULL << slot);
+    return list;
+}
+
+// Spread the timers of the current slot of a higher level over the levels below
+static int cascade(struct timer_wheel *wheel, int level)
+{
+    int slot = (wheel->now >> (level * TIMER_SLOT_BITS)) & SLOT_MASK;
+    struct timer *timer = take_slot(wheel, level, slot);
+    while (timer != NULL)
+    {
+        struct timer *next = timer->next;
+        place(wheel, timer);
+        timer = next;
+    }
+    return slot;
+}
+
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ms, timer_fn fn, void *arg)
+{
+    // An empty wheel can jump straight to the new time
+    int level;
+    for (level = 0; level < TIMER_LEVELS && wheel->occupied[level] == 0; level++)
+    {
+    }
+    if (level == TIMER_LEVELS)
+    {
+        wheel->now = now_ms + 1 > wheel->now ? now_ms + 1 : wheel->now;
+        return;
+    }
+
+    while (wheel->now <= now_ms)
+    {
+        int slot = wheel->now & SLOT_MASK;
+
+        // Refill level 0 whenever it wraps, and each level above when the one below wraps
+        if (slot == 0)
+        {
+            level = 1;
+            while (level < TIMER_LEVELS && cascade(wheel, level) == 0)
+            {
+                level++;
+            }
+        }
+
+        // Nothing due in the rest of this turn of level 0: jump to its end
+        uint64_t ahead = wheel->occupied[0] >> slot;
+        if (ahead == 0)
+        {
+            uint64_t turn_end = (wheel->now | SLOT_MASK) + 1;
+            wheel->now = turn_end <= now_ms ? turn_end : now_ms + 1;
+            continue;
+        }
+        int skip = __builtin_ctzll(ahead);
+        if (wheel->now + skip > now_ms)
+        {
+            wheel->now = now_ms + 1;
+            break;
+        }
+        wheel->now += skip;
+        slot += skip;
+
+        // Detach the due timers first so the callbacks can arm timers again. The
+        // ones still waiting stay linked from due, so a callback may cancel them.
+        struct timer *due = take_slot(wheel, 0, slot);
+        if (due != NULL)
+        {
+            due->pprev = &due;
+        }
+        wheel->now++;
+        while (due != NULL)
+        {
+            struct timer *timer = due;
+            due = timer->next;
+            if (due != NULL)
+            {
+                due->pprev = &due;
+            }
+            timer->pprev = NULL;
+            fn(timer, arg);
+        }
+    }
+}
+
+int timer_wheel_timeout(const struct timer_wheel *wheel, uint64_t now_ms)
+{
+    uint64_t next = UINT64_MAX;
+    int level;
+
+    // Level 0 holds exact deadlines: the first occupied slot from the clock on
+    int slot = wheel->now & SLOT_MASK;
+    uint64_t occupied = wheel->occupied[0];
+    if (occupied != 0)
+    {
+        uint64_t rotated = slot == 0 ? occupied : occupied >> slot | occupied << (TIMER_SLOTS - slot);
+        next = wheel->now + __builtin_ctzll(rotated);
+    }
+
+    // Higher levels only tell when their next occupied slot cascades. The slot
+    // under the clock has cascaded already unless the clock sits on its start.
+    for (level = 1; level < TIMER_LEVELS; level++)
+    {
+        occupied = wheel->occupied[level];
+        if (occupied == 0)
+        {
+            continue;
+        }
+        int shift = level * TIMER_SLOT_BITS;
+        uint64_t index = (wheel->now >> shift) + ((wheel->now & ((1ULL << shift) - 1)) != 0);
+        int start = index & SLOT_MASK;
+        uint64_t rotated = start == 0 ? occupied : occupied >> start | occupied << (TIMER_SLOTS - start);
+        uint64_t when = (index + __builtin_ctzll(rotated)) << shift;
+        if (when < next)
+        {
+            next = when;
+        }
+    }
+
+    if (next == UINT64_MAX)
+    {
+        return -1;
+    }
+    if (next <= now_ms)
+    {
+        return 0;
+    }
+    return next - now_ms > INT32_MAX ? INT32_MAX : (int)(next - now_ms);
+}
@@ -0,0 +1,74 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Four levels of 64 slots with a 1 ms tick: level 0 holds the timers due in
+// the next 64 ms, level 1 those due in the next 4 s, and so on up to about
+// 4.6 hours. Later deadlines are clamped to that.
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+// A timer embedded in the object it belongs to
+struct timer
+{
+    struct timer *next;
+    struct timer **pprev;   // link pointing at this timer, NULL when not pending
+    uint64_t expires;       // millisecond the timer is due
+};
+
+// Hierarchical timing wheel. Adding and cancelling a timer is O(1); a timer
+// moves down at most TIMER_LEVELS - 1 times before it fires, when the wheel
+// reaches the slot it was hashed into.
+struct timer_wheel
+{
+    uint64_t now;                                   // next tick to process
+    uint64_t occupied[TIMER_LEVELS];                // bit per slot that may hold timers
+    struct timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+typedef void (*timer_fn)(struct timer *timer, void *arg);
+
+// Monotonic time in milliseconds, the clock the wheels run on
+static inline uint64_t timer_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Set up an empty wheel whose clock starts at now_ms
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now_ms);
+
+static inline void timer_init(struct timer *timer)
+{
+    timer->pprev = NULL;
+}
+
+static inline int timer_pending(const struct timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+// Arm timer to fire once the wheel reaches expires_ms, moving it if it is
+// already pending. A deadline already passed fires on the next tick.
+void timer_add(struct timer_wheel *wheel, struct timer *timer, uint64_t expires_ms);
+
+// Disarm timer if it is pending. A slot emptied this way keeps its occupancy
+// bit until the wheel reaches it, which costs at most one early wakeup.
+void timer_cancel(struct timer *timer);
+
+// Move the clock forward to now_ms and call fn(timer, arg) for every timer
+// that became due. Timers are no longer pending when fn runs, so fn may arm
+// them again or free them.
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ms, timer_fn fn, void *arg);
+
+// Milliseconds from now_ms until the wheel needs advancing again, for the
+// timeout of poll or epoll_wait, or -1 if no timer is pending. The wait may
+// end on a cascade of a higher level before any timer is due.
+int timer_wheel_timeout(const struct timer_wheel *wheel, uint64_t now_ms);
+
+#endif
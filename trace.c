@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "trace.h"
+
+#define CHUNK_SIZE ((uint64_t)TRACE_CHUNK_RECORDS * sizeof(struct trace_record))
+
+int trace_enabled;
+int trace_use_tsc;
+__thread struct trace_record *trace_next;
+__thread struct trace_record *trace_end;
+__thread uint16_t trace_thread;
+
+static int trace_fd = -1;
+static uint64_t max_chunks;
+static uint64_t chunks_claimed;
+static int threads_seen;
+static __thread int thread_known;
+
+// Whether the TSC ticks at a constant rate across cores and power states,
+// so differences between readings are time
+static int invariant_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+#else
+    return 0;
+#endif
+}
+
+static uint64_t monotonic_raw_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Count TSC ticks over 20 ms of CLOCK_MONOTONIC_RAW
+static uint64_t tsc_hz(void)
+{
+    uint64_t ns = monotonic_raw_ns();
+    uint64_t ticks = trace_ticks();
+    usleep(20000);
+    uint64_t elapsed_ns = monotonic_raw_ns() - ns;
+    uint64_t elapsed_ticks = trace_ticks() - ticks;
+    return (uint64_t)((double)elapsed_ticks * 1e9 / elapsed_ns);
+}
+
+int trace_open(const char *path, uint64_t max_size)
+{
+    trace_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd == -1)
+    {
+        perror(path);
+        return -1;
+    }
+    max_chunks = max_size > TRACE_HEADER_SIZE ? (max_size - TRACE_HEADER_SIZE) / CHUNK_SIZE : 0;
+
+    struct trace_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(struct trace_record);
+    header.chunk_size = CHUNK_SIZE;
+    trace_use_tsc = invariant_tsc();
+    header.clock = trace_use_tsc ? TRACE_CLOCK_TSC : TRACE_CLOCK_MONOTONIC_RAW;
+    header.ticks_per_sec = trace_use_tsc ? tsc_hz() : 1000000000ULL;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.start_ticks = trace_ticks();
+    header.start_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    if (pwrite(trace_fd, &header, sizeof(header), 0) != sizeof(header) || ftruncate(trace_fd, TRACE_HEADER_SIZE) == -1)
+    {
+        perror(path);
+        close(trace_fd);
+        trace_fd = -1;
+        return -1;
+    }
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void trace_close(void)
+{
+    // The mappings write back to the file on their own; the descriptor stays
+    // open for a thread that is claiming a chunk right now
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+}
+
+struct trace_record *trace_claim_chunk(void)
+{
+    uint64_t chunk = __atomic_load_n(&chunks_claimed, __ATOMIC_RELAXED);
+    if (chunk >= max_chunks)
+    {
+        return NULL;
+    }
+    chunk = __atomic_fetch_add(&chunks_claimed, 1, __ATOMIC_RELAXED);
+    if (chunk >= max_chunks)
+    {
+        return NULL;
+    }
+    if (!thread_known)
+    {
+        trace_thread = __atomic_fetch_add(&threads_seen, 1, __ATOMIC_RELAXED);
+        thread_known = 1;
+    }
+
+    // Grow the file over the chunk by writing its last byte, which never
+    // shrinks it under a thread that claimed a later chunk
+    off_t offset = TRACE_HEADER_SIZE + chunk * CHUNK_SIZE;
+    char zero = 0;
+    if (pwrite(trace_fd, &zero, 1, offset + CHUNK_SIZE - 1) != 1)
+    {
+        perror("trace");
+        return NULL;
+    }
+    struct trace_record *records = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, trace_fd, offset);
+    if (records == MAP_FAILED)
+    {
+        perror("trace: mmap");
+        return NULL;
+    }
+
+    // The previous chunk stays mapped: unmapping it would flush the TLB of every core running the server
+    trace_next = records;
+    trace_end = records + TRACE_CHUNK_RECORDS;
+    return records;
+}
@@ -0,0 +1,136 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Request tracing timestamps the phases of every request into a binary trace
+// file, for traceanalyze to turn into latency distributions per phase or a
+// Chrome trace. It is compiled in with make TRACE=1 and turned on with
+// --trace; otherwise the hooks cost nothing. Each thread claims chunks of the
+// file and writes its records into them through a shared mapping, so a
+// record is a few stores, with no system call and no lock; once the file
+// reaches its size limit, further records are dropped.
+//
+// The hooks also fire a USDT probe, server:phase with the phase and the
+// connection as arguments, wherever <sys/sdt.h> is available, so perf or
+// bpftrace can attach to any build.
+#define TRACE_MAGIC "CNTRACE1"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 4096              // the header page, chunks follow it
+#define TRACE_CHUNK_RECORDS 65536           // records per chunk a thread claims
+#define TRACE_DEFAULT_MAX_SIZE (256 << 20)  // the file stops growing here
+
+// Phases of a connection and its requests
+#define TRACE_ACCEPT 1      // the connection was accepted
+#define TRACE_READ 2        // the first bytes of a request were read
+#define TRACE_PARSED 3      // its head was parsed
+#define TRACE_RESOLVED 4    // its response was decided: cache hit, file opened or error
+#define TRACE_HEADERS 5     // the first bytes of the response were written
+#define TRACE_SENT 6        // its last byte was written
+#define TRACE_CLOSE 7       // the connection was closed
+#define TRACE_NUM_EVENTS 8
+
+// Clocks the timestamps can come from
+#define TRACE_CLOCK_TSC 1           // the invariant time stamp counter
+#define TRACE_CLOCK_MONOTONIC_RAW 2 // clock_gettime, in nanoseconds
+
+struct trace_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t chunk_size;        // bytes per chunk
+    uint32_t clock;             // TRACE_CLOCK_*
+    uint32_t reserved;
+    uint64_t ticks_per_sec;     // of the clock, measured against CLOCK_MONOTONIC_RAW for the TSC
+    uint64_t start_ticks;       // clock reading when the file was opened
+    uint64_t start_ns;          // and the time then, ns since the epoch
+};
+
+// One phase of one connection. Chunks are zero-filled, so a record with
+// event 0 ends the ones a thread wrote.
+struct trace_record
+{
+    uint64_t ticks;
+    uint32_t conn;              // the connection's descriptor or io_uring slot
+    uint16_t thread;            // in the order threads first traced
+    uint8_t event;              // TRACE_*
+    uint8_t reserved;
+};
+
+_Static_assert(sizeof(struct trace_record) == 16, "trace records must stay 16 bytes");
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_PROBE(event, conn) DTRACE_PROBE2(server, phase, event, conn)
+#endif
+#endif
+#ifndef TRACE_PROBE
+#define TRACE_PROBE(event, conn) ((void)0)
+#endif
+
+// Set while a trace file is open
+extern int trace_enabled;
+
+// Where this thread writes its next record, and the end of its chunk
+extern __thread struct trace_record *trace_next;
+extern __thread struct trace_record *trace_end;
+extern __thread uint16_t trace_thread;
+extern int trace_use_tsc;
+
+// Open a trace file at path, of at most max_size bytes, and start tracing.
+// Returns -1 on failure.
+int trace_open(const char *path, uint64_t max_size);
+
+// Stop tracing; the records written so far reach the file
+void trace_close(void);
+
+// Map a new chunk for this thread. Returns its first record, or NULL once
+// the file is full.
+struct trace_record *trace_claim_chunk(void);
+
+static inline uint64_t trace_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (trace_use_tsc)
+    {
+        return __builtin_ia32_rdtsc();
+    }
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void trace_record(int event, uint32_t conn)
+{
+    struct trace_record *record = trace_next;
+    if (record == trace_end && (record = trace_claim_chunk()) == NULL)
+    {
+        return;
+    }
+    record->ticks = trace_ticks();
+    record->conn = conn;
+    record->thread = trace_thread;
+    record->event = event;
+    trace_next = record + 1;
+}
+
+// Record that connection conn reached a phase
+#ifdef TRACE
+#define TRACE_PHASE(event, conn)                 \
+    do                                           \
+    {                                            \
+        TRACE_PROBE(event, conn);                \
+        if (__builtin_expect(trace_enabled, 0))  \
+        {                                        \
+            trace_record(event, conn);           \
+        }                                        \
+    } while (0)
+#else
+#define TRACE_PHASE(event, conn) TRACE_PROBE(event, conn)
+#endif
+
+#endif
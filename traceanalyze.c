@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// Spans measured between the phases of a connection and its requests
+enum span
+{
+    SPAN_CONNECT,       // accepted to the first bytes of its first request
+    SPAN_RECEIVE,       // first bytes of a request to its parsed head
+    SPAN_RESOLVE,       // parsed to the response decided
+    SPAN_QUEUE,         // decided to its first bytes written
+    SPAN_SEND,          // first bytes to the last one written
+    SPAN_REQUEST,       // first bytes of a request, or its head if it was pipelined, to the last byte written
+    SPAN_CONNECTION,    // accepted to closed
+    NUM_SPANS
+};
+
+static const char *const span_names[NUM_SPANS] = {
+    "connect", "receive", "resolve", "queue", "send", "request", "connection",
+};
+
+// Durations of one span in nanoseconds
+struct samples
+{
+    uint64_t *ns;
+    size_t count;
+    size_t size;
+};
+
+// Where a connection is, by the ticks each phase of its current request was reached at, 0 if not yet
+struct conn_trace
+{
+    uint64_t key;           // thread and connection plus one, 0 for an empty slot
+    uint64_t at[TRACE_NUM_EVENTS];
+    int requests;
+};
+
+static struct samples spans[NUM_SPANS];
+
+// Open addressing over keys, doubled when half full
+static struct conn_trace *conns;
+static size_t conn_slots;
+static size_t conn_count;
+
+// Converting ticks to nanoseconds since the trace started
+static double ns_per_tick;
+static uint64_t start_ticks;
+
+// Chrome trace output instead of distributions, and whether an event was written yet
+static int chrome;
+static int chrome_events;
+
+static struct conn_trace *find_conn(uint64_t key)
+{
+    size_t i = (key * 0x9e3779b97f4a7c15ULL) >> 20 & (conn_slots - 1);
+    while (conns[i].key != 0 && conns[i].key != key)
+    {
+        i = (i + 1) & (conn_slots - 1);
+    }
+    return &conns[i];
+}
+
+static struct conn_trace *get_conn(uint64_t key)
+{
+    if (2 * (conn_count + 1) > conn_slots)
+    {
+        struct conn_trace *old = conns;
+        size_t old_slots = conn_slots, i;
+        conn_slots = conn_slots != 0 ? 2 * conn_slots : 1024;
+        conns = calloc(conn_slots, sizeof(*conns));
+        if (conns == NULL)
+        {
+            perror("calloc");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < old_slots; i++)
+        {
+            if (old[i].key != 0)
+            {
+                *find_conn(old[i].key) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    struct conn_trace *conn = find_conn(key);
+    if (conn->key == 0)
+    {
+        conn->key = key;
+        conn_count++;
+    }
+    return conn;
+}
+
+static double to_us(uint64_t ticks)
+{
+    return (ticks - start_ticks) * ns_per_tick / 1e3;
+}
+
+// Write a span as a complete event of the Chrome trace format, one process
+// per thread and one track per connection, where the spans nest
+static void print_chrome(const char *name, int thread, uint32_t conn, uint64_t from, uint64_t to)
+{
+    printf("%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+           chrome_events++ ? "," : "", name, thread, conn, to_us(from), to_us(to) - to_us(from));
+}
+
+// Count the span between two phases that were both reached
+static void add_span(enum span span, int thread, uint32_t conn, uint64_t from, uint64_t to)
+{
+    if (from == 0 || to == 0 || to < from)
+    {
+        return;
+    }
+    if (chrome)
+    {
+        print_chrome(span_names[span], thread, conn, from, to);
+        return;
+    }
+
+    struct samples *samples = &spans[span];
+    if (samples->count == samples->size)
+    {
+        samples->size = samples->size != 0 ? 2 * samples->size : 4096;
+        samples->ns = realloc(samples->ns, samples->size * sizeof(*samples->ns));
+        if (samples->ns == NULL)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    samples->ns[samples->count++] = (uint64_t)((to - from) * ns_per_tick);
+}
+
+static void add_record(const struct trace_record *record)
+{
+    struct conn_trace *conn = get_conn(((uint64_t)record->thread << 32 | record->conn) + 1);
+    uint64_t *at = conn->at;
+    int thread = record->thread;
+
+    switch (record->event)
+    {
+    case TRACE_ACCEPT:
+        memset(at, 0, sizeof(conn->at));
+        conn->requests = 0;
+        at[TRACE_ACCEPT] = record->ticks;
+        break;
+    case TRACE_READ:
+        if (at[TRACE_READ] == 0)
+        {
+            at[TRACE_READ] = record->ticks;
+        }
+        break;
+    case TRACE_PARSED:
+    case TRACE_RESOLVED:
+    case TRACE_HEADERS:
+        at[record->event] = record->ticks;
+        break;
+    case TRACE_SENT:
+        at[TRACE_SENT] = record->ticks;
+        if (conn->requests++ == 0)
+        {
+            add_span(SPAN_CONNECT, thread, record->conn, at[TRACE_ACCEPT], at[TRACE_READ]);
+        }
+        add_span(SPAN_REQUEST, thread, record->conn, at[TRACE_READ] != 0 ? at[TRACE_READ] : at[TRACE_PARSED],
+                 at[TRACE_SENT]);
+        add_span(SPAN_RECEIVE, thread, record->conn, at[TRACE_READ], at[TRACE_PARSED]);
+        add_span(SPAN_RESOLVE, thread, record->conn, at[TRACE_PARSED], at[TRACE_RESOLVED]);
+        add_span(SPAN_QUEUE, thread, record->conn, at[TRACE_RESOLVED], at[TRACE_HEADERS]);
+        add_span(SPAN_SEND, thread, record->conn, at[TRACE_HEADERS], at[TRACE_SENT]);
+        memset(&at[TRACE_READ], 0, (TRACE_NUM_EVENTS - TRACE_READ) * sizeof(*at));
+        break;
+    case TRACE_CLOSE:
+        add_span(SPAN_CONNECTION, thread, record->conn, at[TRACE_ACCEPT], record->ticks);
+        memset(at, 0, sizeof(conn->at));
+        break;
+    }
+}
+
+// Read the records of one trace file. Returns -1 if it cannot be read or is not a trace.
+static int analyze_file(const char *name)
+{
+    FILE *file = fopen(name, "rb");
+    if (file == NULL)
+    {
+        perror(name);
+        return -1;
+    }
+
+    struct trace_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(struct trace_record) ||
+        header.chunk_size % sizeof(struct trace_record) != 0 || header.ticks_per_sec == 0)
+    {
+        fprintf(stderr, "%s: not a trace\n", name);
+        fclose(file);
+        return -1;
+    }
+    ns_per_tick = 1e9 / header.ticks_per_sec;
+    start_ticks = header.start_ticks;
+
+    // A thread's chunks come in the order it wrote them, and its records within each
+    size_t per_chunk = header.chunk_size / sizeof(struct trace_record);
+    struct trace_record *chunk = malloc(header.chunk_size);
+    if (chunk == NULL || fseek(file, TRACE_HEADER_SIZE, SEEK_SET) == -1)
+    {
+        perror(name);
+        free(chunk);
+        fclose(file);
+        return -1;
+    }
+    size_t n;
+    while ((n = fread(chunk, sizeof(struct trace_record), per_chunk, file)) > 0)
+    {
+        size_t i;
+        for (i = 0; i < n && chunk[i].event != 0; i++)
+        {
+            add_record(&chunk[i]);
+        }
+    }
+    free(chunk);
+    fclose(file);
+
+    // Connections still open at the end of one file do not carry over into the next
+    if (conns != NULL)
+    {
+        memset(conns, 0, conn_slots * sizeof(*conns));
+    }
+    conn_count = 0;
+    return 0;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const struct samples *samples, double p)
+{
+    size_t i = (size_t)(p * (samples->count - 1) + 0.5);
+    return samples->ns[i] / 1e3;
+}
+
+static void print_distributions(void)
+{
+    int span;
+
+    printf("%-11s %10s %10s %10s %10s %10s %10s %10s\n", "span (us)", "count", "mean", "p50", "p90", "p99",
+           "p99.9", "max");
+    for (span = 0; span < NUM_SPANS; span++)
+    {
+        struct samples *samples = &spans[span];
+        if (samples->count == 0)
+        {
+            printf("%-11s %10d\n", span_names[span], 0);
+            continue;
+        }
+        qsort(samples->ns, samples->count, sizeof(*samples->ns), compare_ns);
+        double sum = 0;
+        size_t i;
+        for (i = 0; i < samples->count; i++)
+        {
+            sum += samples->ns[i];
+        }
+        printf("%-11s %10zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", span_names[span], samples->count,
+               sum / samples->count / 1e3, percentile_us(samples, 0.5), percentile_us(samples, 0.9),
+               percentile_us(samples, 0.99), percentile_us(samples, 0.999), samples->ns[samples->count - 1] / 1e3);
+    }
+}
+
+// Print the latency distribution of every span in the trace files written
+// by the server, or the spans as a Chrome trace with -j
+int main(int argc, char *argv[])
+{
+    int bad = 0, opt, status = 0;
+
+    while ((opt = getopt(argc, argv, "j")) != -1)
+    {
+        if (opt == 'j')
+        {
+            chrome = 1;
+        }
+        else
+        {
+            bad = 1;
+        }
+    }
+    if (bad || optind >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-j] <trace_file>...\n", argv[0]);
+        fprintf(stderr, "  -j  print the spans as Chrome trace JSON instead of their distributions\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (chrome)
+    {
+        printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    }
+    for (; optind < argc; optind++)
+    {
+        if (analyze_file(argv[optind]) == -1)
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+    if (chrome)
+    {
+        printf("\n]}\n");
+    }
+    else
+    {
+        print_distributions();
+    }
+    return status;
+}
@@ -0,0 +1,902 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+#include "uring_loop.h"
+#include "admission.h"
+#include "conn.h"
+#include "file_cache.h"
+#include "stats.h"
+#include "http.h"
+#include "trace.h"
+
+#define UR_MAX_CONNS 1024
+#define UR_SPARE_CONNS 64       // slots left for answering clients with the 503 once the others are taken
+#define UR_ACCEPTS 16           // accepts kept armed, each learning the address of its client
+#define UR_RING_ENTRIES 1024
+#define UR_RECV_BUFFERS 1024
+#define UR_RECV_BUFFER_SIZE 4096
+#define UR_RECV_GROUP 0
+#define UR_FILE_BUFFER_SIZE (32 << 10)
+#define UR_HEADER_ROOM HTTP_HEAD_MAX
+#define UR_FILE_CHUNK (UR_FILE_BUFFER_SIZE - UR_HEADER_ROOM)
+#define UR_STASH 64
+
+// What a completion belongs to, kept in the top half of user_data
+enum uring_op
+{
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_READ,
+    OP_CLOSE_SOCKET,
+    OP_CANCEL,
+    OP_WATCH,
+    OP_OPENED,
+    OP_CONTROL,
+    OP_STOP
+};
+
+#define USER_DATA(op, slot) (((uint64_t)(op) << 32) | (uint32_t)(slot))
+#define USER_DATA_OP(data) ((int)((data) >> 32))
+#define USER_DATA_SLOT(data) ((int)(uint32_t)(data))
+
+// Submission and completion queues mapped from the kernel
+struct ring
+{
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;      // next free sqe, published to *sq_tail on submit
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    int timed_wait;         // io_uring_enter can wait with a timeout
+};
+
+// A connection living in registered file slot `slot`. Requests are answered
+// by conn.c into the output queue of conn, which is sent from here.
+struct uring_conn
+{
+    struct conn conn;       // parser, input buffer, output queue and keep-alive state
+    int active;
+    int closing;
+    int close_submitted;
+    int inflight;           // submitted operations that will still complete
+    int recv_armed;
+    int peer_closed;
+    int sending;            // a send of the output queue is in flight
+
+    // Received buffers that did not fit in the input buffer yet, a ring
+    int stash[UR_STASH];
+    int stash_len[UR_STASH];
+    int stash_head;
+    int stash_count;
+
+    // The send in flight
+    struct iovec iov[CONN_OUT_CHUNKS];
+    struct msghdr msg;
+    char *buf;              // registered buffer: header room followed by file data
+};
+
+struct uring_loop
+{
+    struct ring ring;
+    int listen_fd;
+    struct server_ctx *ctx;
+    unsigned long *requests;
+    struct uring_conn *conns;
+    struct io_uring_buf_ring *buf_ring;
+    unsigned short buf_ring_tail;
+    char *recv_buffers;
+    char *file_buffers;
+    int conn_count;             // slots holding a connection
+    uint64_t dropped_report_ms; // when dropped connections may be reported again
+
+    // Where each armed accept stores the address of its client
+    struct sockaddr_in accept_addr[UR_ACCEPTS];
+    socklen_t accept_addr_len[UR_ACCEPTS];
+};
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg,
+                          size_t arg_size)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int ring_init(struct ring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    // Batch task work into our own io_uring_enter calls, with a roomy completion queue for multishot requests
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    params.cq_entries = entries * 4;
+    ring->fd = io_uring_setup(entries, &params);
+    if (ring->fd == -1 && errno == EINVAL)
+    {
+        // Older kernels lack the optional flags
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        ring->fd = io_uring_setup(entries, &params);
+    }
+    if (ring->fd == -1)
+    {
+        perror("io_uring_setup");
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+    {
+        fprintf(stderr, "io_uring: kernel too old\n");
+        return -1;
+    }
+
+    // The submission and completion rings share one mapping
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+    char *rings = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (rings == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    ring->sq_head = (unsigned *)(rings + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(rings + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(rings + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(rings + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(rings + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+    ring->timed_wait = (params.features & IORING_FEAT_EXT_ARG) != 0;
+
+    // Slot i of the submission ring always points at sqe i
+    unsigned *array = (unsigned *)(rings + params.sq_off.array);
+    unsigned i;
+    for (i = 0; i < params.sq_entries; i++)
+    {
+        array[i] = i;
+    }
+    return 0;
+}
+
+// Hand every queued sqe to the kernel and optionally wait for a completion, for
+// at most timeout_ms unless that is -1. Kernels that cannot bound the wait
+// only check timeouts as completions arrive.
+static int ring_submit(struct ring *ring, unsigned wait, int timeout_ms)
+{
+    unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000LL};
+    struct io_uring_getevents_arg arg = {0, 0, 0, (uint64_t)(uintptr_t)&ts};
+    void *enter_arg = NULL;
+    size_t arg_size = 0;
+    if (wait > 0 && timeout_ms >= 0 && ring->timed_wait)
+    {
+        flags |= IORING_ENTER_EXT_ARG;
+        enter_arg = &arg;
+        arg_size = sizeof(arg);
+    }
+
+    while (1)
+    {
+        int ret = io_uring_enter(ring->fd, to_submit, wait, flags, enter_arg, arg_size);
+        if (ret >= 0 || (errno != EINTR && errno != ETIME))
+        {
+            return ret;
+        }
+        if (errno == ETIME)
+        {
+            return 0;
+        }
+        to_submit = 0;
+    }
+}
+
+// Make sure count sqes can be queued back to back, so linked requests are never split
+static void ring_reserve(struct ring *ring, unsigned count)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail + count - head > ring->sq_entries)
+    {
+        ring_submit(ring, 0, -1);
+    }
+}
+
+static struct io_uring_sqe *ring_get_sqe(struct ring *ring, int op, int slot)
+{
+    ring_reserve(ring, 1);
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail++ & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = USER_DATA(op, slot);
+    return sqe;
+}
+
+// Give a provided receive buffer back to the kernel
+static void recycle_buffer(struct uring_loop *loop, int bid)
+{
+    struct io_uring_buf *buf = &loop->buf_ring->bufs[loop->buf_ring_tail & (UR_RECV_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(loop->recv_buffers + (size_t)bid * UR_RECV_BUFFER_SIZE);
+    buf->len = UR_RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    loop->buf_ring_tail++;
+    __atomic_store_n(&loop->buf_ring->tail, loop->buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+// Register the file slots, file buffers and provided receive buffers
+static int register_resources(struct uring_loop *loop)
+{
+    int fd = loop->ring.fd;
+
+    // A sparse table the sockets are accepted into
+    struct io_uring_rsrc_register files = {.nr = UR_MAX_CONNS, .flags = IORING_RSRC_REGISTER_SPARSE};
+    struct io_uring_file_index_range range = {.off = 0, .len = UR_MAX_CONNS};
+    if (io_uring_register(fd, IORING_REGISTER_FILES2, &files, sizeof(files)) == -1 ||
+        io_uring_register(fd, IORING_REGISTER_FILE_ALLOC_RANGE, &range, 0) == -1)
+    {
+        perror("io_uring_register files");
+        return -1;
+    }
+
+    // One fixed buffer per connection for file data
+    loop->file_buffers = mmap(NULL, (size_t)UR_MAX_CONNS * UR_FILE_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct iovec *iovs = calloc(UR_MAX_CONNS, sizeof(*iovs));
+    if (loop->file_buffers == MAP_FAILED || iovs == NULL)
+    {
+        perror("mmap");
+        return -1;
+    }
+    int i;
+    for (i = 0; i < UR_MAX_CONNS; i++)
+    {
+        iovs[i].iov_base = loop->file_buffers + (size_t)i * UR_FILE_BUFFER_SIZE;
+        iovs[i].iov_len = UR_FILE_BUFFER_SIZE;
+    }
+    int ret = io_uring_register(fd, IORING_REGISTER_BUFFERS, iovs, UR_MAX_CONNS);
+    free(iovs);
+    if (ret == -1)
+    {
+        perror("io_uring_register buffers");
+        return -1;
+    }
+
+    // The ring of buffers the kernel picks from for multishot recv
+    loop->buf_ring = mmap(NULL, UR_RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    loop->recv_buffers = malloc((size_t)UR_RECV_BUFFERS * UR_RECV_BUFFER_SIZE);
+    if (loop->buf_ring == MAP_FAILED || loop->recv_buffers == NULL)
+    {
+        perror("mmap");
+        return -1;
+    }
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t)(uintptr_t)loop->buf_ring,
+        .ring_entries = UR_RECV_BUFFERS,
+        .bgid = UR_RECV_GROUP,
+    };
+    if (io_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        perror("io_uring_register provided buffers");
+        return -1;
+    }
+    for (i = 0; i < UR_RECV_BUFFERS; i++)
+    {
+        recycle_buffer(loop, i);
+    }
+    return 0;
+}
+
+// Accept one client into a free file slot. A multishot accept would share one
+// address buffer among all the clients it takes, so several single ones stay armed.
+static void arm_accept(struct uring_loop *loop, int index)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_ACCEPT, index);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listen_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&loop->accept_addr[index];
+    sqe->addr2 = (uint64_t)(uintptr_t)&loop->accept_addr_len[index];
+    sqe->file_index = IORING_FILE_INDEX_ALLOC;
+    loop->accept_addr_len[index] = sizeof(loop->accept_addr[index]);
+}
+
+static void arm_watch(struct uring_loop *loop)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_WATCH, 0);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = file_cache_fd(loop->ctx->cache);
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+// Wait for the offload pool to open files
+static void arm_opened(struct uring_loop *loop)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_OPENED, 0);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop->ctx->opened.event_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+// Wait for a request of the main thread
+static void arm_control(struct uring_loop *loop)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_CONTROL, 0);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop->ctx->control_fd;
+    sqe->poll32_events = POLLIN;
+}
+
+static void arm_recv(struct uring_loop *loop, struct uring_conn *uc, int slot)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_RECV, slot);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = slot;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = UR_RECV_GROUP;
+    uc->recv_armed = 1;
+    uc->inflight++;
+}
+
+static void cancel_recv(struct uring_loop *loop, struct uring_conn *uc, int slot)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_CANCEL, slot);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = USER_DATA(OP_RECV, slot);
+    uc->inflight++;
+}
+
+// Cancel every request on the connection's socket, such as a send stuck on a client that stopped reading
+static void cancel_all(struct uring_loop *loop, struct uring_conn *uc, int slot)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_CANCEL, slot);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = slot;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED;
+    uc->inflight++;
+}
+
+// Send whatever uc->msg points at
+static void submit_send(struct uring_loop *loop, struct uring_conn *uc, int slot, int msg_flags)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_SEND, slot);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = slot;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t)(uintptr_t)&uc->msg;
+    sqe->msg_flags = MSG_NOSIGNAL | msg_flags;
+    uc->sending = 1;
+    uc->inflight++;
+}
+
+// Send the front of the output queue conn.c filled. Chunks in memory go out in
+// one sendmsg; when a file range follows, they are copied in front of its next
+// piece in the fixed buffer, and the read of that piece is linked to the send.
+// A short read, from a file that shrank, breaks the link and fails the send.
+static void submit_output(struct uring_loop *loop, struct uring_conn *uc, int slot)
+{
+    struct conn *conn = &uc->conn;
+    size_t head_len = 0;
+    int count = 0;
+
+    while (count < conn->out_count && conn->out[(conn->out_head + count) % CONN_OUT_CHUNKS].data != NULL)
+    {
+        const struct out_chunk *chunk = &conn->out[(conn->out_head + count) % CONN_OUT_CHUNKS];
+        uc->iov[count].iov_base = (void *)chunk->data;
+        uc->iov[count].iov_len = chunk->len;
+        head_len += chunk->len;
+        count++;
+    }
+
+    // Bytes in memory too many to fit in front of the file data go out on their own
+    uc->msg.msg_iov = uc->iov;
+    uc->msg.msg_iovlen = count;
+    if (count == conn->out_count || head_len > UR_HEADER_ROOM)
+    {
+        submit_send(loop, uc, slot, count < conn->out_count ? MSG_MORE : 0);
+        return;
+    }
+
+    const struct out_chunk *file = &conn->out[(conn->out_head + count) % CONN_OUT_CHUNKS];
+    char *data = uc->buf + UR_HEADER_ROOM;
+    char *start = data - head_len;
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        memcpy(start, uc->iov[i].iov_base, uc->iov[i].iov_len);
+        start += uc->iov[i].iov_len;
+    }
+    size_t len = file->len < UR_FILE_CHUNK ? file->len : UR_FILE_CHUNK;
+
+    ring_reserve(&loop->ring, 2);
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_READ, slot);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = file->file_fd;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = len;
+    sqe->off = file->offset;
+    sqe->buf_index = slot;
+    uc->inflight++;
+
+    uc->iov[0].iov_base = data - head_len;
+    uc->iov[0].iov_len = head_len + len;
+    uc->msg.msg_iovlen = 1;
+    submit_send(loop, uc, slot, 0);
+}
+
+// Tear a connection down once nothing in the kernel refers to it any more
+static void finish_close(struct uring_loop *loop, struct uring_conn *uc, int slot)
+{
+    if (!uc->closing || uc->inflight > 0 || uc->close_submitted)
+    {
+        return;
+    }
+
+    // Sends are done with the queued output now
+    conn_cleanup(&uc->conn);
+
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_CLOSE_SOCKET, slot);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+    uc->close_submitted = 1;
+    uc->inflight++;
+}
+
+static void begin_close(struct uring_loop *loop, struct uring_conn *uc, int slot)
+{
+    if (uc->closing)
+    {
+        return;
+    }
+    uc->closing = 1;
+
+    if (uc->recv_armed)
+    {
+        cancel_recv(loop, uc, slot);
+    }
+    finish_close(loop, uc, slot);
+}
+
+static void process_input(struct uring_loop *loop, struct uring_conn *uc, int slot);
+
+// The response went out completely
+static void response_done(struct uring_loop *loop, struct uring_conn *uc, int slot)
+{
+    conn_finish_response(&uc->conn);
+    if (!uc->conn.keep_alive)
+    {
+        begin_close(loop, uc, slot);
+        return;
+    }
+    process_input(loop, uc, slot);
+}
+
+// Move stashed receive buffers into the input buffer as far as they fit
+static void drain_stash(struct uring_loop *loop, struct uring_conn *uc)
+{
+    struct conn *conn = &uc->conn;
+
+    while (uc->stash_count > 0 && conn->in_len + uc->stash_len[uc->stash_head] <= sizeof(conn->in_buf))
+    {
+        int bid = uc->stash[uc->stash_head];
+        memcpy(conn->in_buf + conn->in_len, loop->recv_buffers + (size_t)bid * UR_RECV_BUFFER_SIZE,
+               uc->stash_len[uc->stash_head]);
+        conn->in_len += uc->stash_len[uc->stash_head];
+        recycle_buffer(loop, bid);
+        uc->stash_head = (uc->stash_head + 1) % UR_STASH;
+        uc->stash_count--;
+    }
+}
+
+// Answer the next buffered request, or wait for more input
+static void process_input(struct uring_loop *loop, struct uring_conn *uc, int slot)
+{
+    struct conn *conn = &uc->conn;
+
+    if (uc->sending || uc->closing || conn_wants_write(conn) || conn_waiting(conn))
+    {
+        return;
+    }
+
+    // The request and its response are handled like on the other loops; only the I/O is ours
+    drain_stash(loop, uc);
+    unsigned long requests = conn->requests;
+    if (conn->in_len > 0 && conn_answer(conn, loop->ctx))
+    {
+        __atomic_store_n(loop->requests, *loop->requests + conn->requests - requests, __ATOMIC_RELAXED);
+        if (!conn_waiting(conn))
+        {
+            submit_output(loop, uc, slot);
+        }
+        return;
+    }
+
+    conn->state = conn->in_len > 0 ? CONN_READING_HEADERS : CONN_IDLE;
+    if (uc->peer_closed)
+    {
+        begin_close(loop, uc, slot);
+    }
+    else if (!uc->recv_armed && uc->stash_count == 0)
+    {
+        arm_recv(loop, uc, slot);
+    }
+}
+
+static void handle_accept(struct uring_loop *loop, int index, struct io_uring_cqe *cqe)
+{
+    // Take the address before the accept is armed again and overwrites it
+    struct sockaddr_in peer = loop->accept_addr[index];
+    if (!loop->ctx->draining)
+    {
+        arm_accept(loop, index);
+    }
+    if (cqe->res == -ENFILE)
+    {
+        // Every slot is taken and the kernel reset the connection; say so at most once a second
+        stats_add(&stats_thread()->dropped, 1);
+        if (loop->ctx->timers.now >= loop->dropped_report_ms)
+        {
+            fprintf(stderr, "accept: all %d connection slots of a worker are taken, dropping connections\n",
+                    UR_MAX_CONNS);
+            loop->dropped_report_ms = loop->ctx->timers.now + 1000;
+        }
+        return;
+    }
+    if (cqe->res < 0)
+    {
+        if (cqe->res != -ECANCELED)
+        {
+            fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+        }
+        return;
+    }
+
+    int slot = cqe->res;
+    struct uring_conn *uc = &loop->conns[slot];
+    memset(uc, 0, offsetof(struct uring_conn, iov));
+    conn_init(&uc->conn, slot);
+    loop->conn_count++;
+
+    // A client turned away still gets a connection, whose first request is answered
+    // with the 503. The last slots are kept for that, since a connection without one is reset.
+    uc->conn.admitted = loop->conn_count <= UR_MAX_CONNS - UR_SPARE_CONNS &&
+                        admission_admit(&loop->ctx->load, peer.sin_addr.s_addr) == ADMISSION_OK;
+    if (!uc->conn.admitted)
+    {
+        stats_add(&stats_thread()->rejected, 1);
+    }
+    uc->conn.peer_addr = peer.sin_addr.s_addr;
+    uc->conn.peer_port = ntohs(peer.sin_port);
+    uc->active = 1;
+    uc->buf = loop->file_buffers + (size_t)slot * UR_FILE_BUFFER_SIZE;
+    uc->msg.msg_iov = uc->iov;
+    arm_recv(loop, uc, slot);
+    conn_schedule_timeout(&uc->conn, loop->ctx);
+}
+
+static void handle_recv(struct uring_loop *loop, struct uring_conn *uc, int slot, struct io_uring_cqe *cqe)
+{
+    struct conn *conn = &uc->conn;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        uc->recv_armed = 0;
+        uc->inflight--;
+    }
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+    {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        const char *data = loop->recv_buffers + (size_t)bid * UR_RECV_BUFFER_SIZE;
+
+        if (!uc->closing && conn->in_len == 0 && uc->stash_count == 0)
+        {
+            TRACE_PHASE(TRACE_READ, conn->fd);
+        }
+        if (uc->closing)
+        {
+            recycle_buffer(loop, bid);
+        }
+        else if (uc->stash_count == 0 && conn->in_len + cqe->res <= sizeof(conn->in_buf))
+        {
+            memcpy(conn->in_buf + conn->in_len, data, cqe->res);
+            conn->in_len += cqe->res;
+            recycle_buffer(loop, bid);
+        }
+        else if (uc->stash_count < UR_STASH)
+        {
+            // The client is ahead of us; hold on to the data and stop receiving until we catch up.
+            // Completions already posted still arrive, so the stash has to absorb a full batch.
+            int tail = (uc->stash_head + uc->stash_count) % UR_STASH;
+            uc->stash[tail] = bid;
+            uc->stash_len[tail] = cqe->res;
+            uc->stash_count++;
+            if (uc->recv_armed && uc->stash_count == 1)
+            {
+                cancel_recv(loop, uc, slot);
+            }
+        }
+        else
+        {
+            recycle_buffer(loop, bid);
+            begin_close(loop, uc, slot);
+        }
+    }
+    else if (cqe->res == 0)
+    {
+        uc->peer_closed = 1;
+    }
+    else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+    {
+        begin_close(loop, uc, slot);
+    }
+
+    process_input(loop, uc, slot);
+}
+
+static void handle_send(struct uring_loop *loop, struct uring_conn *uc, int slot, struct io_uring_cqe *cqe)
+{
+    uc->inflight--;
+    uc->sending = 0;
+    if (uc->closing)
+    {
+        return;
+    }
+    if (cqe->res < 0)
+    {
+        begin_close(loop, uc, slot);
+        return;
+    }
+
+    // Drop what went out and send the rest
+    conn_output_sent(&uc->conn, cqe->res);
+    if (conn_wants_write(&uc->conn))
+    {
+        submit_output(loop, uc, slot);
+        return;
+    }
+    response_done(loop, uc, slot);
+}
+
+// Send the responses to the requests whose files the offload pool opened
+static void handle_opened(struct uring_loop *loop)
+{
+    struct offload_job *job = offload_queue_take(&loop->ctx->opened);
+    while (job != NULL)
+    {
+        struct offload_job *next = job->next;
+        struct conn *conn = conn_complete_open(loop->ctx, job);
+        if (conn != NULL)
+        {
+            struct uring_conn *uc = (struct uring_conn *)((char *)conn - offsetof(struct uring_conn, conn));
+            int slot = uc - loop->conns;
+            __atomic_store_n(loop->requests, *loop->requests + 1, __ATOMIC_RELAXED);
+            if (!uc->closing)
+            {
+                submit_output(loop, uc, slot);
+                conn_schedule_timeout(conn, loop->ctx);
+            }
+        }
+        job = next;
+    }
+}
+
+// Stop taking clients for a reload, leaving them to the successor sharing the
+// listener, and have every connection close after its next response
+static void start_draining(struct uring_loop *loop)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&loop->ring, OP_STOP, 0);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = loop->listen_fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_FD;
+
+    int slot;
+    for (slot = 0; slot < UR_MAX_CONNS; slot++)
+    {
+        struct uring_conn *uc = &loop->conns[slot];
+        if (uc->active && !uc->closing)
+        {
+            conn_drain(&uc->conn, loop->ctx);
+        }
+    }
+}
+
+// Whether any connection is still open or closing
+static int conns_left(const struct uring_loop *loop)
+{
+    int slot;
+    for (slot = 0; slot < UR_MAX_CONNS; slot++)
+    {
+        if (loop->conns[slot].active)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void handle_completion(struct uring_loop *loop, struct io_uring_cqe *cqe)
+{
+    int op = USER_DATA_OP(cqe->user_data);
+    int slot = USER_DATA_SLOT(cqe->user_data);
+    struct uring_conn *uc = &loop->conns[slot];
+
+    switch (op)
+    {
+    case OP_ACCEPT:
+        handle_accept(loop, slot, cqe);
+        return;
+    case OP_WATCH:
+        file_cache_process_events(loop->ctx->cache);
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            arm_watch(loop);
+        }
+        return;
+    case OP_OPENED:
+        handle_opened(loop);
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            arm_opened(loop);
+        }
+        return;
+    case OP_CONTROL:
+        if (server_ctx_control(loop->ctx))
+        {
+            start_draining(loop);
+        }
+        else
+        {
+            arm_control(loop);
+        }
+        return;
+    case OP_STOP:
+        return;
+    case OP_RECV:
+        handle_recv(loop, uc, slot, cqe);
+        break;
+    case OP_SEND:
+        handle_send(loop, uc, slot, cqe);
+        break;
+    case OP_READ:
+    case OP_CANCEL:
+        uc->inflight--;
+        if (op == OP_CANCEL)
+        {
+            process_input(loop, uc, slot);
+        }
+        break;
+    case OP_CLOSE_SOCKET:
+        uc->inflight--;
+        while (uc->stash_count > 0)
+        {
+            recycle_buffer(loop, uc->stash[uc->stash_head]);
+            uc->stash_head = (uc->stash_head + 1) % UR_STASH;
+            uc->stash_count--;
+        }
+        uc->active = 0;
+        loop->conn_count--;
+        return;
+    }
+
+    finish_close(loop, uc, slot);
+    if (!uc->closing)
+    {
+        conn_schedule_timeout(&uc->conn, loop->ctx);
+    }
+}
+
+// A connection's timer fired: close it if it was idle or too slow
+static void expire_conn(struct timer *timer, void *arg)
+{
+    struct uring_loop *loop = arg;
+    struct uring_conn *uc = (struct uring_conn *)((char *)conn_of_timer(timer) - offsetof(struct uring_conn, conn));
+    int slot = uc - loop->conns;
+
+    if (uc->closing || !conn_timed_out(&uc->conn, loop->ctx))
+    {
+        return;
+    }
+    if (uc->sending)
+    {
+        cancel_all(loop, uc, slot);
+    }
+    begin_close(loop, uc, slot);
+}
+
+int uring_loop_run(int listen_fd, struct server_ctx *ctx, unsigned long *requests)
+{
+    struct uring_loop loop;
+
+    memset(&loop, 0, sizeof(loop));
+    loop.listen_fd = listen_fd;
+    loop.ctx = ctx;
+    loop.requests = requests;
+    loop.conns = calloc(UR_MAX_CONNS, sizeof(*loop.conns));
+    if (loop.conns == NULL || ring_init(&loop.ring, UR_RING_ENTRIES) == -1 || register_resources(&loop) == -1)
+    {
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < UR_ACCEPTS; i++)
+    {
+        arm_accept(&loop, i);
+    }
+    arm_control(&loop);
+    if (ctx->cache != NULL)
+    {
+        arm_watch(&loop);
+    }
+    if (ctx->offload != NULL)
+    {
+        arm_opened(&loop);
+    }
+
+    // Event loop: submit everything queued, wait for at least one completion or
+    // the next timeout, close the connections that timed out and handle the completions
+    while (1)
+    {
+        if (ring_submit(&loop.ring, 1, conn_wait_timeout(ctx)) == -1)
+        {
+            perror("io_uring_enter");
+            exit(EXIT_FAILURE);
+        }
+        uint64_t batch_start = stats_now();
+        timer_wheel_advance(&ctx->timers, timer_now_ms(), expire_conn, &loop);
+
+        unsigned head = *loop.ring.cq_head;
+        unsigned tail = __atomic_load_n(loop.ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            handle_completion(&loop, &loop.ring.cqes[head & loop.ring.cq_mask]);
+            head++;
+            __atomic_store_n(loop.ring.cq_head, head, __ATOMIC_RELEASE);
+        }
+        if (ctx->draining && !conns_left(&loop))
+        {
+            return 0;
+        }
+
+        // Shed load while the batch took too long or too many files wait for the pool
+        admission_update(&ctx->load, stats_now() - batch_start, ctx->num_offloaded);
+    }
+
+    return 0;
+}
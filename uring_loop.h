@@ -0,0 +1,14 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+struct server_ctx;
+
+// Serve the connections arriving on listen_fd with an io_uring event loop:
+// accepts into registered file slots, multishot recv into provided buffers,
+// and sendmsg, linked to a read into a fixed buffer for file data, for the
+// responses conn.c queues. requests is advanced for every request answered.
+// Returns 0 once the loop drained for a reload, -1 if io_uring or one of the
+// features it needs is unavailable.
+int uring_loop_run(int listen_fd, struct server_ctx *ctx, unsigned long *requests);
+
+#endif